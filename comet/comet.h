@@ -13,13 +13,60 @@ extern "C" {
     void init_comet(VM* vm);
     void init_stdlib(VM* vm);
 
+    typedef struct
+    {
+        uint32_t collections;
+        uint32_t full_collections;
+        // Time the other threads were stopped for, in nanoseconds
+        uint64_t total_pause_ns;
+        uint64_t max_pause_ns;
+        // Since the interpreter started
+        size_t bytes_allocated;
+        size_t bytes_freed;
+        size_t heap_size;
+        // The heap size at which the next collection runs
+        size_t next_collection;
+        // Objects on the heap that haven't been found to be unreachable yet
+        size_t live_objects[NUM_OBJ_TYPES];
+        // Instances, by the type of the class (CLS_USER_DEF for script classes)
+        size_t live_instances[NUM_CLASS_TYPES];
+    } GCStats;
+
+    // Stops every thread while the heap is counted, so it's not for calling
+    // in a tight loop
+    void gc_get_stats(GCStats* stats);
+    const char* gc_obj_type_name(ObjType type);
+
+    typedef struct
+    {
+        // The class name for instances, otherwise the object type
+        const char* name;
+        size_t count;
+        size_t bytes;
+    } GCCensusEntry;
+
+    // Both run a full collection first, so only reachable objects are
+    // counted. Returns the number of entries, largest first. Free them with
+    // gc_free_census().
+    int gc_heap_census(GCCensusEntry** entries);
+    void gc_free_census(GCCensusEntry* entries, int count);
+    // Writes every reachable object, its size and what it references to path,
+    // see docs/stdlib/gc.md for the format
+    bool gc_write_heap_snapshot(const char* path);
+
     VALUE obj_hash(VM* vm, VALUE self, int arg_count, VALUE* arguments);
+    uint32_t obj_get_hash(VALUE self);
+    bool obj_is_identical(VALUE self, VALUE other);
 
     VALUE string_create(VM* vm, char* chars, int length);
     int string_compare_to_cstr(VALUE self, const char* cstr);
     const char* string_get_cstr(VALUE self);
     VALUE string_hash(VM* vm, VALUE self, int arg_count, VALUE* arguments);
     uint32_t string_hash_cstr(const char* string, int length);
+    uint32_t string_get_hash(VALUE self);
+    bool string_is_interned(VALUE self);
+    void string_set_interned(VALUE self);
+    bool string_is_equal(VALUE self, VALUE other);
 
     void exception_set_stacktrace(VM* vm, VALUE self, VALUE stacktrace);
     VALUE exception_get_stacktrace(VM* vm, VALUE self);
@@ -30,6 +77,7 @@ extern "C" {
 
     VALUE create_number(VM* vm, double number);
     double number_get_value(VALUE self);
+    uint32_t number_get_hash(VALUE self);
     VALUE number_operator(VM* vm, VALUE self, VALUE* arguments, OPERATOR op);
 
     VALUE list_create(VM* vm);
@@ -14,6 +14,8 @@
 
 static VM virtualMachine;
 
+#define GC_OPTION_PREFIX "--gc-"
+
 static int startingArg = 2;
 
 static void repl()
@@ -82,8 +84,24 @@ void initArgv(VM *vm, int argc, const char **argv)
         list_add(vm, argv_list, 1, &arg);
         pop(vm);
     }
-    addGlobal(copyString(vm, "ARGV", 4), argv_list);
-    pop(vm);
+    push(vm, copyInternedString(vm, "ARGV", 4));
+    addGlobal(peek(vm, 0), argv_list);
+    popMany(vm, 2);
+}
+
+// --gc-<name>=<value>
+static bool setGCOptionFromArg(const char *arg)
+{
+    const char *equals = strchr(arg, '=');
+    if (equals == NULL || equals == arg)
+        return false;
+    char name[32];
+    size_t length = equals - arg;
+    if (length >= sizeof(name))
+        return false;
+    memcpy(name, arg, length);
+    name[length] = '\0';
+    return setGarbageCollectionOption(name, equals + 1);
 }
 
 int main(int argc, const char **argv)
@@ -99,25 +117,48 @@ int main(int argc, const char **argv)
             }
         }
     }
+    // Interpreter options come before the script, anything after it is left for the script in ARGV
+    for (; startingArg <= argc; startingArg++)
+    {
+        const char *option = argv[startingArg - 1];
+        if (strcmp(option, "--coverage") == 0)
+        {
+            // Has to happen before anything is compiled, otherwise there is nothing to count into
+            enableCoverage();
+        }
+        else if (strncmp(option, GC_OPTION_PREFIX, strlen(GC_OPTION_PREFIX)) == 0)
+        {
+            if (!setGCOptionFromArg(option + strlen(GC_OPTION_PREFIX)))
+            {
+                fprintf(stderr, "Invalid garbage collection option '%s'\n", option);
+                exit(64);
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
     init_comet(&virtualMachine);
 
     initArgv(&virtualMachine, argc, argv);
     const char *version_string = stringify_value(VERSION_STRING);
-    addGlobal(
-        copyString(&virtualMachine, "COMET_VERSION", 13),
-        copyString(&virtualMachine, version_string, strlen(version_string)));
+    push(&virtualMachine, copyInternedString(&virtualMachine, "COMET_VERSION", 13));
+    push(&virtualMachine, copyString(&virtualMachine, version_string, strlen(version_string)));
+    addGlobal(peek(&virtualMachine, 1), peek(&virtualMachine, 0));
+    popMany(&virtualMachine, 2);
 
-    if (argc == 1)
+    if (argc == startingArg - 1)
     {
         repl();
     }
-    else if (argc >= 2)
+    else if (argc >= startingArg)
     {
         runFile(argv[startingArg-1]);
     }
     else
     {
-        fprintf(stderr, "Usage: comet [path]\n");
+        fprintf(stderr, "Usage: comet [--coverage] [--gc-<option>=<value>...] [path]\n");
         exit(64);
     }
 
@@ -3,18 +3,19 @@
 
 void init_comet(VM* vm)
 {
+    initializeGarbageCollection();
     initGlobals();
     initVM(vm);
     init_stdlib(vm);
-    common_strings[STRING_INIT] = copyString(vm, "init", 4);
-    common_strings[STRING_HASH] = copyString(vm, "hash", 4);
-    common_strings[STRING_TO_STRING] = copyString(vm, "to_string", 9);
-    common_strings[STRING_LAMBDA] = copyString(vm, "(|lambda|)", 10);
-    common_strings[STRING_EMPTY_Q] = copyString(vm, "empty?", 6);
-    common_strings[STRING_NUMBER] = copyString(vm, "Number", 6);
-    common_strings[STRING_SCRIPT] = copyString(vm, "<script>", 8);
-    common_strings[STRING_FUNCTION] = copyString(vm, "Function", 8);
-    common_strings[STRING_ADD] = copyString(vm, "add", 3);
+    common_strings[STRING_INIT] = copyInternedString(vm, "init", 4);
+    common_strings[STRING_HASH] = copyInternedString(vm, "hash", 4);
+    common_strings[STRING_TO_STRING] = copyInternedString(vm, "to_string", 9);
+    common_strings[STRING_LAMBDA] = copyInternedString(vm, "(|lambda|)", 10);
+    common_strings[STRING_EMPTY_Q] = copyInternedString(vm, "empty?", 6);
+    common_strings[STRING_NUMBER] = copyInternedString(vm, "Number", 6);
+    common_strings[STRING_SCRIPT] = copyInternedString(vm, "<script>", 8);
+    common_strings[STRING_FUNCTION] = copyInternedString(vm, "Function", 8);
+    common_strings[STRING_ADD] = copyInternedString(vm, "add", 3);
 }
 
 void init_stdlib(VM *vm)
@@ -46,4 +47,6 @@ void init_stdlib(VM *vm)
     init_string_builder(vm);
     init_function(vm);
     init_process(vm);
+    init_gc(vm);
+    init_weak_ref(vm);
 }
@@ -53,11 +53,11 @@ static void init_instance(VM *vm, BooleanData_t *instance, ObjClass *klass, bool
 #endif
     instance->obj.klass = klass;
     instance->value = value;
-    initTable(&instance->obj.fields);
+    initInstanceFields(&instance->obj, NULL, 0);
     if (value)
-        push(vm, copyString(vm, "true", 4));
+        push(vm, copyInternedString(vm, "true", 4));
     else
-        push(vm, copyString(vm, "false", 5));
+        push(vm, copyInternedString(vm, "false", 5));
     addGlobal(peek(vm, 0), OBJ_VAL(instance));
     pop(vm);
 }
@@ -84,6 +84,7 @@ void init_boolean(VM *vm)
     bool_class = defineNativeClass(vm, "Boolean", NULL, NULL, NULL, NULL, CLS_BOOLEAN, sizeof(BooleanData_t), true);
     defineNativeMethod(vm, bool_class, &boolean_to_string, "to_string", 0, false);
     defineNativeMethod(vm, bool_class, &boolean_parse, "parse", 1, true);
+    defineNativeHash(bool_class, &obj_get_hash, &obj_is_identical);
     init_instance(vm, &_true, AS_CLASS(bool_class), true);
     init_instance(vm, &_false, AS_CLASS(bool_class), false);
 }
\ No newline at end of file
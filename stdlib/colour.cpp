@@ -60,7 +60,7 @@ static VALUE colour_to_string(VM *vm, VALUE self, int UNUSED(arg_count), VALUE U
 {
     ColourData_t* data = GET_NATIVE_INSTANCE_DATA(ColourData_t, self);
     std::stringstream stream;
-    stream << "(" << data->r << ", " << data->g << ", " << data->b << ")";
+    stream << "(" << (int)data->r << ", " << (int)data->g << ", " << (int)data->b << ")";
     std::string result = stream.str();
     return copyString(vm, result.c_str(), result.length());
 }
@@ -140,7 +140,9 @@ extern "C" {
 
         colour_category = enum_create(vm);
         push(vm, colour_category);
-        addGlobal(copyString(vm, "COLOUR_CATEGORY", 15), colour_category);
+        push(vm, copyInternedString(vm, "COLOUR_CATEGORY", 15));
+        addGlobal(peek(vm, 0), colour_category);
+        pop(vm);
         enum_add_value(vm, colour_category, "BLACK", COLOUR_CAT_BLACK);
         enum_add_value(vm, colour_category, "WHITE", COLOUR_CAT_WHITE);
         enum_add_value(vm, colour_category, "GREY", COLOUR_CAT_GREY);
@@ -16,6 +16,7 @@ extern "C" {
     void init_datetime(VM* vm);
     void init_duration(VM *vm);
     void init_functions(VM* vm);
+    void init_gc(VM *vm);
     void init_hash(VM* vm);
     void init_colour(VM *vm);
     void init_image(VM* vm);
@@ -37,6 +38,7 @@ extern "C" {
     void init_string_builder(VM *vm);
     void init_function(VM *vm);
     void init_process(VM *vm);
+    void init_weak_ref(VM *vm);
 
     VALUE callable_p(VM* vm, int arg_count, VALUE* args);
 
@@ -214,6 +214,22 @@ static VALUE datetime_operator_equals(VM *vm, VALUE self, int UNUSED(arg_count),
     return FALSE_VAL;
 }
 
+static uint32_t datetime_hash(VALUE self)
+{
+    DateTimeData *data = GET_NATIVE_INSTANCE_DATA(DateTimeData, self);
+    uint64_t count = (uint64_t) data->point.get_sys_time().time_since_epoch().count();
+    return (uint32_t) (count ^ (count >> 32));
+}
+
+static bool datetime_equals(VALUE self, VALUE other)
+{
+    if (!IS_INSTANCE_OF_STDLIB_TYPE(other, CLS_DATETIME))
+        return false;
+    DateTimeData *lhs = GET_NATIVE_INSTANCE_DATA(DateTimeData, self);
+    DateTimeData *rhs = GET_NATIVE_INSTANCE_DATA(DateTimeData, other);
+    return lhs->point == rhs->point;
+}
+
 void init_datetime(VM *vm)
 {
     datetime_class = defineNativeClass(vm, "DateTime", NULL, NULL, NULL, NULL, CLS_DATETIME, sizeof(DateTimeData), false);
@@ -231,6 +247,7 @@ void init_datetime(VM *vm)
 
     defineNativeOperator(vm, datetime_class, &datetime_operator_minus, 1, OPERATOR_MINUS);
     defineNativeOperator(vm, datetime_class, &datetime_operator_equals, 1, OPERATOR_EQUALS);
+    defineNativeHash(datetime_class, &datetime_hash, &datetime_equals);
 }
 
 }
@@ -152,6 +152,7 @@ static VALUE enum_add(VM *vm, VALUE self, int arg_count, VALUE *arguments)
     setNativeProperty(vm, self, string_get_cstr(arguments[0]), instance);
     EnumData *data = GET_NATIVE_INSTANCE_DATA(EnumData, self);
     writeValueArray(&data->array, instance);
+    writeBarrier((Obj *)data, instance);
     pop(vm);
     return NIL_VAL;
 }
@@ -205,7 +206,7 @@ VALUE enum_create(VM *vm)
 void enum_add_value(VM *vm, VALUE enum_instance, const char *name, uint64_t value)
 {
     VALUE args[2] = {NIL_VAL};
-    args[0] = copyString(vm, name, strlen(name));
+    args[0] = copyInternedString(vm, name, strlen(name));
     push(vm, args[0]);
     args[1] = create_number(vm, (double)value);
     push(vm, args[1]);
@@ -242,6 +243,7 @@ void init_enum(VM *vm)
     defineNativeMethod(vm, enum_value_class, &enumvalue_init, "init", 2, false);
     defineNativeMethod(vm, enum_value_class, &enumvalue_to_string, "to_string", 0, false);
     defineNativeOperator(vm, enum_value_class, &enumvalue_less_equal, 1, OPERATOR_LESS_EQUAL);
+    defineNativeHash(enum_value_class, &obj_get_hash, &obj_is_identical);
 
     enum_iterator_class = defineNativeClass(
         vm, "EnumIterator", &enum_iterator_constructor, NULL, NULL, "Iterator", CLS_ITERATOR, sizeof(EnumIterator), false);
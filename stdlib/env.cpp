@@ -60,7 +60,9 @@ void init_env(VM *vm)
     defineNativeOperator(vm, klass, &env_get_value, 1, OPERATOR_INDEX);
     VALUE instance = OBJ_VAL(newInstance(vm, AS_CLASS(klass)));
     push(vm, instance);
-    addGlobal(copyString(vm, "ENV", 3), instance);
+    push(vm, copyInternedString(vm, "ENV", 3));
+    addGlobal(peek(vm, 0), instance);
+    pop(vm);
     pop(vm);
 }
 
@@ -86,7 +86,7 @@ VALUE argument_exception_throw_if_nil_or_whitespace(VM* vm, VALUE klass, int UNU
             throw_exception_native(vm, "ArgumentException", "Argument cannot be empty");
             return NIL_VAL;
         }
-        call_function(vm, arguments[0], copyString(vm, "whitespace?", 11), 0, NULL);
+        call_function(vm, arguments[0], copyInternedString(vm, "whitespace?", 11), 0, NULL);
         if (pop(vm) == TRUE_VAL)
         {
             throw_exception_native(vm, "ArgumentException", "Argument cannot be whitespace");
@@ -59,7 +59,9 @@ void init_file(VM* vm)
 
     fopen_params = enum_create(vm);
     push(vm, fopen_params);
-    addGlobal(copyString(vm, "FOPEN", 5), fopen_params);
+    push(vm, copyInternedString(vm, "FOPEN", 5));
+    addGlobal(peek(vm, 0), fopen_params);
+    pop(vm);
     enum_add_value(vm, fopen_params, "READ_ONLY", FOPEN_READ_ONLY);
     enum_add_value(vm, fopen_params, "READ_WRITE", FOPEN_READ_WRITE);
     enum_add_value(vm, fopen_params, "APPEND", FOPEN_APPEND);
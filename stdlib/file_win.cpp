@@ -218,7 +218,8 @@ VALUE file_static_read_all_lines(VM UNUSED(*vm), VALUE UNUSED(klass), int UNUSED
             size_t length = line_end - current;
             VALUE string = copyString(vm, current, length);
             list_add(vm, result, 1, &string);
-            index += length;
+            // Past the newline too, current skips it below
+            index += length + 1;
         }
         else if (current == line_end)
         {
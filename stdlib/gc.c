@@ -0,0 +1,132 @@
+#include "comet.h"
+#include "cometlib.h"
+
+#include <string.h>
+
+// Named after the stdlib class, every exception class counts as Exception
+static const char *class_type_names[NUM_CLASS_TYPES] = {
+    "Boolean",
+    "ConditionVariable",
+    "Colour",
+    "DateTime",
+    "Directory",
+    "Duration",
+    "Enum",
+    "EnumValue",
+    "EnvVars",
+    "Exception",
+    "File",
+    "Function",
+    "GC",
+    "Iterable",
+    "Iterator",
+    "List",
+    "Hash",
+    "Image",
+    "Module",
+    "Mutex",
+    "Nil",
+    "Number",
+    "Object",
+    "Process",
+    "ProcessRunResult",
+    "Set",
+    "Socket",
+    "String",
+    "StringBuilder",
+    "Thread",
+    "WeakHash",
+    "WeakRef",
+    "UserDefined",
+};
+
+static void add_entry(VM *vm, VALUE hash, const char *key, VALUE value)
+{
+    VALUE args[2];
+    push(vm, value);
+    args[0] = copyString(vm, key, strlen(key));
+    push(vm, args[0]);
+    args[1] = value;
+    hash_add(vm, hash, 2, args);
+    popMany(vm, 2);
+}
+
+static VALUE create_counts(VM *vm, const size_t *counts, const char **names, int count)
+{
+    VALUE hash = hash_create(vm);
+    push(vm, hash);
+    for (int i = 0; i < count; i++)
+    {
+        if (counts[i] > 0)
+            add_entry(vm, hash, names[i], create_number(vm, (double)counts[i]));
+    }
+    return pop(vm);
+}
+
+VALUE gc_static_stats(VM *vm, VALUE UNUSED(klass), int UNUSED(arg_count), VALUE UNUSED(*arguments))
+{
+    GCStats stats;
+    gc_get_stats(&stats);
+
+    VALUE result = hash_create(vm);
+    push(vm, result);
+    add_entry(vm, result, "collections", create_number(vm, stats.collections));
+    add_entry(vm, result, "full_collections", create_number(vm, stats.full_collections));
+    add_entry(vm, result, "total_pause", create_number(vm, stats.total_pause_ns / 1e9));
+    add_entry(vm, result, "max_pause", create_number(vm, stats.max_pause_ns / 1e9));
+    add_entry(vm, result, "bytes_allocated", create_number(vm, (double)stats.bytes_allocated));
+    add_entry(vm, result, "bytes_freed", create_number(vm, (double)stats.bytes_freed));
+    add_entry(vm, result, "heap_size", create_number(vm, (double)stats.heap_size));
+    add_entry(vm, result, "next_collection", create_number(vm, (double)stats.next_collection));
+    const char *obj_type_names[NUM_OBJ_TYPES];
+    for (int i = 0; i < NUM_OBJ_TYPES; i++)
+    {
+        obj_type_names[i] = gc_obj_type_name((ObjType)i);
+    }
+    add_entry(vm, result, "objects", create_counts(vm, stats.live_objects, obj_type_names, NUM_OBJ_TYPES));
+    add_entry(vm, result, "instances", create_counts(vm, stats.live_instances, class_type_names, NUM_CLASS_TYPES));
+    return pop(vm);
+}
+
+VALUE gc_static_census(VM *vm, VALUE UNUSED(klass), int UNUSED(arg_count), VALUE UNUSED(*arguments))
+{
+    GCCensusEntry *entries;
+    int count = gc_heap_census(&entries);
+
+    VALUE result = hash_create(vm);
+    push(vm, result);
+    for (int i = 0; i < count; i++)
+    {
+        VALUE entry = hash_create(vm);
+        push(vm, entry);
+        add_entry(vm, entry, "count", create_number(vm, (double)entries[i].count));
+        add_entry(vm, entry, "bytes", create_number(vm, (double)entries[i].bytes));
+        add_entry(vm, result, entries[i].name, entry);
+        pop(vm);
+    }
+    gc_free_census(entries, count);
+    return pop(vm);
+}
+
+VALUE gc_static_write_snapshot(VM *vm, VALUE UNUSED(klass), int UNUSED(arg_count), VALUE *arguments)
+{
+    if (!isObjOfStdlibClassType(arguments[0], CLS_STRING))
+    {
+        throw_exception_native(vm, "ArgumentException", "GC.write_snapshot() needs a path");
+        return NIL_VAL;
+    }
+    const char *path = string_get_cstr(arguments[0]);
+    if (!gc_write_heap_snapshot(path))
+    {
+        throw_exception_native(vm, "IOException", "Could not write a heap snapshot to '%s'", path);
+    }
+    return NIL_VAL;
+}
+
+void init_gc(VM *vm)
+{
+    VALUE klass = defineNativeClass(vm, "GC", NULL, NULL, NULL, NULL, CLS_GC, 0, true);
+    defineNativeMethod(vm, klass, &gc_static_stats, "stats", 0, true);
+    defineNativeMethod(vm, klass, &gc_static_census, "census", 0, true);
+    defineNativeMethod(vm, klass, &gc_static_write_snapshot, "write_snapshot", 1, true);
+}
@@ -27,8 +27,14 @@ typedef struct
 {
     ObjInstance obj;
     int count;
+    // Entries that aren't empty, tombstones included, the table grows by this
+    int used;
     int32_t capacity;
     HashEntry *entries;
+    // Set while the entries are being moved to a bigger array. Hashing a key
+    // can run a collection part way through, the entries moved so far are
+    // only in the new array, which it doesn't know about.
+    bool resizing;
 } HashTable;
 
 typedef struct {
@@ -82,7 +88,7 @@ VALUE hash_iterable_contains_q(VM *vm, VALUE self, int UNUSED(arg_count), VALUE
 {
     HashTable* data = GET_NATIVE_INSTANCE_DATA(HashTable, self);
     VALUE contains = arguments[0];
-    for (int i = 0; i < data->capacity; i++)
+    for (int i = 0; i <= data->capacity; i++)
     {
         HashEntry entry = data->entries[i];
         if (entry.key == NIL_VAL)
@@ -121,8 +127,10 @@ void hash_constructor(void *instanceData)
 {
     HashTable *table = (HashTable *)instanceData;
     table->count = 0;
+    table->used = 0;
     table->capacity = -1;
     table->entries = NULL;
+    table->resizing = false;
 }
 
 void hash_destructor(void *data)
@@ -138,9 +146,7 @@ VALUE hash_create(VM *vm)
 
 static HashEntry *find_entry(VM *vm, HashEntry *entries, int capacity, Value key)
 {
-    call_function(vm, key, common_strings[STRING_HASH], 0, NULL);
-    uint32_t index = ((uint32_t) number_get_value(peek(vm, 0))) & capacity;
-    pop(vm);
+    uint32_t index = get_object_hash(vm, key) & capacity;
     HashEntry *tombstone = NULL;
 
     for (;;)
@@ -236,6 +242,7 @@ static void adjust_capacity(VM *vm, HashTable *table, int capacity)
     }
 
     table->count = 0;
+    table->resizing = true;
     if (table->entries != NULL)
     {
         for (int32_t i = 0; i <= table->capacity; i++)
@@ -251,6 +258,8 @@ static void adjust_capacity(VM *vm, HashTable *table, int capacity)
         }
         FREE_ARRAY(HashEntry, table->entries, table->capacity + 1);
     }
+    table->used = table->count;
+    table->resizing = false;
 
     table->entries = entries;
     table->capacity = capacity;
@@ -265,7 +274,7 @@ VALUE hash_add(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
         return NIL_VAL;
     }
 
-    if (table->count + 1 > (table->capacity + 1) * TABLE_MAX_LOAD)
+    if (table->used + 1 > (table->capacity + 1) * TABLE_MAX_LOAD)
     {
         // Figure out the new table size.
         int capacity = GROW_CAPACITY(table->capacity + 1) - 1;
@@ -277,14 +286,28 @@ VALUE hash_add(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
     HashEntry *entry = find_entry(vm, table->entries, table->capacity, key);
 
     bool isNewKey = entry->key == NIL_VAL;
-    if (isNewKey && IS_NIL(entry->value))
+    if (isNewKey)
+    {
         table->count++;
+        if (IS_NIL(entry->value))
+            table->used++;
+    }
 
     entry->key = key;
     entry->value = value;
+    writeBarrier((Obj *)table, key);
+    writeBarrier((Obj *)table, value);
     return isNewKey;
 }
 
+static void remove_entry(HashTable *table, HashEntry *entry)
+{
+    // Place a tombstone in the entry.
+    entry->key = NIL_VAL;
+    entry->value = TRUE_VAL;
+    table->count--;
+}
+
 VALUE hash_remove(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
 {
     HashTable *table = GET_NATIVE_INSTANCE_DATA(HashTable, self);
@@ -297,10 +320,7 @@ VALUE hash_remove(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
     if (entry == NULL || entry->key == NIL_VAL)
         return false;
 
-    // Place a tombstone in the entry.
-    entry->key = NIL_VAL;
-    entry->value = TRUE_VAL;
-
+    remove_entry(table, entry);
     return TRUE_VAL;
 }
 
@@ -323,7 +343,7 @@ void table_remove_white(VM *vm, HashTable *table)
     {
 #if !REF_COUNT_MEM_MANAGEMENT
         HashEntry *entry = &table->entries[i];
-        if (entry->key != NIL_VAL && !AS_OBJ(entry->key)->isMarked)
+        if (entry->key != NIL_VAL && isObjectUnreachable(AS_OBJ(entry->key)))
         {
             hash_remove(vm, OBJ_VAL(table), 1, &entry->key);
         }
@@ -345,12 +365,61 @@ void hash_mark_contents(VALUE self)
     }
 }
 
+// A WeakHash holds on to its keys weakly, and to each value for only as long
+// as its key is reachable otherwise. Keys that aren't objects are never dropped.
+static bool is_key_reachable(VALUE key)
+{
+    return !IS_OBJ(key) || !isObjectUnreachable(AS_OBJ(key));
+}
+
+static void weak_hash_mark_ephemerons(VALUE self)
+{
+    HashTable *table = GET_NATIVE_INSTANCE_DATA(HashTable, self);
+    // Nothing can be dropped from a table that is being resized
+    if (table->resizing)
+    {
+        hash_mark_contents(self);
+        return;
+    }
+    for (int32_t i = 0; i <= table->capacity; i++)
+    {
+        HashEntry *entry = &table->entries[i];
+        if (entry->key != NIL_VAL && is_key_reachable(entry->key))
+        {
+            markValue(entry->value);
+        }
+    }
+}
+
+static void weak_hash_clear_unreachable(VALUE self)
+{
+    HashTable *table = GET_NATIVE_INSTANCE_DATA(HashTable, self);
+    for (int32_t i = 0; i <= table->capacity; i++)
+    {
+        HashEntry *entry = &table->entries[i];
+        if (entry->key != NIL_VAL && !is_key_reachable(entry->key))
+        {
+            remove_entry(table, entry);
+        }
+    }
+}
+
+static const WeakReferenceCallbacks weak_hash_callbacks = {
+    &weak_hash_mark_ephemerons,
+    &weak_hash_clear_unreachable,
+};
+
+void weak_hash_mark_contents(VALUE self)
+{
+    markWeakReferences(self, &weak_hash_callbacks);
+}
+
 VALUE hash_obj_to_string(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
     HashTable *table = GET_NATIVE_INSTANCE_DATA(HashTable, self);
     std::stringstream stream;
     stream << "{";
-    size_t count = 1;
+    bool first = true;
     for (int32_t i = 0; i <= table->capacity; i++)
     {
         HashEntry *entry = &table->entries[i];
@@ -360,10 +429,10 @@ VALUE hash_obj_to_string(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED
             VALUE key_str = peek(vm, 0);
             call_function(vm, entry->value, common_strings[STRING_TO_STRING], 0, NULL);
             VALUE value_str = peek(vm, 0);
-            stream << string_get_cstr(key_str) << ": " << string_get_cstr(value_str);
-            if (count != table->count - 1)
+            if (!first)
                 stream << ", ";
-            count++;
+            stream << string_get_cstr(key_str) << ": " << string_get_cstr(value_str);
+            first = false;
             popMany(vm, 2);
         }
     }
@@ -421,6 +490,8 @@ void init_hash(VM *vm)
     defineNativeOperator(vm, hash_class, &hash_find, 1, OPERATOR_INDEX);
     defineNativeOperator(vm, hash_class, &hash_add, 2, OPERATOR_INDEX_ASSIGN);
 
+    defineNativeClass(vm, "WeakHash", &hash_constructor, &hash_destructor, &weak_hash_mark_contents, "Hash", CLS_WEAK_HASH, sizeof(HashTable), true);
+
     hash_iterator_class = defineNativeClass(
         vm,
         "HashIterator",
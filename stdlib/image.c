@@ -139,7 +139,9 @@ void init_image(VM* vm)
 
     VALUE image_formats = enum_create(vm);
     push(vm, image_formats);
-    addGlobal(copyString(vm, "IMAGE_FORMAT", 12), image_formats);
+    push(vm, copyInternedString(vm, "IMAGE_FORMAT", 12));
+    addGlobal(peek(vm, 0), image_formats);
+    pop(vm);
     enum_add_value(vm, image_formats, "PNG", IMAGE_TYPE_PNG);
     enum_add_value(vm, image_formats, "JPEG", IMAGE_TYPE_JPEG);
     enum_add_value(vm, image_formats, "BMP", IMAGE_TYPE_BMP);
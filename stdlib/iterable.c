@@ -38,11 +38,11 @@ VALUE iterator_get_next(VM UNUSED(*vm), VALUE UNUSED(self), int UNUSED(arg_count
 
 VALUE iterable_compare(VM* vm, VALUE self, int arg_count, VALUE* arguments, OPERATOR op)
 {
-    VALUE iterator_func_name = copyString(vm, "iterator", strlen("iterator"));
+    VALUE iterator_func_name = copyInternedString(vm, "iterator", strlen("iterator"));
     push(vm, iterator_func_name);
-    VALUE has_next_name = copyString(vm, "has_next?", strlen("has_next?"));
+    VALUE has_next_name = copyInternedString(vm, "has_next?", strlen("has_next?"));
     push(vm, has_next_name);
-    VALUE get_next_name = copyString(vm, "get_next", strlen("get_next"));
+    VALUE get_next_name = copyInternedString(vm, "get_next", strlen("get_next"));
     push(vm, get_next_name);
     call_function(vm, self, iterator_func_name, 0, NULL);
     VALUE iterator = peek(vm, 0);
@@ -84,7 +84,7 @@ void list_destructor(void *instanceData)
     data->entries = nullptr;
 }
 
-VALUE list_add(VM UNUSED(*vm), VALUE self, int arg_count, VALUE *arguments)
+VALUE list_add(VM *vm, VALUE self, int arg_count, VALUE *arguments)
 {
     ListData *data = GET_NATIVE_INSTANCE_DATA(ListData, self);
     for (int i = 0; i < arg_count; i++)
@@ -92,7 +92,11 @@ VALUE list_add(VM UNUSED(*vm), VALUE self, int arg_count, VALUE *arguments)
         if (data->capacity == data->count)
         {
             int new_capacity = GROW_CAPACITY(data->capacity);
+            // Natives add values nothing else refers to yet, e.g. the parts
+            // of a split string
+            push(vm, arguments[i]);
             data->entries = GROW_ARRAY(data->entries, list_node_t, data->capacity, new_capacity);
+            pop(vm);
             for (int i = data->capacity; i < new_capacity; i++)
             {
                 data->entries[i].item = NIL_VAL;
@@ -100,6 +104,7 @@ VALUE list_add(VM UNUSED(*vm), VALUE self, int arg_count, VALUE *arguments)
             data->capacity = new_capacity;
         }
         data->entries[data->count++].item = arguments[i];
+        writeBarrier((Obj *)data, arguments[i]);
     }
     return NIL_VAL;
 }
@@ -121,6 +126,7 @@ VALUE list_union(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
     {
         result_data->entries[result_data->count++].item = other->entries[i].item;
     }
+    rememberObject(AS_OBJ(result));
     return pop(vm);
 }
 
@@ -215,6 +221,7 @@ VALUE list_assign_at(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE *a
         return NIL_VAL;
     }
     data->entries[index].item = arguments[1];
+    writeBarrier((Obj *)data, arguments[1]);
     return NIL_VAL;
 }
 
@@ -53,6 +53,7 @@ void module_set_main(VALUE module, ObjFunction *function)
 {
     module_data_t *data = GET_NATIVE_INSTANCE_DATA(module_data_t, module);
     data->main = function;
+    writeBarrier((Obj *)data, OBJ_VAL(function));
 }
 
 ObjFunction *module_get_main(VALUE module)
@@ -64,11 +65,15 @@ ObjFunction *module_get_main(VALUE module)
 VALUE module_create(VM *vm, const char *filename)
 {
     VALUE instance = OBJ_VAL(newInstance(vm, AS_CLASS(klass)));
+    push(vm, instance);
     module_data_t *data = GET_NATIVE_INSTANCE_DATA(module_data_t, instance);
+    // Modules hold every top-level name in a file, so they go straight to a
+    // table rather than building a long chain of shapes.
+    instanceUseDictionary(&data->obj);
     size_t filenameLen = strlen(filename) + 1;
     data->filename = ALLOCATE(char, filenameLen);
     strncpy(data->filename, filename, filenameLen);
-    return instance;
+    return pop(vm);
 }
 
 void module_mark_contents(VALUE self)
@@ -84,7 +89,7 @@ VALUE module_functions(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*
     module_data_t *data = GET_NATIVE_INSTANCE_DATA(module_data_t, self);
     VALUE keys = list_create(vm);
     push(vm, keys);
-    tableGetKeys(&data->obj.fields, vm, keys);
+    instanceGetFieldNames(&data->obj, vm, keys);
     VALUE iter = list_iterable_iterator(vm, keys, 0, NULL);
     push(vm, iter);
     VALUE has_next = list_iterator_has_next_p(vm, iter, 0, NULL);
@@ -93,7 +98,7 @@ VALUE module_functions(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*
         VALUE field = list_iterator_get_next(vm, iter, 0, NULL);
         push(vm, field);
         VALUE val;
-        tableGet(&data->obj.fields, field, &val);
+        instanceGetField(&data->obj, field, &val);
         if (IS_BOUND_METHOD(val) || IS_FUNCTION(val) || IS_CLOSURE(val) ||
             IS_NATIVE(val) || IS_NATIVE_METHOD(val))
         {
@@ -115,7 +120,7 @@ VALUE module_fields(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arg
     module_data_t *data = GET_NATIVE_INSTANCE_DATA(module_data_t, self);
     VALUE keys = list_create(vm);
     push(vm, keys);
-    tableGetKeys(&data->obj.fields, vm, keys);
+    instanceGetFieldNames(&data->obj, vm, keys);
     VALUE iter = list_iterable_iterator(vm, keys, 0, NULL);
     push(vm, iter);
     VALUE has_next = list_iterator_has_next_p(vm, iter, 0, NULL);
@@ -124,7 +129,7 @@ VALUE module_fields(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arg
         VALUE field = list_iterator_get_next(vm, iter, 0, NULL);
         push(vm, field);
         VALUE val;
-        tableGet(&data->obj.fields, field, &val);
+        instanceGetField(&data->obj, field, &val);
         if (IS_INSTANCE(field) || IS_NATIVE_INSTANCE(field) || IS_NUMBER(field))
         {
             list_add(vm, result, 1, &field);
@@ -148,7 +153,7 @@ VALUE module_index(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
 {
     module_data_t *data = GET_NATIVE_INSTANCE_DATA(module_data_t, self);
     VALUE result;
-    if (tableGet(&data->obj.fields, arguments[0], &result))
+    if (instanceGetField(&data->obj, arguments[0], &result))
     {
         return result;
     }
@@ -178,10 +183,11 @@ static void addExecutionCountsForFunction(VM *vm, VALUE hash, ObjFunction *funct
         int line = chunk->lines[i];
         VALUE line_no = create_number(vm, line);
         push(vm, line_no);
-        VALUE ex_no = create_number(vm, chunk->execution_counts[i]);
+        uint64_t count = chunk->execution_counts != NULL ? chunk->execution_counts[i] : 0;
+        VALUE ex_no = create_number(vm, (double)count);
         push(vm, ex_no);
         VALUE line_val = hash_get(vm, result, 1, &line_no);
-        if (line_val == NIL_VAL || chunk->execution_counts[i] > number_get_value(line_val))
+        if (line_val == NIL_VAL || count > number_get_value(line_val))
         {
             args[0] = line_no;
             args[1] = ex_no;
@@ -239,7 +245,7 @@ VALUE module_get_execution_counts(VM *vm, VALUE self, int UNUSED(arg_count), VAL
     push(vm, result);
     VALUE fields_list = list_create(vm);
     push(vm, fields_list);
-    tableGetValues(&data->obj.fields, vm, fields_list);
+    instanceGetFieldValues(&data->obj, vm, fields_list);
     VALUE fields_iter = list_iterable_iterator(vm, fields_list, 0, NULL);
     push(vm, fields_iter);
     VALUE has_next = list_iterator_has_next_p(vm, fields_iter, 0, NULL);
@@ -23,6 +23,18 @@ static Value clockNative(VM *vm, int UNUSED(argCount), Value UNUSED(*args))
     return create_number(vm, (double)clock() / CLOCKS_PER_SEC);
 }
 
+#if COMET_COUNT_INSTRUCTIONS
+static Value instructionsExecutedNative(VM *vm, int UNUSED(argCount), Value UNUSED(*args))
+{
+    return create_number(vm, (double)vm->instructionCount);
+}
+#endif
+
+static Value coverageEnabledNative(VM UNUSED(*vm), int UNUSED(argCount), Value UNUSED(*args))
+{
+    return isCoverageEnabled() ? TRUE_VAL : FALSE_VAL;
+}
+
 static VALUE printNative(VM *vm, int arg_count, VALUE *args)
 {
     for (int i = 0; i < arg_count; i++)
@@ -75,9 +87,10 @@ VALUE callable_p(VM UNUSED(*vm), int UNUSED(arg_count), VALUE *args)
     return FALSE_VAL;
 }
 
-VALUE fn_sleep(VM UNUSED(*vm), int UNUSED(arg_count), VALUE *args)
+VALUE fn_sleep(VM *vm, int UNUSED(arg_count), VALUE *args)
 {
     double input_time = number_get_value(args[0]);
+    enterSafeRegion(vm);
 #ifdef WIN32
     Sleep(input_time * MILLI_SECONDS_PER_SECOND);
 #else
@@ -86,6 +99,7 @@ VALUE fn_sleep(VM UNUSED(*vm), int UNUSED(arg_count), VALUE *args)
     sleep_time.tv_nsec = (input_time - sleep_time.tv_sec) * NANO_SECONDS_PER_SECOND;
     nanosleep(&sleep_time, &remainder);
 #endif
+    leaveSafeRegion(vm);
     return NIL_VAL;
 }
 
@@ -136,7 +150,9 @@ VALUE get_password(VM *vm, int arg_count, VALUE *args)
         printf("%s", string_get_cstr(peek(vm, 0)));
         pop(vm);
     }
+    enterSafeRegion(vm);
     char *result = fgets(input_line, MAX_INPUT_LINE_SIZE, stdin);
+    leaveSafeRegion(vm);
     set_stdin_echo(true);
     if (result == NULL)
         return NIL_VAL;
@@ -151,7 +167,9 @@ VALUE input(VM *vm, int arg_count, VALUE *args)
         printf("%s", string_get_cstr(peek(vm, 0)));
         pop(vm);
     }
+    enterSafeRegion(vm);
     char *result = fgets(input_line, MAX_INPUT_LINE_SIZE, stdin);
+    leaveSafeRegion(vm);
     if (result == NULL)
         return NIL_VAL;
     return copyString(vm, result, strlen(result));
@@ -183,13 +201,19 @@ void init_functions(VM *vm)
 {
     std_streams = enum_create(vm);
     push(vm, std_streams);
-    addGlobal(copyString(vm, "STD_STREAM", 10), std_streams);
+    push(vm, copyInternedString(vm, "STD_STREAM", 10));
+    addGlobal(peek(vm, 0), std_streams);
+    pop(vm);
     enum_add_value(vm, std_streams, "OUT", STD_STREAM_OUT);
     enum_add_value(vm, std_streams, "ERR", STD_STREAM_ERR);
     pop(vm);
 
     defineNativeFunction(vm, "call_function", &call_func);
     defineNativeFunction(vm, "clock", &clockNative);
+#if COMET_COUNT_INSTRUCTIONS
+    defineNativeFunction(vm, "instructions_executed", &instructionsExecutedNative);
+#endif
+    defineNativeFunction(vm, "coverage_enabled?", &coverageEnabledNative);
     defineNativeFunction(vm, "print", &printNative);
     defineNativeFunction(vm, "print_to", &print_to);
     defineNativeFunction(vm, "input", &input);
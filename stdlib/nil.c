@@ -57,7 +57,7 @@ void init_nil(VM *vm)
     nil_instance.obj.isMarked = false; // doesn't matter, it's static memory anyway
 #endif
     nil_instance.klass = AS_CLASS(klass);
-    initTable(&nil_instance.fields);
+    initInstanceFields(&nil_instance, NULL, 0);
     push(vm, copyString(vm, "nil", 3));
     addGlobal(peek(vm, 0), NIL_VAL);
     pop(vm);
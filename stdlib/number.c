@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <errno.h>
+#include <string.h>
 
 #include "cometlib.h"
 #include "comet_stdlib.h"
@@ -205,6 +206,11 @@ VALUE number_compare(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments
     return number_operator(vm, self, arguments, OPERATOR_EQUALS);
 }
 
+VALUE number_hash(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+{
+    return create_number(vm, (double)number_get_hash(self));
+}
+
 static unsigned int rand_seed;
 VALUE number_random(VM *vm, VALUE UNUSED(klass), int arg_count, VALUE *arguments)
 {
@@ -236,6 +242,23 @@ double number_get_value(VALUE self)
     return NAN;
 }
 
+uint32_t number_get_hash(VALUE self)
+{
+    // 0 and -0 are equal, so they need to hash the same
+    double value = number_get_value(self);
+    if (value == 0)
+        value = 0;
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    // Integral keys only differ in their high bits, mix them down into the
+    // low bits that pick the bucket
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
 void bootstrap_number(VM *vm)
 {
     number_class = bootstrapNativeClass(vm, "Number", NULL, NULL, CLS_NUMBER, 0, true);
@@ -258,6 +281,7 @@ void complete_number(VM *vm)
     defineNativeMethod(vm, number_class, &number_max, "max", 2, true);
     defineNativeMethod(vm, number_class, &number_min, "min", 2, true);
     defineNativeMethod(vm, number_class, &number_clamp, "clamp", 3, true);
+    defineNativeMethod(vm, number_class, &number_hash, "hash", 0, false);
 
     defineNativeOperator(vm, number_class, &number_compare, 1, OPERATOR_EQUALS);
 }
\ No newline at end of file
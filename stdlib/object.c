@@ -45,7 +45,7 @@ VALUE obj_equals(VM *vm, VALUE self, int arg_count, VALUE *arguments)
     return TRUE_VAL;
 }
 
-VALUE obj_hash(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+uint32_t obj_get_hash(VALUE self)
 {
     uint32_t hash = 2166136261u;
     uintptr_t address = (uintptr_t) AS_OBJ(self);
@@ -56,7 +56,17 @@ VALUE obj_hash(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*argument
         hash *= 16777619;
     }
 
-    return create_number(vm, (double) hash);
+    return hash;
+}
+
+bool obj_is_identical(VALUE self, VALUE other)
+{
+    return self == other;
+}
+
+VALUE obj_hash(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+{
+    return create_number(vm, (double) obj_get_hash(self));
 }
 
 // A placeholder such that anyone can call "super.init()"
@@ -78,8 +88,8 @@ VALUE obj_to_string(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arg
     size_t string_len = strlen(instance->klass->name) + strlen(" instance") + 1;
 #endif
     char string[string_len];
-    snprintf(string, string_len, "%s instance", instance->klass->name);
-    return copyString(vm, string, string_len);
+    int length = snprintf(string, string_len, "%s instance", instance->klass->name);
+    return copyString(vm, string, length);
 }
 
 VALUE cls_to_string(VM *vm, VALUE klass, int UNUSED(arg_count), VALUE UNUSED(*arguments))
@@ -94,8 +104,8 @@ VALUE cls_to_string(VM *vm, VALUE klass, int UNUSED(arg_count), VALUE UNUSED(*ar
     size_t string_len = strlen(AS_CLASS(klass)->name) + strlen(" class") + 1;
 #endif
     char string[string_len];
-    snprintf(string, string_len, "%s class", AS_CLASS(klass)->name);
-    return copyString(vm, string, string_len);
+    int length = snprintf(string, string_len, "%s class", AS_CLASS(klass)->name);
+    return copyString(vm, string, length);
 }
 
 VALUE obj_nil_q(VM UNUSED(*vm), VALUE UNUSED(self), int UNUSED(arg_count), VALUE UNUSED(*arguments))
@@ -117,7 +127,7 @@ VALUE obj_fields(VM UNUSED(*vm), VALUE UNUSED(self), int UNUSED(arg_count), VALU
     VALUE list = list_create(vm);
     push(vm, list);
     ObjInstance *obj = AS_INSTANCE(self);
-    tableGetKeys(&obj->fields, vm, list);
+    instanceGetFieldNames(obj, vm, list);
     return pop(vm);
 }
 
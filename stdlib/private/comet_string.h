@@ -4,24 +4,67 @@
 #include "comet.h"
 #include "utf8proc.h"
 
+typedef enum
+{
+    STRING_FLAT,
+    // The concatenation of two strings, copied into one buffer the first time
+    // its characters are needed
+    STRING_ROPE,
+    // Part of another string's characters, shared rather than copied
+    STRING_SLICE,
+} StringKind;
+
 typedef struct
 {
     ObjInstance obj;
+    // In bytes
     size_t length;
+    // Null terminated, only set once needed for a rope or a slice that stops
+    // short of its parent's end. Read them with string_chars() or
+    // string_get_cstr().
     char *chars;
+    // 0 until it's needed
     uint32_t hash;
+    StringKind kind;
+    // In the VM's table of interned strings, see internString()
+    bool interned;
+    // Every character is a single byte, only set once codepoint_length is
+    bool ascii;
+    // In codepoints, -1 until it's needed
+    utf8proc_ssize_t codepoint_length;
+    // Byte offsets of every CODEPOINT_INDEX_STRIDE'th codepoint, only made
+    // for long strings that aren't ASCII once they're indexed into
+    size_t *codepoint_index;
+    union
+    {
+        // Both nil once the rope has been flattened
+        struct
+        {
+            VALUE left;
+            VALUE right;
+        } rope;
+        struct
+        {
+            VALUE parent;
+            const char *start;
+        } slice;
+    } as;
 } StringData;
 
 typedef struct
 {
     ObjInstance obj;
-    StringData *string;
+    VALUE string;
+    const char *chars;
     utf8proc_int32_t current_codepoint;
     utf8proc_ssize_t remaining;
     utf8proc_ssize_t offset;
 } StringIterator;
 
+// The string's characters, which aren't null terminated if it's a slice
+const char *string_get_chars(VALUE self);
+
 bool string_iter_get_next(StringIterator *iter);
 VALUE string_iterator(VM *vm, VALUE self, int arg_count, VALUE *arguments);
 
-#endif
\ No newline at end of file
+#endif
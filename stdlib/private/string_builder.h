@@ -11,4 +11,16 @@ VALUE string_builder_to_string(VM *vm, VALUE self, int arg_count, VALUE *argumen
 
 void string_builder_add_cstr(VM *vm, VALUE self, const char *cstr);
 
+void string_builder_add_chars(VALUE self, const char *chars, size_t length);
+
+void string_builder_add_string(VALUE self, VALUE string);
+
+// Makes room for at least additional more bytes. False, leaving the builder
+// as it was, if that would make it longer than a String can be.
+bool string_builder_reserve(VALUE self, size_t additional);
+
+// Hands the builder's buffer to a new string without copying it, leaving the
+// builder empty
+VALUE string_builder_take_string(VM *vm, VALUE self);
+
 #endif
\ No newline at end of file
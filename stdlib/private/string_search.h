@@ -0,0 +1,18 @@
+#ifndef _COMET_STDLIB_STRING_SEARCH_H_
+#define _COMET_STDLIB_STRING_SEARCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Picks the widest vector instructions the CPU has, until it's called the
+// portable versions are used
+void init_string_search(void);
+
+// The first occurrence of needle in haystack, NULL if there isn't one.
+// Neither has to be null terminated.
+const char *string_search(const char *haystack, size_t haystack_length, const char *needle, size_t needle_length);
+
+// Whether none of the bytes are part of a multi-byte UTF-8 character
+bool string_is_ascii(const char *chars, size_t length);
+
+#endif
@@ -29,13 +29,17 @@ static VALUE result_klass;
 VALUE process_static_run(VM *vm, VALUE UNUSED(self), int UNUSED(arg_count), VALUE *arguments)
 {
     const char *cmd = string_get_cstr(arguments[0]);
+    // The child can run for as long as it likes, so collections on other
+    // threads mustn't wait for it. Nothing here touches the heap.
+    enterSafeRegion(vm);
     FILE *cmd_file = popen(cmd, "r");
     if (cmd_file == nullptr)
     {
-        throw_exception_native(vm, "Exception", "Could not run a process: %s", strerror(errno));
+        int error = errno;
+        leaveSafeRegion(vm);
+        throw_exception_native(vm, "Exception", "Could not run a process: %s", strerror(error));
+        return NIL_VAL;
     }
-    VALUE proc_result = OBJ_VAL(newInstance(vm, AS_CLASS(result_klass)));
-    push(vm, proc_result);
     std::stringstream stream;
     char buffer[256];
     while (!feof(cmd_file)) {
@@ -44,8 +48,12 @@ VALUE process_static_run(VM *vm, VALUE UNUSED(self), int UNUSED(arg_count), VALU
         stream << buffer;
     }
     int result = pclose(cmd_file);
-    setNativeProperty(vm, proc_result, "status_code", create_number(vm, result));
     std::string output = stream.str();
+    leaveSafeRegion(vm);
+
+    VALUE proc_result = OBJ_VAL(newInstance(vm, AS_CLASS(result_klass)));
+    push(vm, proc_result);
+    setNativeProperty(vm, proc_result, "status_code", create_number(vm, result));
     setNativeProperty(vm, proc_result, "output", copyString(vm, output.c_str(), output.length()));
     setNativeProperty(vm, proc_result, "command", arguments[0]);
     return pop(vm);
@@ -11,17 +11,19 @@ extern "C" {
 static VALUE set_class;
 static VALUE set_iterator_class;
 
-typedef struct _set_entry
-{
-    Value key;
-    struct _set_entry *next;
-} SetEntry;
+// Slots that don't hold a value. Neither is a valid Value, so nil can still
+// be stored in a set.
+#define SET_EMPTY ((Value)(QNAN | 1))
+#define SET_TOMBSTONE ((Value)(QNAN | 2))
+
+#define IS_SET_KEY(value) ((value) != SET_EMPTY && (value) != SET_TOMBSTONE)
 
 typedef struct {
     ObjInstance obj;
     int count;
-    int capacity;
-    SetEntry **entries;
+    int tombstones;
+    int32_t capacity;
+    Value *entries;
 } SetData;
 
 typedef struct {
@@ -29,7 +31,6 @@ typedef struct {
     VALUE set;
     int index;
     int returned_count;
-    SetEntry *current;
 } SetIterator;
 
 #define SET_MAX_LOAD_FACTOR 0.75
@@ -37,172 +38,178 @@ typedef struct {
 void set_constructor(void *instanceData)
 {
     SetData *data = (SetData *)instanceData;
-    data->capacity = 0;
+    data->capacity = -1;
     data->count = 0;
+    data->tombstones = 0;
     data->entries = nullptr;
 }
 
 void set_destructor(void *data)
 {
     SetData *set_data = (SetData *)data;
-    for (int i = 0; i < set_data->capacity; i++)
-    {
-        SetEntry *next = nullptr;
-        if (set_data->entries[i] != nullptr)
-        {
-            next = set_data->entries[i]->next;
-            FREE(SetEntry *, set_data->entries[i]);
-        }
-
-        while (next != nullptr)
-        {
-            SetEntry *current = next;
-            next = current->next;
-            FREE(SetEntry *, current);
-        }
-    }
     if (set_data->entries != nullptr)
     {
-        FREE_ARRAY(SetEntry, set_data->entries, set_data->capacity);
+        FREE_ARRAY(Value, set_data->entries, set_data->capacity + 1);
     }
-    set_data->capacity = 0;
-    set_data->count = 0;
-    set_data->entries = nullptr;
+    set_constructor(data);
 }
 
 VALUE set_create(VM *vm)
 {
-    VALUE set = OBJ_VAL(newInstance(vm, AS_CLASS(set_class)));
-    push(vm, set);
-    SetData *data = GET_NATIVE_INSTANCE_DATA(SetData, set);
-    data->capacity = 0;
-    data->count = 0;
-    data->entries = nullptr;
-
-    return pop(vm);
+    return OBJ_VAL(newInstance(vm, AS_CLASS(set_class)));
 }
 
-static uint32_t getIndex(VM *vm, Value value, int capacity)
+// The capacity (one less than the number of slots) needed to hold count values
+// without going over the load factor.
+static int32_t capacity_for(int count)
 {
-    call_function(vm, value, common_strings[STRING_HASH], 0, nullptr);
-    uint32_t result = ((uint32_t) number_get_value(peek(vm, 0))) % capacity;
-    pop(vm);
-    return result;
+    int32_t slots = GROW_CAPACITY(0);
+    while (count > slots * SET_MAX_LOAD_FACTOR)
+        slots *= 2;
+    return slots - 1;
 }
 
-static bool insert(VM *vm, SetEntry **entries, int capacity, SetEntry *entry)
+// Returns the slot holding key, or the slot it should be added to if it isn't
+// in the set, which reuses the first tombstone found.
+static Value *find_slot(VM *vm, Value *entries, int32_t capacity, Value key)
 {
-    uint32_t index = getIndex(vm, entry->key, capacity);
-    if (entries[index] == nullptr)
-    {
-        entries[index] = entry;
-        return true;
-    }
-    else
+    uint32_t index = get_object_hash(vm, key) & capacity;
+    Value *tombstone = nullptr;
+
+    for (;;)
     {
-        SetEntry *current = entries[index];
-        SetEntry *previous = nullptr;
-        while (current != nullptr)
+        Value *slot = &entries[index];
+        if (*slot == SET_EMPTY)
+        {
+            return tombstone != nullptr ? tombstone : slot;
+        }
+        else if (*slot == SET_TOMBSTONE)
+        {
+            if (tombstone == nullptr)
+                tombstone = slot;
+        }
+        else if (compare_objects(vm, key, *slot))
         {
-            if (compare_objects(vm, current->key, entry->key))
-                return false;
-            previous = current;
-            current = current->next;
+            return slot;
         }
-        previous->next = entry;
+
+        index = (index + 1) & capacity;
     }
-    return true;
 }
 
-static void adjust_capacity(VM *vm, SetData *data)
+// Adds a value that is known not to be in the table, and that has no
+// tombstones, so nothing needs comparing.
+static void insert_unique(VM *vm, Value *entries, int32_t capacity, Value key)
+{
+    uint32_t index = get_object_hash(vm, key) & capacity;
+    while (entries[index] != SET_EMPTY)
+    {
+        index = (index + 1) & capacity;
+    }
+    entries[index] = key;
+}
+
+static void adjust_capacity(VM *vm, SetData *data, int32_t capacity)
 {
-    int new_capacity = GROW_CAPACITY(data->capacity);
-    SetEntry **new_entries = ALLOCATE(SetEntry *, new_capacity);
-    memset(new_entries, 0, new_capacity * sizeof(SetEntry *));
-    for (int i = 0; i < data->capacity; i++)
+    Value *entries = ALLOCATE(Value, capacity + 1);
+    for (int32_t i = 0; i <= capacity; i++)
+    {
+        entries[i] = SET_EMPTY;
+    }
+
+    if (data->entries != nullptr)
     {
-        SetEntry *current = data->entries[i];
-        while (current != nullptr)
+        for (int32_t i = 0; i <= data->capacity; i++)
         {
-            insert(vm, new_entries, new_capacity, current);
-            current = current->next;
+            if (IS_SET_KEY(data->entries[i]))
+                insert_unique(vm, entries, capacity, data->entries[i]);
         }
+        FREE_ARRAY(Value, data->entries, data->capacity + 1);
     }
-    if (data->entries != nullptr)
+
+    data->entries = entries;
+    data->capacity = capacity;
+    data->tombstones = 0;
+}
+
+// Makes sure another count values can be added without growing the table
+static void reserve(VM *vm, SetData *data, int count)
+{
+    if (data->count + data->tombstones + count > (data->capacity + 1) * SET_MAX_LOAD_FACTOR)
     {
-        FREE_ARRAY(SetEntry *, data->entries, data->capacity);
+        int32_t capacity = capacity_for(data->count + count);
+        // Don't shrink when it's tombstones that filled the table
+        adjust_capacity(vm, data, capacity > data->capacity ? capacity : data->capacity);
     }
-    data->capacity = new_capacity;
-    data->entries = new_entries;
+}
+
+static bool add_value(VM *vm, SetData *data, Value value)
+{
+    reserve(vm, data, 1);
+    Value *slot = find_slot(vm, data->entries, data->capacity, value);
+    if (IS_SET_KEY(*slot))
+        return false;
+
+    if (*slot == SET_TOMBSTONE)
+        data->tombstones--;
+    *slot = value;
+    data->count++;
+    writeBarrier((Obj *)data, value);
+    return true;
+}
+
+static bool contains_value(VM *vm, SetData *data, Value value)
+{
+    if (data->count == 0)
+        return false;
+    return IS_SET_KEY(*find_slot(vm, data->entries, data->capacity, value));
 }
 
 VALUE set_add(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
 {
     SetData *data = GET_NATIVE_INSTANCE_DATA(SetData, self);
-    if ((data->count + 1) > (data->capacity * SET_MAX_LOAD_FACTOR))
-    {
-        adjust_capacity(vm, data);
-    }
-    SetEntry *new_entry = ALLOCATE(SetEntry, 1);
-    new_entry->next = nullptr;
-    new_entry->key = arguments[0];
-    if (insert(vm, data->entries, data->capacity, new_entry))
-    {
-        data->count++;
+    if (add_value(vm, data, arguments[0]))
         return TRUE_VAL;
-    }
-    else
-    {
-        FREE(SetEntry, new_entry);
-    }
     return FALSE_VAL;
 }
 
 VALUE set_remove(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
 {
     SetData *data = GET_NATIVE_INSTANCE_DATA(SetData, self);
-    for (int i = 0; i < data->capacity; i++)
-    {
-        SetEntry *current = data->entries[i];
-        SetEntry *previous = nullptr;
-        while (current != nullptr)
-        {
-            if (compare_objects(vm, current->key, arguments[0]))
-            {
-                VALUE result = current->key;
-                push(vm, result);
-                if (previous == nullptr)
-                {
-                    data->entries[i] = current->next;
-                }
-                else
-                {
-                    previous->next = current->next;
-                }
-                FREE(SetEntry, current);
-                data->count--;
-                return pop(vm);
-            }
-            previous = current;
-            current = current->next;
-        }
-    }
-    return NIL_VAL;
+    if (data->count == 0)
+        return NIL_VAL;
+
+    Value *slot = find_slot(vm, data->entries, data->capacity, arguments[0]);
+    if (!IS_SET_KEY(*slot))
+        return NIL_VAL;
+
+    VALUE result = *slot;
+    *slot = SET_TOMBSTONE;
+    data->count--;
+    data->tombstones++;
+    return result;
 }
 
 VALUE set_iterable_contains_q(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
 {
     SetData *data = GET_NATIVE_INSTANCE_DATA(SetData, self);
-    uint32_t index = getIndex(vm, arguments[0], data->capacity);
-    SetEntry *current = data->entries[index];
-    while (current != nullptr)
+    if (contains_value(vm, data, arguments[0]))
+        return TRUE_VAL;
+    return FALSE_VAL;
+}
+
+// Creates the set for the result of a bulk operation, sized up front for
+// count values so that it never has to grow part way through.
+static VALUE create_presized(VM *vm, int count)
+{
+    VALUE result = set_create(vm);
+    push(vm, result);
+    if (count > 0)
     {
-        if (compare_objects(vm, current->key, arguments[0])) {
-            return TRUE_VAL;
-        }
-        current = current->next;
+        SetData *data = GET_NATIVE_INSTANCE_DATA(SetData, result);
+        adjust_capacity(vm, data, capacity_for(count));
     }
-    return FALSE_VAL;
+    return result;
 }
 
 VALUE set_union(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
@@ -212,28 +219,22 @@ VALUE set_union(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
         throw_exception_native(vm, "ArgumentException", "Only another Set may be unioned with a set");
         return NIL_VAL;
     }
-    VALUE result = set_create(vm);
-    push(vm, result);
     SetData *data = GET_NATIVE_INSTANCE_DATA(SetData, self);
-    for (int i = 0; i < data->capacity; i++)
+    SetData *other = GET_NATIVE_INSTANCE_DATA(SetData, arguments[0]);
+    VALUE result = create_presized(vm, data->count + other->count);
+    SetData *result_data = GET_NATIVE_INSTANCE_DATA(SetData, result);
+    for (int32_t i = 0; i <= data->capacity; i++)
     {
-        SetEntry *entry = data->entries[i];
-        while (entry != nullptr)
-        {
-            set_add(vm, result, 1, &entry->key);
-            entry = entry->next;
-        }
+        if (IS_SET_KEY(data->entries[i]))
+            insert_unique(vm, result_data->entries, result_data->capacity, data->entries[i]);
     }
-    SetData *other = GET_NATIVE_INSTANCE_DATA(SetData, arguments[0]);
-    for (int i = 0; i < other->capacity; i++)
+    result_data->count = data->count;
+    for (int32_t i = 0; i <= other->capacity; i++)
     {
-        SetEntry *entry = other->entries[i];
-        while (entry != nullptr)
-        {
-            set_add(vm, result, 1, &entry->key);
-            entry = entry->next;
-        }
+        if (IS_SET_KEY(other->entries[i]))
+            add_value(vm, result_data, other->entries[i]);
     }
+    rememberObject(AS_OBJ(result));
     return pop(vm);
 }
 
@@ -244,19 +245,23 @@ VALUE set_intersect(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
         throw_exception_native(vm, "ArgumentException", "Only another Set may be intersected with a set");
         return NIL_VAL;
     }
-    VALUE result = set_create(vm);
-    push(vm, result);
-    SetData *data = GET_NATIVE_INSTANCE_DATA(SetData, arguments[0]);
-    for (int i = 0; i < data->capacity; i++)
+    SetData *data = GET_NATIVE_INSTANCE_DATA(SetData, self);
+    SetData *other = GET_NATIVE_INSTANCE_DATA(SetData, arguments[0]);
+    // Only the smaller set needs walking, and it bounds the size of the result
+    SetData *smaller = data->count < other->count ? data : other;
+    SetData *larger = smaller == data ? other : data;
+    VALUE result = create_presized(vm, smaller->count);
+    SetData *result_data = GET_NATIVE_INSTANCE_DATA(SetData, result);
+    for (int32_t i = 0; i <= smaller->capacity; i++)
     {
-        SetEntry *entry = data->entries[i];
-        while (entry != nullptr)
+        Value value = smaller->entries[i];
+        if (IS_SET_KEY(value) && contains_value(vm, larger, value))
         {
-            if (set_iterable_contains_q(vm, self, 1, &entry->key) == TRUE_VAL)
-                set_add(vm, result, 1, &entry->key);
-            entry = entry->next;
+            insert_unique(vm, result_data->entries, result_data->capacity, value);
+            result_data->count++;
         }
     }
+    rememberObject(AS_OBJ(result));
     return pop(vm);
 }
 
@@ -267,20 +272,20 @@ VALUE set_difference(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments
         throw_exception_native(vm, "ArgumentException", "Only another Set may be differed with a set");
         return NIL_VAL;
     }
-    VALUE result = set_create(vm);
-    push(vm, result);
     SetData *data = GET_NATIVE_INSTANCE_DATA(SetData, self);
-    for (int i = 0; i < data->capacity; i++)
+    SetData *other = GET_NATIVE_INSTANCE_DATA(SetData, arguments[0]);
+    VALUE result = create_presized(vm, data->count);
+    SetData *result_data = GET_NATIVE_INSTANCE_DATA(SetData, result);
+    for (int32_t i = 0; i <= data->capacity; i++)
     {
-        SetEntry *entry = data->entries[i];
-        while (entry != nullptr)
+        Value value = data->entries[i];
+        if (IS_SET_KEY(value) && !contains_value(vm, other, value))
         {
-            if (set_iterable_contains_q(vm, arguments[0], 1, &entry->key) == FALSE_VAL) {
-                set_add(vm, result, 1, &entry->key);
-            }
-            entry = entry->next;
+            insert_unique(vm, result_data->entries, result_data->capacity, value);
+            result_data->count++;
         }
     }
+    rememberObject(AS_OBJ(result));
     return pop(vm);
 }
 
@@ -289,14 +294,10 @@ VALUE set_to_list(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*argum
     SetData *data = GET_NATIVE_INSTANCE_DATA(SetData, self);
     VALUE list = list_create(vm);
     push(vm, list);
-    for (int i = 0; i < data->capacity; i++)
+    for (int32_t i = 0; i <= data->capacity; i++)
     {
-        SetEntry *entry = data->entries[i];
-        while (entry != nullptr)
-        {
-            list_add(vm, list, 1, &entry->key);
-            entry = entry->next;
-        }
+        if (IS_SET_KEY(data->entries[i]))
+            list_add(vm, list, 1, &data->entries[i]);
     }
     return pop(vm);
 }
@@ -307,19 +308,17 @@ VALUE set_obj_to_string(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE
     std::stringstream stream;
     stream << "{";
     int found = 0;
-    for (int i = 0; i < data->capacity; i++)
+    for (int32_t i = 0; i <= data->capacity; i++)
     {
-        SetEntry *entry = data->entries[i];
-        while (entry != nullptr)
-        {
-            call_function(vm, data->entries[i]->key, common_strings[STRING_TO_STRING], 0, nullptr);
-            stream << string_get_cstr(peek(vm, 0));
-            if (found != data->count - 1)
-                stream << ", ";
-            pop(vm);
-            entry = entry->next;
-            found++;
-        }
+        if (!IS_SET_KEY(data->entries[i]))
+            continue;
+
+        call_function(vm, data->entries[i], common_strings[STRING_TO_STRING], 0, nullptr);
+        stream << string_get_cstr(peek(vm, 0));
+        if (found != data->count - 1)
+            stream << ", ";
+        pop(vm);
+        found++;
     }
     stream << "}";
     std::string result = stream.str();
@@ -345,14 +344,10 @@ VALUE set_iterable_iterator(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNU
 void set_mark_contents(VALUE self)
 {
     SetData *data = GET_NATIVE_INSTANCE_DATA(SetData, self);
-    for (int i = 0; i < data->capacity; i++)
+    for (int32_t i = 0; i <= data->capacity; i++)
     {
-        SetEntry *entry = data->entries[i];
-        while (entry != nullptr)
-        {
-            markValue(entry->key);
-            entry = entry->next;
-        }
+        if (IS_SET_KEY(data->entries[i]))
+            markValue(data->entries[i]);
     }
 }
 
@@ -365,8 +360,7 @@ VALUE set_iterable_count(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED
 void set_iterator_constructor(void *instanceData)
 {
     SetIterator *iter = (SetIterator *)instanceData;
-    iter->current = nullptr;
-    iter->index = -1;
+    iter->index = 0;
     iter->set = NIL_VAL;
     iter->returned_count = 0;
 }
@@ -375,13 +369,11 @@ VALUE set_iterator_get_next(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), V
 {
     SetIterator *iter = GET_NATIVE_INSTANCE_DATA(SetIterator, self);
     SetData *set_data = GET_NATIVE_INSTANCE_DATA(SetData, iter->set);
-    while (iter->current == nullptr)
-    {
+    while (!IS_SET_KEY(set_data->entries[iter->index]))
         iter->index++;
-        iter->current = set_data->entries[iter->index];
-    }
-    VALUE result = iter->current->key;
-    iter->current = iter->current->next;
+
+    VALUE result = set_data->entries[iter->index];
+    iter->index++;
     iter->returned_count++;
     return result;
 }
@@ -423,6 +415,7 @@ void init_set(VM *vm)
     defineNativeMethod(vm, set_class, &set_iterable_empty_p, "empty?", 0, false);
     defineNativeMethod(vm, set_class, &set_iterable_count, "count", 0, false);
     defineNativeMethod(vm, set_class, &set_iterable_contains_q, "contains?", 1, false);
+    defineNativeMethod(vm, set_class, &set_iterable_iterator, "iterator", 0, false);
 
     defineNativeOperator(vm, set_class, &set_union, 1, OPERATOR_BITWISE_OR);
     defineNativeOperator(vm, set_class, &set_intersect, 1, OPERATOR_BITWISE_AND);
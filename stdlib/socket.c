@@ -94,7 +94,10 @@ VALUE socket_connect(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments
 
     if (address != NULL)
     {
-        if (connect(data->sock_fd, address->ai_addr, address->ai_addrlen) != 0)
+        enterSafeRegion(vm);
+        int result = connect(data->sock_fd, address->ai_addr, address->ai_addrlen);
+        leaveSafeRegion(vm);
+        if (result != 0)
         {
             throw_exception_native(vm, "SocketException", "Could not connect: %s", strerror(errno));
         }
@@ -120,7 +123,9 @@ VALUE socket_read(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*argum
 {
     SocketData *data = GET_NATIVE_INSTANCE_DATA(SocketData, self);
     char received[2048];
+    enterSafeRegion(vm);
     size_t actual = recv(data->sock_fd, received, 2048, 0);
+    leaveSafeRegion(vm);
     return copyString(vm, received, actual);
 }
 
@@ -143,12 +148,14 @@ VALUE socket_bind(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
     return NIL_VAL;
 }
 
-VALUE socket_accept(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+VALUE socket_accept(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
     SocketData *data = GET_NATIVE_INSTANCE_DATA(SocketData, self);
     struct sockaddr peer;
     socklen_t peer_len;
+    enterSafeRegion(vm);
     int connection_fd = accept(data->sock_fd, &peer, &peer_len);
+    leaveSafeRegion(vm);
     if (connection_fd > 0)
     {
         VALUE connection = OBJ_VAL(newInstance(vm, AS_INSTANCE(self)->klass));
@@ -198,7 +205,9 @@ void init_socket(VM *vm)
 
     socket_type = enum_create(vm);
     push(vm, socket_type);
-    addGlobal(copyString(vm, "SOCKET_TYPE", 11), socket_type);
+    push(vm, copyInternedString(vm, "SOCKET_TYPE", 11));
+    addGlobal(peek(vm, 0), socket_type);
+    pop(vm);
     enum_add_value(vm, socket_type, "TCP", SOCK_STREAM);
     enum_add_value(vm, socket_type, "UDP", SOCK_DGRAM);
     enum_add_value(vm, socket_type, "RAW", SOCK_RAW);
@@ -206,7 +215,9 @@ void init_socket(VM *vm)
 
     address_family = enum_create(vm);
     push(vm, address_family);
-    addGlobal(copyString(vm, "ADDRESS_FAMILY", 14), address_family);
+    push(vm, copyInternedString(vm, "ADDRESS_FAMILY", 14));
+    addGlobal(peek(vm, 0), address_family);
+    pop(vm);
     enum_add_value(vm, address_family, "UNIX", AF_UNIX);
     enum_add_value(vm, address_family, "IPv4", AF_INET);
     enum_add_value(vm, address_family, "IPv6", AF_INET6);
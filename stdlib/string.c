@@ -1,3 +1,10 @@
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <sched.h>
+#endif
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,9 +14,39 @@
 #include "comet_stdlib.h"
 #include "comet_string.h"
 #include "string_builder.h"
+#include "string_search.h"
 
 #include "utf8proc.h"
 
+// Concatenations shorter than this are copied straight away, a rope costs
+// more than copying a few characters
+#define MINIMUM_ROPE_LENGTH 64
+// Likewise for substrings
+#define MINIMUM_SLICE_LENGTH 32
+// Indexing a string that isn't ASCII walks at most this many codepoints
+#define CODEPOINT_INDEX_STRIDE 64
+
+// Only ropes being flattened and slices getting their own null terminated
+// copy take the lock. It's never held across an allocation, so a thread
+// waiting for it can't hold up a collection for long.
+#ifdef WIN32
+static volatile LONG string_lock = 0;
+#define STRING_LOCK()                                    \
+    while (InterlockedExchange(&string_lock, 1) != 0) \
+    SwitchToThread()
+#define STRING_UNLOCK() InterlockedExchange(&string_lock, 0)
+#define ATOMIC_LOAD_PTR(var) InterlockedCompareExchangePointer((PVOID volatile *)&(var), NULL, NULL)
+#define ATOMIC_STORE_PTR(var, value) InterlockedExchangePointer((PVOID volatile *)&(var), (value))
+#else
+static bool string_lock = false;
+#define STRING_LOCK()                                            \
+    while (__atomic_test_and_set(&string_lock, __ATOMIC_ACQUIRE)) \
+    sched_yield()
+#define STRING_UNLOCK() __atomic_clear(&string_lock, __ATOMIC_RELEASE)
+#define ATOMIC_LOAD_PTR(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE_PTR(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELEASE)
+#endif
+
 static VALUE string_iterator_class;
 
 static VALUE string_class;
@@ -17,12 +54,19 @@ static VALUE string_class;
 void string_iterator_constructor(void *data)
 {
     StringIterator *iter = (StringIterator *)data;
-    iter->string = NULL;
+    iter->string = NIL_VAL;
+    iter->chars = NULL;
     iter->current_codepoint = 0;
     iter->remaining = 0;
     iter->offset = 0;
 }
 
+static void string_iterator_mark_contents(VALUE self)
+{
+    StringIterator *iter = GET_NATIVE_INSTANCE_DATA(StringIterator, self);
+    markValue(iter->string);
+}
+
 static VALUE string_iterator_has_next_p(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
     StringIterator *data = GET_NATIVE_INSTANCE_DATA(StringIterator, self);
@@ -35,7 +79,7 @@ static VALUE string_iterator_get_next(VM UNUSED(*vm), VALUE self, int UNUSED(arg
 {
     StringIterator *data = GET_NATIVE_INSTANCE_DATA(StringIterator, self);
     utf8proc_ssize_t bytes_read = utf8proc_iterate(
-        (const utf8proc_uint8_t *)&data->string->chars[data->offset], data->remaining, &data->current_codepoint);
+        (const utf8proc_uint8_t *)&data->chars[data->offset], data->remaining, &data->current_codepoint);
     if (bytes_read == -1)
         return NIL_VAL;
     data->offset += bytes_read;
@@ -50,7 +94,7 @@ static VALUE string_iterator_peek_next(VM UNUSED(*vm), VALUE self, int UNUSED(ar
 {
     StringIterator *data = GET_NATIVE_INSTANCE_DATA(StringIterator, self);
     utf8proc_ssize_t bytes_read = utf8proc_iterate(
-        (const utf8proc_uint8_t *)&data->string->chars[data->offset], data->remaining, &data->current_codepoint);
+        (const utf8proc_uint8_t *)&data->chars[data->offset], data->remaining, &data->current_codepoint);
     if (bytes_read == -1)
         return NIL_VAL;
 
@@ -59,6 +103,7 @@ static VALUE string_iterator_peek_next(VM UNUSED(*vm), VALUE self, int UNUSED(ar
     return copyString(vm, (const char *)character, (int)char_len);
 }
 
+// Never 0, which marks a string whose hash hasn't been worked out yet
 uint32_t string_hash_cstr(const char *string, int length)
 {
     uint32_t hash = 2166136261u;
@@ -69,7 +114,7 @@ uint32_t string_hash_cstr(const char *string, int length)
         hash *= 16777619;
     }
 
-    return hash;
+    return hash != 0 ? hash : 1;
 }
 
 void string_constructor(void *instanceData)
@@ -78,25 +123,243 @@ void string_constructor(void *instanceData)
     data->length = 0;
     data->chars = NULL;
     data->hash = 0;
+    data->kind = STRING_FLAT;
+    data->interned = false;
+    data->ascii = false;
+    data->codepoint_length = -1;
+    data->codepoint_index = NULL;
+}
+
+static void string_mark_contents(VALUE self)
+{
+    StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
+    if (data->kind == STRING_ROPE)
+    {
+        markValue(data->as.rope.left);
+        markValue(data->as.rope.right);
+    }
+    else if (data->kind == STRING_SLICE)
+    {
+        markValue(data->as.slice.parent);
+    }
 }
 
 VALUE string_create(VM *vm, char *chars, int length)
 {
     VALUE string = OBJ_VAL(newInstance(vm, AS_CLASS(string_class)));
-    push(vm, string);
     StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, string);
     data->chars = chars;
     data->length = length;
-    data->hash = string_hash_cstr(data->chars, length);
+    return string;
+}
 
-    return pop(vm);
+// Copies a rope's characters into buffer. Ropes built up by a loop are as
+// deep as the number of times round it, so this keeps its own stack of the
+// right hand sides still to copy rather than recursing. Has to be called
+// holding string_lock.
+static void copy_rope(StringData *data, char *buffer)
+{
+    StringData **pending = NULL;
+    int pending_count = 0;
+    int pending_capacity = 0;
+    StringData *current = data;
+    size_t offset = 0;
+    for (;;)
+    {
+        const char *chars = current->chars;
+        if (chars == NULL && current->kind == STRING_SLICE)
+            chars = current->as.slice.start;
+        if (chars != NULL)
+        {
+            memcpy(&buffer[offset], chars, current->length);
+            offset += current->length;
+            if (pending_count == 0)
+                break;
+            current = pending[--pending_count];
+            continue;
+        }
+
+        if (pending_capacity < pending_count + 1)
+        {
+            pending_capacity = GROW_CAPACITY(pending_capacity);
+            pending = realloc(pending, sizeof(StringData *) * pending_capacity);
+        }
+        pending[pending_count++] = GET_NATIVE_INSTANCE_DATA(StringData, current->as.rope.right);
+        current = GET_NATIVE_INSTANCE_DATA(StringData, current->as.rope.left);
+    }
+    free(pending);
+}
+
+// Gives a rope its characters, or a slice a null terminated copy of them.
+// Other threads can be doing the same to the same string, the first one to
+// finish wins and the others throw theirs away.
+static const char *make_cstr(StringData *data)
+{
+    char *buffer = ALLOCATE(char, data->length + 1);
+    STRING_LOCK();
+    char *chars = data->chars;
+    if (chars == NULL)
+    {
+        if (data->kind == STRING_ROPE)
+            copy_rope(data, buffer);
+        else
+            memcpy(buffer, data->as.slice.start, data->length);
+        buffer[data->length] = '\0';
+        ATOMIC_STORE_PTR(data->chars, buffer);
+        // Threads only look at the halves while holding the lock. A slice
+        // keeps its parent, another thread may still be reading from it.
+        if (data->kind == STRING_ROPE)
+        {
+            data->as.rope.left = NIL_VAL;
+            data->as.rope.right = NIL_VAL;
+        }
+        chars = buffer;
+        buffer = NULL;
+    }
+    STRING_UNLOCK();
+    if (buffer != NULL)
+        FREE_ARRAY(char, buffer, data->length + 1);
+    return chars;
+}
+
+// The string's characters, which aren't null terminated if it's a slice
+static const char *string_chars(StringData *data)
+{
+    const char *chars = ATOMIC_LOAD_PTR(data->chars);
+    if (chars != NULL)
+        return chars;
+    if (data->kind == STRING_SLICE)
+        return data->as.slice.start;
+    return make_cstr(data);
 }
 
 const char *string_get_cstr(VALUE self)
 {
     DEBUG_ASSERT(instanceof(self, string_class));
     StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
-    return data->chars;
+    const char *chars = ATOMIC_LOAD_PTR(data->chars);
+    if (chars != NULL)
+        return chars;
+    return make_cstr(data);
+}
+
+// Counts the codepoints the first time they're needed. Threads doing it at
+// the same time all get the same answer, and ascii is set first.
+static size_t codepoint_length(StringData *data)
+{
+    if (data->codepoint_length >= 0)
+        return (size_t)data->codepoint_length;
+    const char *chars = string_chars(data);
+    bool ascii = string_is_ascii(chars, data->length);
+    size_t count = data->length;
+    if (!ascii)
+    {
+        count = 0;
+        for (size_t i = 0; i < data->length; i++)
+        {
+            if (((unsigned char)chars[i] & 0xC0) != 0x80)
+                count++;
+        }
+    }
+    data->ascii = ascii;
+    data->codepoint_length = (utf8proc_ssize_t)count;
+    return count;
+}
+
+// The first time a long string that isn't ASCII is indexed into. As with
+// make_cstr() the first thread to finish wins.
+static const size_t *codepoint_index(StringData *data, const char *chars)
+{
+    size_t *index = ATOMIC_LOAD_PTR(data->codepoint_index);
+    if (index != NULL)
+        return index;
+    size_t entries = data->codepoint_length / CODEPOINT_INDEX_STRIDE + 1;
+    size_t *buffer = ALLOCATE(size_t, entries);
+    size_t codepoint = 0;
+    for (size_t offset = 0; offset < data->length; offset++)
+    {
+        if (((unsigned char)chars[offset] & 0xC0) == 0x80)
+            continue;
+        if (codepoint % CODEPOINT_INDEX_STRIDE == 0)
+            buffer[codepoint / CODEPOINT_INDEX_STRIDE] = offset;
+        codepoint++;
+    }
+    STRING_LOCK();
+    index = data->codepoint_index;
+    if (index == NULL)
+    {
+        ATOMIC_STORE_PTR(data->codepoint_index, buffer);
+        index = buffer;
+        buffer = NULL;
+    }
+    STRING_UNLOCK();
+    if (buffer != NULL)
+        FREE_ARRAY(size_t, buffer, entries);
+    return index;
+}
+
+// The byte offset of the codepoint at index, the string's length in bytes for
+// the one after the last and -1 for anything further
+static utf8proc_ssize_t byte_offset(StringData *data, size_t index)
+{
+    size_t length = codepoint_length(data);
+    if (index > length)
+        return -1;
+    if (data->ascii)
+        return (utf8proc_ssize_t)index;
+    if (index == length)
+        return (utf8proc_ssize_t)data->length;
+    const char *chars = string_chars(data);
+    size_t offset = 0;
+    size_t current = 0;
+    if (length > CODEPOINT_INDEX_STRIDE)
+    {
+        offset = codepoint_index(data, chars)[index / CODEPOINT_INDEX_STRIDE];
+        current = index - index % CODEPOINT_INDEX_STRIDE;
+    }
+    for (; current < index; current++)
+    {
+        do
+        {
+            offset++;
+        } while (((unsigned char)chars[offset] & 0xC0) == 0x80);
+    }
+    return (utf8proc_ssize_t)offset;
+}
+
+// Saves counting a concatenation's characters when both halves have been
+static void add_codepoint_lengths(StringData *result, const StringData *lhs, const StringData *rhs)
+{
+    if (lhs->codepoint_length < 0 || rhs->codepoint_length < 0)
+        return;
+    result->ascii = lhs->ascii && rhs->ascii;
+    result->codepoint_length = lhs->codepoint_length + rhs->codepoint_length;
+}
+
+const char *string_get_chars(VALUE self)
+{
+    DEBUG_ASSERT(instanceof(self, string_class));
+    return string_chars(GET_NATIVE_INSTANCE_DATA(StringData, self));
+}
+
+uint32_t string_get_hash(VALUE self)
+{
+    DEBUG_ASSERT(instanceof(self, string_class));
+    StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
+    // Threads working it out at the same time all get the same answer
+    if (data->hash == 0)
+        data->hash = string_hash_cstr(string_chars(data), (int)data->length);
+    return data->hash;
+}
+
+bool string_is_interned(VALUE self)
+{
+    return GET_NATIVE_INSTANCE_DATA(StringData, self)->interned;
+}
+
+void string_set_interned(VALUE self)
+{
+    GET_NATIVE_INSTANCE_DATA(StringData, self)->interned = true;
 }
 
 int string_compare_to_cstr(VALUE self, const char *cstr)
@@ -104,7 +367,7 @@ int string_compare_to_cstr(VALUE self, const char *cstr)
     if (IS_INSTANCE(self) || IS_NATIVE_INSTANCE(self))
     {
         StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
-        return strncmp(data->chars, cstr, data->length);
+        return strncmp(string_chars(data), cstr, data->length);
     }
     return -1;
 }
@@ -112,46 +375,107 @@ int string_compare_to_cstr(VALUE self, const char *cstr)
 void string_destructor(void *data)
 {
     StringData *string_data = (StringData *)data;
-    if (string_data->chars != NULL)
+    bool shared = string_data->kind == STRING_SLICE && string_data->chars == string_data->as.slice.start;
+    if (string_data->chars != NULL && !shared)
     {
         FREE_ARRAY(char, string_data->chars, string_data->length + 1);
-        string_data->chars = NULL;
-        string_data->length = 0;
-        string_data->hash = 0;
     }
+    if (string_data->codepoint_index != NULL)
+    {
+        FREE_ARRAY(size_t, string_data->codepoint_index, string_data->codepoint_length / CODEPOINT_INDEX_STRIDE + 1);
+    }
+    string_data->chars = NULL;
+    string_data->length = 0;
+    string_data->hash = 0;
+    string_data->codepoint_length = -1;
+    string_data->codepoint_index = NULL;
+}
+
+// A string sharing length bytes of self's characters from offset
+static VALUE make_slice(VM *vm, VALUE self, size_t offset, size_t length)
+{
+    StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
+    VALUE result = OBJ_VAL(newInstance(vm, AS_CLASS(string_class)));
+    push(vm, result);
+    const char *chars = string_chars(data);
+    // The characters are only null terminated where self's are
+    bool terminated = chars == ATOMIC_LOAD_PTR(data->chars);
+    VALUE parent = self;
+    if (data->kind == STRING_SLICE && chars == data->as.slice.start)
+        parent = data->as.slice.parent;
+
+    StringData *slice = GET_NATIVE_INSTANCE_DATA(StringData, result);
+    slice->kind = STRING_SLICE;
+    slice->length = length;
+    slice->as.slice.parent = parent;
+    slice->as.slice.start = chars + offset;
+    if (terminated && offset + length == data->length)
+        slice->chars = (char *)slice->as.slice.start;
+    return pop(vm);
+}
+
+// A new string of length bytes of self's, from offset. Long enough ones share
+// self's characters rather than copying them.
+static VALUE string_slice(VM *vm, VALUE self, size_t offset, size_t length)
+{
+    StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
+    if (offset == 0 && length == data->length)
+        return self;
+    VALUE result;
+    if (length < MINIMUM_SLICE_LENGTH)
+        result = copyString(vm, string_chars(data) + offset, length);
+    else
+        result = make_slice(vm, self, offset, length);
+    // Any part of an ASCII string is ASCII
+    if (data->codepoint_length >= 0 && data->ascii)
+    {
+        StringData *slice = GET_NATIVE_INSTANCE_DATA(StringData, result);
+        slice->ascii = true;
+        slice->codepoint_length = (utf8proc_ssize_t)length;
+    }
+    return result;
 }
 
 VALUE string_iterator(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
     StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
+    // Flattening a rope allocates, so it's done before the iterator exists
+    const char *chars = string_chars(data);
     VALUE instance = OBJ_VAL(newInstance(vm, AS_CLASS(string_iterator_class)));
     StringIterator *iter = GET_NATIVE_INSTANCE_DATA(StringIterator, instance);
-    iter->string = data;
+    iter->string = self;
+    iter->chars = chars;
     iter->remaining = data->length;
     return instance;
 }
 
-VALUE string_equals(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE *arguments)
+bool string_is_equal(VALUE self, VALUE other)
 {
-    VALUE rhs = arguments[0];
-    if (IS_NATIVE_INSTANCE(rhs) &&
-        AS_INSTANCE(rhs)->klass->classType == CLS_STRING)
+    if (IS_NATIVE_INSTANCE(other) &&
+        AS_INSTANCE(other)->klass->classType == CLS_STRING)
     {
+        if (self == other)
+            return true;
         StringData *lhs = GET_NATIVE_INSTANCE_DATA(StringData, self);
-        StringData *rhs = GET_NATIVE_INSTANCE_DATA(StringData, arguments[0]);
+        StringData *rhs = GET_NATIVE_INSTANCE_DATA(StringData, other);
         if (lhs->length != rhs->length)
-            return FALSE_VAL;
+            return false;
+        if (lhs->hash != 0 && rhs->hash != 0 && lhs->hash != rhs->hash)
+            return false;
 
-        if (strncmp(lhs->chars, rhs->chars, lhs->length) == 0)
-            return TRUE_VAL;
+        return memcmp(string_chars(lhs), string_chars(rhs), lhs->length) == 0;
     }
-    return FALSE_VAL;
+    return false;
+}
+
+VALUE string_equals(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE *arguments)
+{
+    return string_is_equal(self, arguments[0]) ? TRUE_VAL : FALSE_VAL;
 }
 
 VALUE string_hash(VM *vm, VALUE UNUSED(self), int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
-    StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
-    return create_number(vm, (double)data->hash);
+    return create_number(vm, (double)string_get_hash(self));
 }
 
 VALUE string_to_string(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
@@ -161,6 +485,12 @@ VALUE string_to_string(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE
 
 static bool is_whitespace(const utf8proc_int32_t character)
 {
+    // Of ASCII only these are, which saves looking up the category
+    if (character < 0x80)
+    {
+        return character == ' ' || character == '\n' || character == '\r' ||
+               character == '\t' || character == '\v';
+    }
     const uint8_t as_char = (const char)character;
     if (character <= 0xff &&
         (as_char == '\n' || as_char == '\r' || as_char == '\t' || as_char == '\v' || as_char == 0x85))
@@ -177,81 +507,83 @@ static bool is_whitespace(const utf8proc_int32_t character)
     return false;
 }
 
-VALUE string_trim_left(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+// The number of bytes of whitespace chars starts with
+static size_t leading_whitespace(const char *chars, size_t length)
 {
-    StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
-    utf8proc_int32_t *intermediate = ALLOCATE(utf8proc_int32_t, data->length + 1);
-    utf8proc_ssize_t intermediate_length = utf8proc_decompose(
-        (const utf8proc_uint8_t *)data->chars, data->length,
-        intermediate, data->length,
-        UTF8PROC_NULLTERM);
-    if (intermediate_length < 0)
-    {
-        FREE_ARRAY(utf8proc_int32_t, intermediate, data->length + 1);
-        throw_exception_native(vm, "Exception", "ERROR: %s\n", utf8proc_errmsg(intermediate_length));
-        return NIL_VAL;
+    size_t offset = 0;
+    while (offset < length)
+    {
+        unsigned char byte = (unsigned char)chars[offset];
+        if (byte < 0x80)
+        {
+            if (!is_whitespace(byte))
+                break;
+            offset++;
+            continue;
+        }
+        utf8proc_int32_t codepoint;
+        utf8proc_ssize_t bytes_read = utf8proc_iterate(
+            (const utf8proc_uint8_t *)&chars[offset], length - offset, &codepoint);
+        if (bytes_read < 0 || !is_whitespace(codepoint))
+            break;
+        offset += bytes_read;
     }
-    char *output = ALLOCATE(char, data->length + 1);
-    bool found_non_whitespace = false;
-    int output_offset = 0;
+    return offset;
+}
 
-    for (int i = 0; i < intermediate_length; i++)
+// Where the whitespace chars ends with starts, no earlier than start
+static size_t trailing_whitespace(const char *chars, size_t start, size_t length)
+{
+    size_t end = length;
+    while (end > start)
     {
-        if (!found_non_whitespace)
+        unsigned char byte = (unsigned char)chars[end - 1];
+        if (byte < 0x80)
         {
-            found_non_whitespace = !is_whitespace(intermediate[i]);
+            if (!is_whitespace(byte))
+                break;
+            end--;
+            continue;
         }
-        if (found_non_whitespace)
+        // Back over the continuation bytes to the start of the character
+        size_t first = end - 1;
+        while (first > start && ((unsigned char)chars[first] & 0xC0) == 0x80)
         {
-            output_offset += utf8proc_encode_char(intermediate[i], (utf8proc_uint8_t *)&output[output_offset]);
+            first--;
         }
+        utf8proc_int32_t codepoint;
+        utf8proc_ssize_t bytes_read = utf8proc_iterate(
+            (const utf8proc_uint8_t *)&chars[first], end - first, &codepoint);
+        if (bytes_read != (utf8proc_ssize_t)(end - first) || !is_whitespace(codepoint))
+            break;
+        end = first;
     }
-    VALUE result = copyString(vm, (const char *)output, output_offset);
-    FREE_ARRAY(utf8proc_int32_t, intermediate, data->length + 1);
-    FREE_ARRAY(char, output, data->length + 1);
-    return result;
+    return end;
 }
 
-VALUE string_trim_right(VM UNUSED(*vm), VALUE UNUSED(self), int UNUSED(arg_count), VALUE UNUSED(*arguments))
+VALUE string_trim_left(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
     StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
-    utf8proc_int32_t *intermediate = ALLOCATE(utf8proc_int32_t, data->length + 1);
-    utf8proc_ssize_t intermediate_length = utf8proc_decompose(
-        (const utf8proc_uint8_t *)data->chars, data->length,
-        intermediate, data->length,
-        UTF8PROC_NULLTERM);
-    if (intermediate_length < 0)
-    {
-        FREE_ARRAY(utf8proc_int32_t, intermediate, data->length + 1);
-        throw_exception_native(vm, "Exception", "ERROR: %s\n", utf8proc_errmsg(intermediate_length));
-        return NIL_VAL;
-    }
-    char *output = ALLOCATE(char, data->length + 1);
-
-    int i = intermediate_length - 1;
-    for (; i >= 0; i--)
-    {
-        if (!is_whitespace(intermediate[i]))
-            break;
-    }
-    int output_offset = 0;
-    for (int j = 0; j <= i; j++)
-    {
-        output_offset += utf8proc_encode_char(intermediate[j], (utf8proc_uint8_t *)&output[output_offset]);
-    }
+    size_t start = leading_whitespace(string_chars(data), data->length);
+    return string_slice(vm, self, start, data->length - start);
+}
 
-    VALUE result = copyString(vm, (const char *)output, output_offset);
-    FREE_ARRAY(utf8proc_int32_t, intermediate, data->length + 1);
-    FREE_ARRAY(char, output, data->length + 1);
-    return result;
+VALUE string_trim_right(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+{
+    StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
+    size_t end = trailing_whitespace(string_chars(data), 0, data->length);
+    return string_slice(vm, self, 0, end);
 }
 
 VALUE string_trim(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
     if (arg_count == 0)
     {
-        VALUE str = string_trim_left(vm, self, 0, NULL);
-        return string_trim_right(vm, str, 0, NULL);
+        StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
+        const char *chars = string_chars(data);
+        size_t start = leading_whitespace(chars, data->length);
+        size_t end = trailing_whitespace(chars, start, data->length);
+        return string_slice(vm, self, start, end - start);
     }
     return NIL_VAL;
 }
@@ -261,80 +593,72 @@ VALUE string_split(VM *vm, VALUE self, int arg_count, VALUE *arguments)
     VALUE list = list_create(vm);
     push(vm, list);
     StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
-    const char *separator_chars = NULL;
-    size_t separator_length = 0;
-    if (arg_count == 0)
-    {
-        separator_chars = " ";
-        separator_length = 1;
-    }
-    else
+    const char *separator_chars = " ";
+    size_t separator_length = 1;
+    if (arg_count != 0)
     {
         StringData *separator = GET_NATIVE_INSTANCE_DATA(StringData, arguments[0]);
-        separator_chars = separator->chars;
+        separator_chars = string_chars(separator);
         separator_length = separator->length;
     }
-    const char *previous = data->chars;
-    const char *string = strstr(data->chars, separator_chars);
-    int offset = 0;
-    while (string != NULL)
+    const char *chars = string_chars(data);
+    const char *end = chars + data->length;
+    const char *previous = chars;
+    const char *found;
+    while (separator_length > 0 &&
+           (found = string_search(previous, end - previous, separator_chars, separator_length)) != NULL)
     {
-        if (string > previous)
+        // Separators next to each other don't make empty parts
+        if (found > previous)
         {
-            int length = string - previous;
-            VALUE part = copyString(vm, previous, length);
+            VALUE part = copyString(vm, previous, found - previous);
             list_add(vm, list, 1, &part);
-            offset += length + separator_length;
         }
-        else
-        {
-            offset++;
-        }
-        previous = string + separator_length;
-        string = strstr(&data->chars[offset], separator_chars);
+        previous = found + separator_length;
     }
-    VALUE part = copyString(vm, previous, data->length - offset);
+    VALUE part = copyString(vm, previous, end - previous);
     list_add(vm, list, 1, &part);
     pop(vm);
     return list;
 }
 
-VALUE string_replace(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE *arguments)
+VALUE string_replace(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
 {
-    const char *orig = string_get_cstr(self);
-    const char *what = string_get_cstr(arguments[0]);
-    const char *with = string_get_cstr(arguments[1]);
-    size_t what_len = strlen(what);
-    size_t with_len = strlen(with);
-    int num_found = 0;
-    const char *current = strstr(orig, what);
+    StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
+    StringData *what = GET_NATIVE_INSTANCE_DATA(StringData, arguments[0]);
+    StringData *with = GET_NATIVE_INSTANCE_DATA(StringData, arguments[1]);
+    const char *orig = string_chars(data);
+    const char *what_chars = string_chars(what);
+    const char *with_chars = string_chars(with);
+    const char *end = orig + data->length;
+    if (what->length == 0)
+        return self;
+
+    size_t num_found = 0;
+    const char *current = string_search(orig, data->length, what_chars, what->length);
     while (current != NULL)
     {
         num_found++;
-        current = strstr(current + what_len, what);
+        current += what->length;
+        current = string_search(current, end - current, what_chars, what->length);
     }
+    if (num_found == 0)
+        return self;
 
-    int new_length = strlen(orig) - (num_found * what_len) + (num_found * with_len);
+    size_t new_length = data->length - (num_found * what->length) + (num_found * with->length);
     char *new_str = ALLOCATE(char, new_length + 1);
+    size_t chars_copied = 0;
     current = orig;
-    int chars_copied = 0;
-    while (current != NULL)
+    for (size_t i = 0; i < num_found; i++)
     {
-        char *next = strstr(current, what);
-        if (next != NULL)
-        {
-            strncpy(&new_str[chars_copied], current, next - current);
-            chars_copied += next - current;
-            strncpy(&new_str[chars_copied], with, with_len);
-            chars_copied += with_len;
-            current = next + what_len;
-        }
-        else
-        {
-            strncpy(&new_str[chars_copied], current, strlen(current));
-            current = next;
-        }
+        const char *next = string_search(current, end - current, what_chars, what->length);
+        memcpy(&new_str[chars_copied], current, next - current);
+        chars_copied += next - current;
+        memcpy(&new_str[chars_copied], with_chars, with->length);
+        chars_copied += with->length;
+        current = next + what->length;
     }
+    memcpy(&new_str[chars_copied], current, end - current);
     new_str[new_length] = '\0';
 
     return takeString(vm, new_str, new_length);
@@ -349,7 +673,7 @@ VALUE string_starts_with_q(VM UNUSED(*vm), VALUE self, int arg_count, VALUE *arg
         if (rhs->length > lhs->length)
             return FALSE_VAL;
 
-        if (memcmp(lhs->chars, rhs->chars, rhs->length) == 0)
+        if (memcmp(string_chars(lhs), string_chars(rhs), rhs->length) == 0)
         {
             return TRUE_VAL;
         }
@@ -366,7 +690,7 @@ VALUE string_ends_with_q(VM UNUSED(*vm), VALUE self, int arg_count, VALUE *argum
         if (rhs->length > lhs->length)
             return FALSE_VAL;
 
-        if (memcmp(&lhs->chars[lhs->length - rhs->length], rhs->chars, rhs->length) == 0)
+        if (memcmp(&string_chars(lhs)[lhs->length - rhs->length], string_chars(rhs), rhs->length) == 0)
         {
             return TRUE_VAL;
         }
@@ -374,6 +698,21 @@ VALUE string_ends_with_q(VM UNUSED(*vm), VALUE self, int arg_count, VALUE *argum
     return FALSE_VAL;
 }
 
+// Changing the case of ASCII never changes the length, so there's nothing to
+// decode or measure
+static VALUE ascii_change_case(VM *vm, const char *chars, size_t length, bool upper)
+{
+    char *result = ALLOCATE(char, length + 1);
+    char from = upper ? 'a' : 'A';
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = chars[i];
+        result[i] = (c >= from && c <= from + 25) ? c ^ 0x20 : c;
+    }
+    result[length] = '\0';
+    return takeString(vm, result, length);
+}
+
 static utf8proc_int32_t to_lower_func(utf8proc_int32_t c, void UNUSED(*data))
 {
     return utf8proc_tolower(c);
@@ -383,8 +722,11 @@ VALUE string_to_lower(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE U
 {
     char *dest_string = NULL;
     StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
+    const char *chars = string_chars(data);
+    if (string_is_ascii(chars, data->length))
+        return ascii_change_case(vm, chars, data->length, false);
     utf8proc_ssize_t new_len = utf8proc_map_custom(
-        (const utf8proc_uint8_t *)data->chars,
+        (const utf8proc_uint8_t *)string_get_cstr(self),
         data->length,
         (utf8proc_uint8_t **)&dest_string,
         UTF8PROC_NULLTERM,
@@ -402,8 +744,11 @@ VALUE string_to_upper(VM UNUSED(*vm), VALUE UNUSED(self), int UNUSED(arg_count),
 {
     char *dest_string = NULL;
     StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
+    const char *chars = string_chars(data);
+    if (string_is_ascii(chars, data->length))
+        return ascii_change_case(vm, chars, data->length, true);
     utf8proc_ssize_t new_len = utf8proc_map_custom(
-        (const utf8proc_uint8_t *)data->chars,
+        (const utf8proc_uint8_t *)string_get_cstr(self),
         data->length,
         (utf8proc_uint8_t **)&dest_string,
         UTF8PROC_NULLTERM,
@@ -423,21 +768,7 @@ VALUE string_empty_q(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UN
 VALUE string_length(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
     StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
-    utf8proc_int32_t current_codepoint;
-    utf8proc_ssize_t remaining = data->length;
-    size_t offset = 0;
-    size_t length = 0;
-    while (offset < data->length)
-    {
-        utf8proc_ssize_t bytes_read = utf8proc_iterate(
-            (const utf8proc_uint8_t *)&data->chars[offset], remaining, &current_codepoint);
-        if (bytes_read == -1)
-            break;
-        offset += bytes_read;
-        remaining -= bytes_read;
-        length++;
-    }
-    return create_number(vm, (double)length);
+    return create_number(vm, (double)codepoint_length(data));
 }
 
 VALUE string_concatenate(VM *vm, VALUE self, int arg_count, VALUE *arguments)
@@ -451,54 +782,64 @@ VALUE string_concatenate(VM *vm, VALUE self, int arg_count, VALUE *arguments)
         }
         StringData *lhs = GET_NATIVE_INSTANCE_DATA(StringData, self);
         StringData *rhs = GET_NATIVE_INSTANCE_DATA(StringData, arguments[0]);
-        char *new_string = ALLOCATE(char, (lhs->length + rhs->length) + 1);
-        new_string[0] = 0;
-        strncat(new_string, lhs->chars, lhs->length);
-        strncat(new_string, rhs->chars, rhs->length);
-        return takeString(vm, new_string, lhs->length + rhs->length);
+        if (rhs->length == 0)
+            return self;
+        if (lhs->length == 0)
+            return arguments[0];
+        size_t length = lhs->length + rhs->length;
+        if (length < MINIMUM_ROPE_LENGTH)
+        {
+            char *new_string = ALLOCATE(char, length + 1);
+            memcpy(new_string, string_chars(lhs), lhs->length);
+            memcpy(&new_string[lhs->length], string_chars(rhs), rhs->length);
+            new_string[length] = '\0';
+            VALUE result = takeString(vm, new_string, length);
+            add_codepoint_lengths(GET_NATIVE_INSTANCE_DATA(StringData, result), lhs, rhs);
+            return result;
+        }
+        // Appending in a loop would copy everything so far each time round,
+        // a rope only copies once something needs the characters
+        VALUE result = OBJ_VAL(newInstance(vm, AS_CLASS(string_class)));
+        StringData *rope = GET_NATIVE_INSTANCE_DATA(StringData, result);
+        rope->kind = STRING_ROPE;
+        rope->length = length;
+        rope->as.rope.left = self;
+        rope->as.rope.right = arguments[0];
+        add_codepoint_lengths(rope, lhs, rhs);
+        return result;
     }
     return self;
 }
 
 VALUE string_get_at(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
-    uint64_t index = (int64_t)number_get_value(arguments[0]);
+    int64_t index = (int64_t)number_get_value(arguments[0]);
     StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
-    utf8proc_int32_t current_codepoint;
-    utf8proc_ssize_t remaining = data->length;
-    size_t offset = 0;
-    size_t length = 0;
-    while (offset < data->length)
+    utf8proc_ssize_t offset = index >= 0 ? byte_offset(data, (size_t)index) : -1;
+    if (offset < 0 || (size_t)offset == data->length)
     {
-        utf8proc_ssize_t bytes_read = utf8proc_iterate(
-            (const utf8proc_uint8_t *)&data->chars[offset], remaining, &current_codepoint);
-        if (bytes_read == -1)
-            break;
-        offset += bytes_read;
-        remaining -= bytes_read;
-        if (length == index)
-        {
-            char *temp = ALLOCATE(char, 5);
-            utf8proc_ssize_t result_len = utf8proc_encode_char(current_codepoint, (utf8proc_uint8_t *)temp);
-            temp = reallocate(temp, 5, result_len + 1);
-            temp[result_len] = '\0';
-            return string_create(vm, temp, result_len);
-        }
-        length++;
+        throw_exception_native(vm, "IndexOutOfBoundsException", "%ld was not a valid string index", (long)index);
+        return NIL_VAL;
     }
-    throw_exception_native(vm, "IndexOutOfBoundsException", "%ld was not a valid string index", index);
-    return NIL_VAL;
+    const char *chars = string_chars(data);
+    size_t char_length = 1;
+    while ((size_t)offset + char_length < data->length && ((unsigned char)chars[offset + char_length] & 0xC0) == 0x80)
+    {
+        char_length++;
+    }
+    return copyString(vm, &chars[offset], char_length);
 }
 
 VALUE string_iterable_contains_q(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE *arguments)
 {
-    StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
     if (!isObjOfStdlibClassType(arguments[0], CLS_STRING))
     {
         return FALSE_VAL;
     }
-    const char *string = strstr(data->chars, string_get_cstr(arguments[0]));
-    if (string != NULL)
+    StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
+    StringData *other = GET_NATIVE_INSTANCE_DATA(StringData, arguments[0]);
+    const char *chars = string_chars(data);
+    if (string_search(chars, data->length, string_chars(other), other->length) != NULL)
         return TRUE_VAL;
     return FALSE_VAL;
 }
@@ -508,7 +849,7 @@ bool string_iter_get_next(StringIterator *iter)
     if (iter->remaining <= 0)
         return false;
     utf8proc_ssize_t bytes_read = utf8proc_iterate(
-            (const utf8proc_uint8_t *)&iter->string->chars[iter->offset],
+            (const utf8proc_uint8_t *)&iter->chars[iter->offset],
             iter->remaining,
             &iter->current_codepoint);
     if (bytes_read < 0 || iter->current_codepoint <= 0)
@@ -527,7 +868,7 @@ static utf8proc_int32_t string_iter_peek_next(StringIterator *iter)
     utf8proc_int32_t result;
     utf8proc_ssize_t bytes_read;
     bytes_read = utf8proc_iterate(
-            (const utf8proc_uint8_t *)&iter->string->chars[iter->offset],
+            (const utf8proc_uint8_t *)&iter->chars[iter->offset],
             iter->remaining,
             &result);
     if (bytes_read == -1)
@@ -541,50 +882,22 @@ VALUE string_substring(VM UNUSED(*vm), VALUE UNUSED(self), int UNUSED(arg_count)
 {
     StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
     int start = (int) number_get_value(arguments[0]);
-    int length = string_length(vm, self, 0, NULL) - start;
+    if (start < 0)
+        return NIL_VAL;
+    utf8proc_ssize_t start_offset = byte_offset(data, start);
+    if (start_offset < 0)
+        return NIL_VAL;
+    utf8proc_ssize_t end_offset = data->length;
     if (arg_count == 2)
     {
-        length = (int) number_get_value(arguments[1]);
-    }
-    VALUE iterator = string_iterator(vm, self, 0, NULL);
-    push(vm, iterator);
-    StringIterator *iter = GET_NATIVE_INSTANCE_DATA(StringIterator, iterator);
-    for (int i = 0; i < start; i++) {
-        if (string_iter_get_next(iter) == false)
-        {
-            pop(vm);
+        int length = (int) number_get_value(arguments[1]);
+        if (length < 0)
             return NIL_VAL;
-        }
-    }
-    utf8proc_int32_t *intermediate = ALLOCATE(utf8proc_int32_t, length + 1);
-    int index = 0;
-    int result_length = 0;
-    for (int i = start; i < start+length; i++) {
-        if (string_iter_get_next(iter) == false)
-        {
-            FREE_ARRAY(utf8proc_int32_t, intermediate, length + 1);
-            pop(vm);
+        end_offset = byte_offset(data, (size_t)start + length);
+        if (end_offset < 0)
             return NIL_VAL;
-        }
-        intermediate[index] = iter->current_codepoint;
-        result_length += utf8proc_charwidth(iter->current_codepoint);
-        index++;
-    }
-    intermediate[index] = '\0';
-
-    utf8proc_uint8_t *output = ALLOCATE(utf8proc_uint8_t, result_length + 1);
-    int output_offset = 0;
-    for (int j = 0; j < length; j++)
-    {
-        output_offset += utf8proc_encode_char(intermediate[j], (utf8proc_uint8_t *)&output[output_offset]);
     }
-
-    VALUE result = copyString(vm, (const char *)output, output_offset);
-    push(vm, result);
-    FREE_ARRAY(utf8proc_int32_t, intermediate, length + 1);
-    FREE_ARRAY(char, output, data->length + 1);
-    popMany(vm, 2);
-    return result;
+    return string_slice(vm, self, start_offset, end_offset - start_offset);
 }
 
 VALUE string_value(VM UNUSED(*vm), VALUE UNUSED(self), int UNUSED(arg_count), VALUE UNUSED(*arguments))
@@ -603,10 +916,10 @@ VALUE string_value(VM UNUSED(*vm), VALUE UNUSED(self), int UNUSED(arg_count), VA
 
 VALUE string_number_q(VM UNUSED(*vm), VALUE UNUSED(self), int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
-    StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
+    const char *chars = string_get_cstr(self);
     char *failed;
-    double value = strtod(data->chars, &failed);
-    if (failed != data->chars)
+    double value = strtod(chars, &failed);
+    if (failed != chars)
         return TRUE_VAL;
     return FALSE_VAL;
 }
@@ -615,7 +928,11 @@ static int compare_to(VALUE self, VALUE other)
 {
     StringData *lhs = GET_NATIVE_INSTANCE_DATA(StringData, self);
     StringData *rhs = GET_NATIVE_INSTANCE_DATA(StringData, other);
-    return strncmp(lhs->chars, rhs->chars, lhs->length);
+    size_t length = lhs->length < rhs->length ? lhs->length : rhs->length;
+    int result = memcmp(string_chars(lhs), string_chars(rhs), length);
+    if (result != 0)
+        return result;
+    return lhs->length < rhs->length ? -1 : lhs->length > rhs->length;
 }
 
 VALUE string_greater_than(VM UNUSED(*vm), VALUE UNUSED(self), int UNUSED(arg_count), VALUE UNUSED(*arguments))
@@ -661,15 +978,7 @@ VALUE string_less_equal(VM UNUSED(*vm), VALUE UNUSED(self), int UNUSED(arg_count
 void add_output_string_to_builder(VM *vm, VALUE builder, VALUE obj)
 {
     call_function(vm, obj, common_strings[STRING_TO_STRING], 0, NULL);
-    VALUE string = peek(vm, 0);
-    VALUE iterator = string_iterator(vm, string, 0, NULL);
-    push(vm, iterator);
-    StringIterator *iter = GET_NATIVE_INSTANCE_DATA(StringIterator, iterator);
-    while(string_iter_get_next(iter))
-    {
-        string_builder_add_codepoint(builder, iter->current_codepoint);
-    }
-    pop(vm); // iterator
+    string_builder_add_string(builder, peek(vm, 0));
     pop(vm); // string
 }
 
@@ -697,9 +1006,14 @@ VALUE string_format(VM *vm, VALUE UNUSED(klass), int arg_count, VALUE *arguments
             }
             else
             {
-                char *end;
-                long index = strtol(&iter->string->chars[iter->offset], &end, 10);
-                iter->offset += end - &iter->string->chars[iter->offset];
+                // A slice's characters carry on past its end
+                long index = 0;
+                while (iter->remaining > 0 && iter->chars[iter->offset] >= '0' && iter->chars[iter->offset] <= '9')
+                {
+                    index = index * 10 + (iter->chars[iter->offset] - '0');
+                    iter->offset++;
+                    iter->remaining--;
+                }
                 if (!string_iter_get_next(iter) || iter->current_codepoint != '}')
                 {
                     throw_exception_native(
@@ -729,27 +1043,18 @@ VALUE string_format(VM *vm, VALUE UNUSED(klass), int arg_count, VALUE *arguments
             string_builder_add_codepoint(builder, iter->current_codepoint);
         }
     }
-    VALUE result = string_builder_to_string(vm, builder, 0, NULL);
+    VALUE result = string_builder_take_string(vm, builder);
     pop(vm); // builder
     pop(vm); // iterator
     return result;
 }
 
-VALUE string_whitespace_q(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+VALUE string_whitespace_q(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
-    VALUE iterator = string_iterator(vm, self, 0, NULL);
-    push(vm, iterator);
-    StringIterator *iter = GET_NATIVE_INSTANCE_DATA(StringIterator, iterator);
-    while (string_iter_get_next(iter))
-    {
-        if (!is_whitespace(iter->current_codepoint))
-        {
-            pop(vm);
-            return FALSE_VAL;
-        }
-    }
-    pop(vm);
-    return TRUE_VAL;
+    StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
+    if (leading_whitespace(string_chars(data), data->length) == data->length)
+        return TRUE_VAL;
+    return FALSE_VAL;
 }
 
 VALUE string_multiply(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
@@ -759,25 +1064,39 @@ VALUE string_multiply(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *argument
         throw_exception_native(vm, "ArgumentException", "String multiply argument must be a Number");
         return NIL_VAL;
     }
+    // Converting anything outside int's range to one is undefined
+    if (!(number_get_value(arguments[0]) >= INT_MIN && number_get_value(arguments[0]) <= INT_MAX))
+    {
+        throw_exception_native(vm, "ArgumentException", "String multiply argument is out of range");
+        return NIL_VAL;
+    }
     VALUE builder = create_string_builder(vm);
     push(vm, builder);
-    StringData *data = GET_NATIVE_INSTANCE_DATA(StringData, self);
     int num = number_get_value(arguments[0]);
+    size_t length = GET_NATIVE_INSTANCE_DATA(StringData, self)->length;
+    if (num > 0 && (length > SIZE_MAX / (size_t)num || !string_builder_reserve(builder, length * num)))
+    {
+        pop(vm); // builder
+        throw_exception_native(vm, "ArgumentException", "String multiplied would be longer than the longest possible String");
+        return NIL_VAL;
+    }
     for (int i = 0; i < num; i++)
     {
-        string_builder_add_cstr(vm, builder, data->chars);
+        string_builder_add_string(builder, self);
     }
-    VALUE result = string_builder_to_string(vm, builder, 0, NULL);
+    VALUE result = string_builder_take_string(vm, builder);
     pop(vm); // builder
     return result;
 }
 
 void init_string(VM *vm, VALUE obj_klass)
 {
+    init_string_search();
     string_class = bootstrapNativeClass(
         vm, "String",
         string_constructor, string_destructor,
         CLS_STRING, sizeof(StringData), true);
+    AS_NATIVE_CLASS(string_class)->marker = &string_mark_contents;
     init_object(vm, obj_klass);
     completeNativeClassDefinition(vm, obj_klass, NULL);
     complete_iterable(vm);
@@ -802,6 +1121,8 @@ void init_string(VM *vm, VALUE obj_klass)
     defineNativeMethod(vm, string_class, &string_value, "value", 0, false);
     defineNativeMethod(vm, string_class, &string_whitespace_q, "whitespace?", 0, false);
     defineNativeMethod(vm, string_class, &string_format, "format", 1, true);
+    defineNativeMethod(vm, string_class, &string_hash, "hash", 0, false);
+    defineNativeHash(string_class, &string_get_hash, &string_is_equal);
     defineNativeOperator(vm, string_class, &string_concatenate, 1, OPERATOR_PLUS);
     defineNativeOperator(vm, string_class, &string_equals, 1, OPERATOR_EQUALS);
     defineNativeOperator(vm, string_class, &string_get_at, 1, OPERATOR_INDEX);
@@ -816,7 +1137,7 @@ void init_string(VM *vm, VALUE obj_klass)
         vm, "StringIterator",
         &string_iterator_constructor,
         NULL,
-        NULL,
+        &string_iterator_mark_contents,
         "Iterator",
         CLS_ITERATOR,
         sizeof(StringIterator),
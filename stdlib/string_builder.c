@@ -1,3 +1,8 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "utf8proc.h"
 
 #include "cometlib.h"
@@ -5,13 +10,17 @@
 #include "comet_string.h"
 #include "string_builder.h"
 
-#define BASE_CODEPOINT_ALLOCATION 16
+#define MINIMUM_CAPACITY 16
+// Strings have int lengths, and taking one adds a null terminator
+#define MAXIMUM_LENGTH ((size_t)INT_MAX - 1)
 
+// The UTF-8 bytes appended so far, not null terminated until they're handed
+// over to a string
 typedef struct {
     ObjInstance obj;
-    utf8proc_int32_t *codepoints;
-    size_t size;
-    size_t index;
+    char *bytes;
+    size_t capacity;
+    size_t length;
 } StringBuilderData_t;
 
 static VALUE string_builder_klass;
@@ -19,90 +28,152 @@ static VALUE string_builder_klass;
 static void string_builder_constructor(void *data)
 {
     StringBuilderData_t *builder = (StringBuilderData_t *)data;
-    builder->codepoints = NULL;
-    builder->size = 0;
-    builder->index = 0;
+    builder->bytes = NULL;
+    builder->capacity = 0;
+    builder->length = 0;
 }
 
 static void string_builder_destructor(void *data)
 {
     StringBuilderData_t *builder = (StringBuilderData_t *)data;
-    if (builder->codepoints != NULL)
+    if (builder->bytes != NULL)
     {
-        FREE_ARRAY(StringBuilderData_t, builder->codepoints, builder->size);
-        builder->codepoints = NULL;
-        builder->size = 0;
-        builder->index = 0;
+        FREE_ARRAY(char, builder->bytes, builder->capacity);
+        builder->bytes = NULL;
+        builder->capacity = 0;
+        builder->length = 0;
     }
 }
 
-void string_builder_add_codepoint(VALUE self, utf8proc_int32_t codepoint)
+bool string_builder_reserve(VALUE self, size_t additional)
 {
     StringBuilderData_t *data = GET_NATIVE_INSTANCE_DATA(StringBuilderData_t, self);
-    if (data->index == data->size)
+    if (additional > MAXIMUM_LENGTH - data->length)
+        return false;
+    size_t needed = data->length + additional;
+    if (needed <= data->capacity)
+        return true;
+    // Doubling keeps appending n bytes O(n) overall
+    size_t new_capacity = data->capacity < MINIMUM_CAPACITY ? MINIMUM_CAPACITY : data->capacity;
+    while (new_capacity < needed)
     {
-        size_t new_size = data->size + (BASE_CODEPOINT_ALLOCATION * sizeof(utf8proc_int32_t));
-        data->codepoints = GROW_ARRAY(data->codepoints, utf8proc_int32_t, data->size, new_size);
-        data->size = new_size;
+        new_capacity = new_capacity <= MAXIMUM_LENGTH / 2 ? new_capacity * 2 : MAXIMUM_LENGTH;
     }
-    data->codepoints[data->index++] = codepoint;
+    data->bytes = GROW_ARRAY(data->bytes, char, data->capacity, new_capacity);
+    data->capacity = new_capacity;
+    return true;
 }
 
-VALUE string_builder_to_string(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+// For appends that can't report an error, running out of room is treated
+// like running out of memory
+static void reserve_or_abort(VALUE self, size_t additional)
 {
-    StringBuilderData_t *data = GET_NATIVE_INSTANCE_DATA(StringBuilderData_t, self);
-    utf8proc_uint8_t temp[4];
-    size_t length = 0;
-    for (size_t i = 0; i < data->index; i++)
-    {
-        utf8proc_ssize_t char_size = utf8proc_encode_char(data->codepoints[i], &temp[0]);
-        length += char_size;
-    }
-    char *output = ALLOCATE(char, length + 1);
-    int output_offset = 0;
-    for (int j = 0; j < data->index; j++)
+    if (!string_builder_reserve(self, additional))
     {
-        output_offset += utf8proc_encode_char(data->codepoints[j], (utf8proc_uint8_t *)&output[output_offset]);
+        fprintf(stderr, "StringBuilder is longer than the longest possible String\n");
+        abort();
     }
-    output[output_offset] = 0;
-    return takeString(vm, output, length);
+}
+
+void string_builder_add_codepoint(VALUE self, utf8proc_int32_t codepoint)
+{
+    reserve_or_abort(self, 4);
+    StringBuilderData_t *data = GET_NATIVE_INSTANCE_DATA(StringBuilderData_t, self);
+    data->length += utf8proc_encode_char(codepoint, (utf8proc_uint8_t *)&data->bytes[data->length]);
+}
+
+void string_builder_add_chars(VALUE self, const char *chars, size_t length)
+{
+    reserve_or_abort(self, length);
+    StringBuilderData_t *data = GET_NATIVE_INSTANCE_DATA(StringBuilderData_t, self);
+    memcpy(&data->bytes[data->length], chars, length);
+    data->length += length;
+}
+
+void string_builder_add_string(VALUE self, VALUE string)
+{
+    // Strings are already valid UTF-8, so there's nothing to decode
+    size_t length = GET_NATIVE_INSTANCE_DATA(StringData, string)->length;
+    string_builder_add_chars(self, string_get_chars(string), length);
+}
+
+void string_builder_add_cstr(VM UNUSED(*vm), VALUE self, const char *cstr)
+{
+    string_builder_add_chars(self, cstr, strlen(cstr));
+}
+
+VALUE string_builder_to_string(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+{
+    StringBuilderData_t *data = GET_NATIVE_INSTANCE_DATA(StringBuilderData_t, self);
+    if (data->length == 0)
+        return copyString(vm, "", 0);
+    return copyString(vm, data->bytes, data->length);
+}
+
+VALUE string_builder_take_string(VM *vm, VALUE self)
+{
+    StringBuilderData_t *data = GET_NATIVE_INSTANCE_DATA(StringBuilderData_t, self);
+    if (data->length == 0)
+        return copyString(vm, "", 0);
+    // Strings free exactly length + 1 bytes, shrinking is normally in place
+    char *chars = GROW_ARRAY(data->bytes, char, data->capacity, data->length + 1);
+    chars[data->length] = '\0';
+    size_t length = data->length;
+    data->bytes = NULL;
+    data->capacity = 0;
+    data->length = 0;
+    return takeString(vm, chars, (int)length);
 }
 
 VALUE string_builder_append(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
 {
-    push(vm, string_iterator(vm, arguments[0], 0, NULL));
-    StringIterator *iter = GET_NATIVE_INSTANCE_DATA(StringIterator, peek(vm, 0));
-    while (string_iter_get_next(iter))
+    if (!isObjOfStdlibClassType(arguments[0], CLS_STRING))
+    {
+        throw_exception_native(vm, "ArgumentException", "StringBuilder can only append a String");
+        return NIL_VAL;
+    }
+    if (!string_builder_reserve(self, GET_NATIVE_INSTANCE_DATA(StringData, arguments[0])->length))
     {
-        string_builder_add_codepoint(self, iter->current_codepoint);
+        throw_exception_native(vm, "ArgumentException", "StringBuilder would be longer than the longest possible String");
+        return NIL_VAL;
     }
-    pop(vm);
+    string_builder_add_string(self, arguments[0]);
     return self;
 }
 
-void string_builder_add_cstr(VM *vm, VALUE self, const char *cstr)
+VALUE string_builder_pop(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
-    int offset = 0;
-    size_t remaining = strlen(cstr);
-    utf8proc_ssize_t bytes_read = 0;
-    utf8proc_int32_t codepoint = 0;
-    while (bytes_read > 0)
+    StringBuilderData_t *data = GET_NATIVE_INSTANCE_DATA(StringBuilderData_t, self);
+    // Back over the continuation bytes of the last codepoint to its first
+    while (data->length > 0)
     {
-        bytes_read = utf8proc_iterate((const utf8proc_uint8_t *)&cstr[offset], remaining, &codepoint);
-        offset += bytes_read;
-        remaining -= bytes_read;
-        string_builder_add_codepoint(self, codepoint);
+        data->length--;
+        if ((data->bytes[data->length] & 0xC0) != 0x80)
+            break;
     }
+    return NIL_VAL;
 }
 
-VALUE string_builder_pop(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+static VALUE string_builder_reserve_method(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
 {
-    StringBuilderData_t *data = GET_NATIVE_INSTANCE_DATA(StringBuilderData_t, self);
-    if (data->index > 0)
+    // Also rules out NaN, which isn't in any range
+    if (!IS_NUMBER(arguments[0]) ||
+        !(number_get_value(arguments[0]) >= 0 && number_get_value(arguments[0]) <= (double)MAXIMUM_LENGTH))
     {
-        data->index--;
+        throw_exception_native(vm, "ArgumentException", "StringBuilder.reserve() needs a number of bytes");
+        return NIL_VAL;
     }
-    return NIL_VAL;
+    if (!string_builder_reserve(self, (size_t)number_get_value(arguments[0])))
+    {
+        throw_exception_native(vm, "ArgumentException", "StringBuilder would be longer than the longest possible String");
+        return NIL_VAL;
+    }
+    return self;
+}
+
+static VALUE string_builder_capacity(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+{
+    return create_number(vm, (double)GET_NATIVE_INSTANCE_DATA(StringBuilderData_t, self)->capacity);
 }
 
 VALUE create_string_builder(VM *vm)
@@ -129,6 +200,8 @@ void init_string_builder(VM *vm)
     defineNativeMethod(vm, string_builder_klass, &string_builder_to_string, "to_string", 0, false);
     defineNativeMethod(vm, string_builder_klass, &string_builder_append, "append", 1, false);
     defineNativeMethod(vm, string_builder_klass, &string_builder_pop, "pop", 0, false);
-    
+    defineNativeMethod(vm, string_builder_klass, &string_builder_reserve_method, "reserve", 1, false);
+    defineNativeMethod(vm, string_builder_klass, &string_builder_capacity, "capacity", 0, false);
+
     defineNativeOperator(vm, string_builder_klass, &string_builder_append, 1, OPERATOR_PLUS);
-}
\ No newline at end of file
+}
@@ -0,0 +1,163 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "string_search.h"
+
+// SSE2 is part of x86-64, so it never needs checking for. AVX2 is only
+// built where the compiler can target it for a single function.
+#if defined(__x86_64__) || defined(_M_X64)
+#define STRING_SEARCH_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define STRING_SEARCH_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+typedef const char *(*SearchFunction)(const char *haystack, size_t haystack_length, const char *needle, size_t needle_length);
+
+static inline int lowest_bit(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// memchr() is already vectorised by the C library, so this only has to look
+// at the places the first byte matches. needle_length is at least 1 and no
+// longer than haystack_length.
+static const char *search_portable(const char *haystack, size_t haystack_length, const char *needle, size_t needle_length)
+{
+    const char *current = haystack;
+    const char *last_start = haystack + haystack_length - needle_length;
+    while (current <= last_start)
+    {
+        current = memchr(current, needle[0], last_start - current + 1);
+        if (current == NULL)
+            return NULL;
+        if (memcmp(current + 1, needle + 1, needle_length - 1) == 0)
+            return current;
+        current++;
+    }
+    return NULL;
+}
+
+// The vector versions compare a block of starting positions against the
+// needle's first and last bytes at once, and only compare the whole needle
+// where both match. What's left over at the end is done a byte at a time.
+#if STRING_SEARCH_SSE2
+static const char *search_sse2(const char *haystack, size_t haystack_length, const char *needle, size_t needle_length)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+    size_t offset = 0;
+    for (; offset + needle_length + 15 <= haystack_length; offset += 16)
+    {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)&haystack[offset]);
+        __m128i block_last = _mm_loadu_si128((const __m128i *)&haystack[offset + needle_length - 1]);
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+        while (mask != 0)
+        {
+            const char *candidate = &haystack[offset + lowest_bit(mask)];
+            if (memcmp(candidate, needle, needle_length) == 0)
+                return candidate;
+            mask &= mask - 1;
+        }
+    }
+    // The loop can stop with fewer than needle_length bytes left
+    if (haystack_length - offset < needle_length)
+        return NULL;
+    return search_portable(&haystack[offset], haystack_length - offset, needle, needle_length);
+}
+#endif
+
+#if STRING_SEARCH_AVX2
+__attribute__((target("avx2")))
+static const char *search_avx2(const char *haystack, size_t haystack_length, const char *needle, size_t needle_length)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+    size_t offset = 0;
+    for (; offset + needle_length + 31 <= haystack_length; offset += 32)
+    {
+        __m256i block_first = _mm256_loadu_si256((const __m256i *)&haystack[offset]);
+        __m256i block_last = _mm256_loadu_si256((const __m256i *)&haystack[offset + needle_length - 1]);
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+        while (mask != 0)
+        {
+            const char *candidate = &haystack[offset + lowest_bit(mask)];
+            if (memcmp(candidate, needle, needle_length) == 0)
+                return candidate;
+            mask &= mask - 1;
+        }
+    }
+    if (haystack_length - offset < needle_length)
+        return NULL;
+    return search_sse2(&haystack[offset], haystack_length - offset, needle, needle_length);
+}
+#endif
+
+static SearchFunction search_function = &search_portable;
+
+void init_string_search(void)
+{
+#if STRING_SEARCH_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        search_function = &search_avx2;
+        return;
+    }
+#endif
+#if STRING_SEARCH_SSE2
+    search_function = &search_sse2;
+#endif
+}
+
+const char *string_search(const char *haystack, size_t haystack_length, const char *needle, size_t needle_length)
+{
+    if (needle_length == 0)
+        return haystack;
+    if (needle_length > haystack_length)
+        return NULL;
+    if (needle_length == 1)
+        return memchr(haystack, needle[0], haystack_length);
+    return search_function(haystack, haystack_length, needle, needle_length);
+}
+
+bool string_is_ascii(const char *chars, size_t length)
+{
+    size_t offset = 0;
+#if STRING_SEARCH_SSE2
+    // movemask gathers the top bit of every byte
+    for (; offset + 16 <= length; offset += 16)
+    {
+        if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)&chars[offset])) != 0)
+            return false;
+    }
+#else
+    for (; offset + sizeof(uint64_t) <= length; offset += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, &chars[offset], sizeof(word));
+        if ((word & 0x8080808080808080ull) != 0)
+            return false;
+    }
+#endif
+    for (; offset < length; offset++)
+    {
+        if ((unsigned char)chars[offset] >= 0x80)
+            return false;
+    }
+    return true;
+}
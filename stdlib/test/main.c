@@ -13,5 +13,9 @@ int main(int UNUSED(argc), char UNUSED(**argv))
 
     test_list_teardown();
 
+    test_string_search_every_offset();
+    test_string_search_not_found();
+    test_string_is_ascii();
+
     return EXIT_SUCCESS;
 }
\ No newline at end of file
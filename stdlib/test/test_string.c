@@ -0,0 +1,56 @@
+#include <string.h>
+
+#include "common.h"
+#include "string_search.h"
+#include "tests.h"
+
+#define HAYSTACK_SIZE 100
+
+static char haystack[HAYSTACK_SIZE];
+
+static void fill_haystack(void)
+{
+    // Full of near misses for a needle starting and ending with 'a'
+    for (int i = 0; i < HAYSTACK_SIZE; i++)
+    {
+        haystack[i] = i % 2 == 0 ? 'a' : 'b';
+    }
+}
+
+void test_string_search_every_offset(void)
+{
+    const char *needle = "abcba";
+    size_t needle_length = strlen(needle);
+    init_string_search();
+    for (size_t offset = 0; offset + needle_length <= HAYSTACK_SIZE; offset++)
+    {
+        fill_haystack();
+        memcpy(&haystack[offset], needle, needle_length);
+        const char *UNUSED(found) = string_search(haystack, HAYSTACK_SIZE, needle, needle_length);
+        DEBUG_ASSERT(found == &haystack[offset]);
+    }
+}
+
+void test_string_search_not_found(void)
+{
+    init_string_search();
+    fill_haystack();
+    DEBUG_ASSERT(string_search(haystack, HAYSTACK_SIZE, "abba", 4) == NULL);
+    DEBUG_ASSERT(string_search(haystack, HAYSTACK_SIZE, "c", 1) == NULL);
+    // Longer than the part of the haystack it's given
+    DEBUG_ASSERT(string_search(haystack, 3, "abab", 4) == NULL);
+    DEBUG_ASSERT(string_search(haystack, HAYSTACK_SIZE - 1, "ba", 2) == &haystack[1]);
+}
+
+void test_string_is_ascii(void)
+{
+    fill_haystack();
+    DEBUG_ASSERT(string_is_ascii(haystack, HAYSTACK_SIZE));
+    for (size_t offset = 0; offset < HAYSTACK_SIZE; offset++)
+    {
+        fill_haystack();
+        haystack[offset] = (char)0xc3;
+        DEBUG_ASSERT(!string_is_ascii(haystack, HAYSTACK_SIZE));
+        DEBUG_ASSERT(string_is_ascii(haystack, offset));
+    }
+}
@@ -8,4 +8,8 @@ void test_list_sort_already_sorted(void);
 void test_list_sort_reverse_sorted(void);
 void test_list_sort_jumbled(void);
 
+void test_string_search_every_offset(void);
+void test_string_search_not_found(void);
+void test_string_is_ascii(void);
+
 #endif
\ No newline at end of file
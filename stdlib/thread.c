@@ -23,6 +23,9 @@ typedef struct {
     VALUE self;
     VALUE start_routine;
     VALUE arg;
+    // Kept here rather than handed back through the OS, so that it stays
+    // reachable between the thread finishing and being joined
+    VALUE result;
 } ThreadData;
 
 void thread_constructor(void *instanceData)
@@ -30,6 +33,7 @@ void thread_constructor(void *instanceData)
     ThreadData *data = (ThreadData *)instanceData;
     data->start_routine = NIL_VAL;
     data->arg = NIL_VAL;
+    data->result = NIL_VAL;
     data->self = NIL_VAL;
     data->thread_id = -1;
 }
@@ -40,10 +44,12 @@ void *thread_runner(void *arg)
     initVM(vm);
     ThreadData *data = (ThreadData *)arg;
     call_function(vm, data->self, data->start_routine, 1, &data->arg);
-    void *result = (void *)(uintptr_t)pop(vm);
+    data->result = peek(vm, 0);
+    writeBarrier((Obj *)data, data->result);
+    pop(vm);
     deregister_thread(vm);
     FREE(VM, vm);
-    return result;
+    return NULL;
 }
 
 VALUE thread_start(VM *vm, VALUE self, int arg_count, VALUE *arguments)
@@ -52,6 +58,7 @@ VALUE thread_start(VM *vm, VALUE self, int arg_count, VALUE *arguments)
     data->self = self;
     data->start_routine = arguments[0];
     data->arg = arg_count > 1 ? arguments[1] : NIL_VAL;
+    rememberObject((Obj *)data);
     int status = 0;
     if (callable_p(vm, 1, arguments) == FALSE_VAL)
     {
@@ -79,23 +86,21 @@ VALUE thread_start(VM *vm, VALUE self, int arg_count, VALUE *arguments)
 VALUE thread_join(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
     ThreadData *data = GET_NATIVE_INSTANCE_DATA(ThreadData, self);
-    void *result = NULL;
     int status = 0;
+    enterSafeRegion(vm);
 #ifdef WIN32
     status = WaitForSingleObject(data->thread_handle, INFINITE) == WAIT_OBJECT_0 ? 0 : -1;
     CloseHandle(data->thread_handle);
 #else
-    status = pthread_join(data->thread_id, &result);
+    status = pthread_join(data->thread_id, NULL);
 #endif
+    leaveSafeRegion(vm);
     if (status != 0)
     {
         throw_exception_native(vm, "ThreadException", "Unable to join thread");
+        return NIL_VAL;
     }
-    if (result != NULL)
-    {
-        return OBJ_VAL(result);
-    }
-    return NIL_VAL;
+    return data->result;
 }
 
 void thread_mark_contents(VALUE self)
@@ -103,6 +108,7 @@ void thread_mark_contents(VALUE self)
     ThreadData *data = GET_NATIVE_INSTANCE_DATA(ThreadData, self);
     markValue(data->start_routine);
     markValue(data->arg);
+    markValue(data->result);
 }
 
 void init_thread(VM *vm)
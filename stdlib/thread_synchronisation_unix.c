@@ -34,12 +34,14 @@ VALUE cond_var_signal_all(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VAL
     return NIL_VAL;
 }
 
-VALUE cond_var_wait(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+VALUE cond_var_wait(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
     CondVarData *data = GET_NATIVE_INSTANCE_DATA(CondVarData, self);
+    enterSafeRegion(vm);
     pthread_mutex_lock(&data->lock);
     pthread_cond_wait(&data->cond_var, &data->lock);
     pthread_mutex_unlock(&data->lock);
+    leaveSafeRegion(vm);
     return NIL_VAL;
 }
 
@@ -56,11 +58,13 @@ static void get_wait_time(struct timespec *time, double wait_interval_s)
 VALUE cond_var_timed_wait(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
 {
     CondVarData *data = GET_NATIVE_INSTANCE_DATA(CondVarData, self);
-    pthread_mutex_lock(&data->lock);
     struct timespec wait_time;
     get_wait_time(&wait_time, number_get_value(arguments[0]));
+    enterSafeRegion(vm);
+    pthread_mutex_lock(&data->lock);
     int result = pthread_cond_timedwait(&data->cond_var, &data->lock, &wait_time);
     pthread_mutex_unlock(&data->lock);
+    leaveSafeRegion(vm);
     if (result == ETIMEDOUT)
     {
         throw_exception_native(vm, "TimeoutException", "Interval elapsed");
@@ -86,10 +90,12 @@ VALUE mutex_unlock(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UNUS
     return NIL_VAL;
 }
 
-VALUE mutex_lock(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+VALUE mutex_lock(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
     MutexData *data = GET_NATIVE_INSTANCE_DATA(MutexData, self);
+    enterSafeRegion(vm);
     pthread_mutex_lock(&data->mutex);
+    leaveSafeRegion(vm);
     return NIL_VAL;
 }
 
@@ -106,7 +112,9 @@ VALUE mutex_timed_lock(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *argumen
     MutexData *data = GET_NATIVE_INSTANCE_DATA(MutexData, self);
     struct timespec wait_time;
     get_wait_time(&wait_time, number_get_value(arguments[0]));
+    enterSafeRegion(vm);
     int result = pthread_mutex_timedlock(&data->mutex, &wait_time);
+    leaveSafeRegion(vm);
     if (result == ETIMEDOUT)
     {
         throw_exception_native(vm, "TimeoutException", "Interval elapsed");
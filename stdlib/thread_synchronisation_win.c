@@ -36,18 +36,23 @@ void mutex_destructor(void* data)
     CloseHandle(cond_var->mutex);
 }
 
-VALUE mutex_lock(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+VALUE mutex_lock(VM *vm, VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
 {
     MutexData* data = GET_NATIVE_INSTANCE_DATA(MutexData, self);
+    enterSafeRegion(vm);
     WaitForSingleObject(data->mutex, INFINITE);
+    leaveSafeRegion(vm);
     return NIL_VAL;
 }
 
-VALUE mutex_timed_lock(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+VALUE mutex_timed_lock(VM *vm, VALUE self, int UNUSED(arg_count), VALUE *arguments)
 {
     MutexData* data = GET_NATIVE_INSTANCE_DATA(MutexData, self);
     DWORD wait_time = (DWORD)number_get_value(arguments[0]) * MILLI_SECONDS_PER_SECOND;
-    if (WaitForSingleObject(data->mutex, wait_time) == WAIT_TIMEOUT)
+    enterSafeRegion(vm);
+    DWORD result = WaitForSingleObject(data->mutex, wait_time);
+    leaveSafeRegion(vm);
+    if (result == WAIT_TIMEOUT)
         throw_exception_native(vm, "TimeoutException", "Interval elapsed");
     return NIL_VAL;
 }
@@ -0,0 +1,58 @@
+#include "comet.h"
+#include "cometlib.h"
+#include "comet_stdlib.h"
+
+typedef struct {
+    ObjInstance obj;
+    VALUE target;
+} WeakRefData;
+
+static void weak_ref_constructor(void *data)
+{
+    WeakRefData *ref = (WeakRefData *)data;
+    ref->target = NIL_VAL;
+}
+
+static void weak_ref_clear_unreachable(VALUE self)
+{
+    WeakRefData *ref = GET_NATIVE_INSTANCE_DATA(WeakRefData, self);
+    if (IS_OBJ(ref->target) && isObjectUnreachable(AS_OBJ(ref->target)))
+        ref->target = NIL_VAL;
+}
+
+static const WeakReferenceCallbacks weak_ref_callbacks = {
+    NULL,
+    &weak_ref_clear_unreachable,
+};
+
+static void weak_ref_mark_contents(VALUE self)
+{
+    markWeakReferences(self, &weak_ref_callbacks);
+}
+
+static VALUE weak_ref_init(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE *arguments)
+{
+    WeakRefData *ref = GET_NATIVE_INSTANCE_DATA(WeakRefData, self);
+    ref->target = arguments[0];
+    // A minor collection has to see the reference to clear it
+    writeBarrier(AS_OBJ(self), ref->target);
+    return NIL_VAL;
+}
+
+static VALUE weak_ref_get(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+{
+    return GET_NATIVE_INSTANCE_DATA(WeakRefData, self)->target;
+}
+
+static VALUE weak_ref_alive_q(VM UNUSED(*vm), VALUE self, int UNUSED(arg_count), VALUE UNUSED(*arguments))
+{
+    return IS_NIL(GET_NATIVE_INSTANCE_DATA(WeakRefData, self)->target) ? FALSE_VAL : TRUE_VAL;
+}
+
+void init_weak_ref(VM *vm)
+{
+    VALUE klass = defineNativeClass(vm, "WeakRef", &weak_ref_constructor, NULL, &weak_ref_mark_contents, "Object", CLS_WEAK_REF, sizeof(WeakRefData), true);
+    defineNativeMethod(vm, klass, &weak_ref_init, "init", 1, false);
+    defineNativeMethod(vm, klass, &weak_ref_get, "get", 0, false);
+    defineNativeMethod(vm, klass, &weak_ref_alive_q, "alive?", 0, false);
+}
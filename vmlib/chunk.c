@@ -1,11 +1,24 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "mem.h"
 #include "value.h"
 #include "vm.h"
 
+static bool coverageEnabled = false;
+
+void enableCoverage(void)
+{
+    coverageEnabled = true;
+}
+
+bool isCoverageEnabled(void)
+{
+    return coverageEnabled;
+}
+
 void initChunk(Chunk *chunk, const char *filename)
 {
     chunk->count = 0;
@@ -13,6 +26,9 @@ void initChunk(Chunk *chunk, const char *filename)
     chunk->code = NULL;
     chunk->lines = NULL;
     chunk->execution_counts = NULL;
+    chunk->inlineCaches = NULL;
+    chunk->inlineCacheCount = 0;
+    chunk->inlineCacheCapacity = 0;
     if (filename == NULL)
     {
         chunk->filename = NULL;
@@ -28,7 +44,11 @@ void initChunk(Chunk *chunk, const char *filename)
 
 void recordInstructionExecuted(Chunk *chunk, size_t instruction)
 {
-    chunk->execution_counts[(uint16_t)instruction]++;
+    // Chunks compiled before coverage was switched on have nothing to record into
+    if (chunk->execution_counts != NULL)
+    {
+        chunk->execution_counts[instruction]++;
+    }
 }
 
 void writeChunk(Chunk *chunk, uint8_t byte, int line)
@@ -39,20 +59,40 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line)
         chunk->capacity = GROW_CAPACITY(oldCapacity);
         chunk->code = GROW_ARRAY(chunk->code, uint8_t, oldCapacity, chunk->capacity);
         chunk->lines = GROW_ARRAY(chunk->lines, int, oldCapacity, chunk->capacity);
-        chunk->execution_counts = GROW_ARRAY(chunk->execution_counts, uint16_t, oldCapacity, chunk->capacity);
+        if (coverageEnabled)
+        {
+            chunk->execution_counts = GROW_ARRAY(chunk->execution_counts, uint64_t, oldCapacity, chunk->capacity);
+        }
     }
 
     chunk->code[chunk->count] = byte;
     chunk->lines[chunk->count] = line;
-    chunk->execution_counts[chunk->count] = 0;
+    if (chunk->execution_counts != NULL)
+    {
+        chunk->execution_counts[chunk->count] = 0;
+    }
     chunk->count++;
 }
 
+int addInlineCache(Chunk *chunk)
+{
+    if (chunk->inlineCacheCapacity < chunk->inlineCacheCount + 1)
+    {
+        int oldCapacity = chunk->inlineCacheCapacity;
+        chunk->inlineCacheCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->inlineCaches = GROW_ARRAY(chunk->inlineCaches, InlineCache, oldCapacity, chunk->inlineCacheCapacity);
+    }
+
+    memset(&chunk->inlineCaches[chunk->inlineCacheCount], 0, sizeof(InlineCache));
+    return chunk->inlineCacheCount++;
+}
+
 void freeChunk(Chunk *chunk)
 {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
     FREE_ARRAY(int, chunk->lines, chunk->capacity);
-    FREE_ARRAY(uint16_t, chunk->execution_counts, chunk->capacity);
+    FREE_ARRAY(uint64_t, chunk->execution_counts, chunk->capacity);
+    FREE_ARRAY(InlineCache, chunk->inlineCaches, chunk->inlineCacheCapacity);
     if (chunk->filename != NULL)
     {
         FREE_ARRAY(char, chunk->filename, strlen(chunk->filename) + 1);
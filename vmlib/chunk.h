@@ -13,9 +13,9 @@ typedef enum
     OP_POP,
     OP_GET_LOCAL,
     OP_SET_LOCAL,
-    OP_GET_GLOBAL,
-    OP_DEFINE_GLOBAL,
-    OP_SET_GLOBAL,
+    OP_GET_MODULE_VAR,
+    OP_DEFINE_MODULE_VAR,
+    OP_SET_MODULE_VAR,
     OP_GET_UPVALUE,
     OP_SET_UPVALUE,
     OP_GET_PROPERTY,
@@ -26,7 +26,9 @@ typedef enum
     OP_GREATER_EQUAL,
     OP_LESS,
     OP_LESS_EQUAL,
+    OP_LESS_JUMP,
     OP_ADD,
+    OP_ADD_CONST,
     OP_SUBTRACT,
     OP_MULTIPLY,
     OP_DIVIDE,
@@ -67,25 +69,63 @@ typedef enum
     OP_SPLAT,
 } OpCode;
 
+#define INLINE_CACHE_ENTRIES (4)
+
+struct sObjClass;
+struct sObjShape;
+
+// For instances, shape is the layout the receiver had when the entry was made.
+// slot is the field the name resolved to, or -1 if value holds a method. When
+// setting a property that added a field, value holds the resulting shape.
+// Threads running the same code share entries, sequence is odd while one is
+// being written and goes up each time, see findInlineCacheEntry().
+typedef struct
+{
+    uint32_t sequence;
+    struct sObjClass *klass;
+    struct sObjShape *shape;
+    uint32_t version;
+    int slot;
+    Value value;
+} InlineCacheEntry;
+
+// Remembers the last few classes and shapes seen at a single property/invoke
+// call site. Entries are only valid while the class's cacheVersion still matches.
+typedef struct
+{
+    InlineCacheEntry entries[INLINE_CACHE_ENTRIES];
+    uint8_t next;
+} InlineCache;
+
 typedef struct
 {
     int count;
     int capacity;
     ValueArray constants;
     int *lines;
-    uint16_t *execution_counts;
+    // Only allocated when coverage is enabled, NULL otherwise
+    uint64_t *execution_counts;
     uint8_t *code;
     char *filename;
+    InlineCache *inlineCaches;
+    int inlineCacheCount;
+    int inlineCacheCapacity;
 } Chunk;
 
 void initChunk(Chunk *chunk, const char *filename);
 
 void writeChunk(Chunk *chunk, uint8_t byte, int line);
 
+int addInlineCache(Chunk *chunk);
+
 void freeChunk(Chunk *chunk);
 
 void print_constants(Chunk *chunk);
 
+// Coverage has to be enabled before any code that should be counted is
+// compiled, it can't be switched off again.
+void enableCoverage(void);
+bool isCoverageEnabled(void);
 void recordInstructionExecuted(Chunk *chunk, size_t instruction);
 
 #endif
@@ -18,6 +18,19 @@
 
 #define REF_COUNT_MEM_MANAGEMENT (0)
 
+// Dispatch the interpreter loop with labels-as-values rather than a switch.
+// Set by the COMET_COMPUTED_GOTO CMake option and only supported by GCC/Clang.
+#if !defined(COMET_COMPUTED_GOTO) || !defined(__GNUC__)
+#undef COMET_COMPUTED_GOTO
+#define COMET_COMPUTED_GOTO (0)
+#endif
+
+// Set by the COMET_COUNT_INSTRUCTIONS CMake option. Off by default as it adds
+// an increment to every instruction.
+#ifndef COMET_COUNT_INSTRUCTIONS
+#define COMET_COUNT_INSTRUCTIONS (0)
+#endif
+
 #ifndef UNUSED
 # if defined(WIN32) || defined(_WIN32)
 #  include <Windows.h>
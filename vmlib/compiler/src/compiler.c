@@ -115,6 +115,8 @@ void patchJump(Parser *parser, int offset)
     }
     setCodeOffset(parser->currentFunction, offset, (jump >> 8) & 0xff);
     setCodeOffset(parser->currentFunction, offset + 1, jump & 0xff);
+    // Something now lands after the last comparison, so it can't be fused
+    parser->currentFunction->lessOffset = -1;
 }
 
 void initCompiler(Compiler *compiler, FunctionType type, Parser *parser)
@@ -124,6 +126,7 @@ void initCompiler(Compiler *compiler, FunctionType type, Parser *parser)
     compiler->type = type;
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
+    compiler->lessOffset = -1;
     compiler->function = AS_FUNCTION(peek(parser->compilation_thread, 0));
     parser->currentFunction = compiler;
 
@@ -133,8 +136,9 @@ void initCompiler(Compiler *compiler, FunctionType type, Parser *parser)
     }
     else if (type != TYPE_SCRIPT && type != TYPE_LAMBDA)
     {
-        parser->currentFunction->function->name = copyString(parser->compilation_thread, parser->previous.start,
+        parser->currentFunction->function->name = copyInternedString(parser->compilation_thread, parser->previous.start,
                                              parser->previous.length);
+        writeBarrier((Obj *)parser->currentFunction->function, parser->currentFunction->function->name);
     }
 
     Local *local = &parser->currentFunction->locals[parser->currentFunction->localCount++];
@@ -73,6 +73,9 @@ typedef struct Compiler
     int localCount;
     Upvalue upvalues[MAX_VAR_COUNT];
     int scopeDepth;
+    // Offset of the OP_LESS that was last emitted, reset once anything jumps
+    // past it. See emitConditionJump.
+    int lessOffset;
 } Compiler;
 
 typedef struct
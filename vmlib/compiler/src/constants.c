@@ -70,5 +70,5 @@ Value parseString(Parser *parser)
         }
     }
     string_chars[index] = '\0';
-    return takeString(parser->compilation_thread, string_chars, index);
+    return takeInternedString(parser->compilation_thread, string_chars, index);
 }
\ No newline at end of file
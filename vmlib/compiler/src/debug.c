@@ -26,6 +26,19 @@ static int invokeInstruction(const char *name, Chunk *chunk,
     return offset + 3 + argCount;
 }
 
+static int cachedInvokeInstruction(const char *name, Chunk *chunk,
+                                   int offset)
+{
+    uint8_t constant = chunk->code[offset + 1];
+    uint8_t argCount = chunk->code[offset + 2];
+    uint16_t cache = (uint16_t)(chunk->code[offset + 3] << 8);
+    cache |= chunk->code[offset + 4];
+    printf("%-16s (%d args) %4d '", name, argCount, constant);
+    printObject(chunk->constants.values[constant]);
+    printf("' cache: %u\n", cache);
+    return offset + 5;
+}
+
 static int simpleInstruction(const char *name, int offset)
 {
     printf("%s\n", name);
@@ -57,6 +70,28 @@ static int constantInstruction(const char *name, Chunk *chunk, int offset)
     return offset + 2;
 }
 
+static int moduleVariableInstruction(const char *name, Chunk *chunk, int offset)
+{
+    uint8_t constant = chunk->code[offset + 1];
+    uint16_t slot = (uint16_t)(chunk->code[offset + 2] << 8);
+    slot |= chunk->code[offset + 3];
+    printf("%-16s %4d '", name, constant);
+    printObject(chunk->constants.values[constant]);
+    printf("' slot: %u\n", slot);
+    return offset + 4;
+}
+
+static int cachedConstantInstruction(const char *name, Chunk *chunk, int offset)
+{
+    uint8_t constant = chunk->code[offset + 1];
+    uint16_t cache = (uint16_t)(chunk->code[offset + 2] << 8);
+    cache |= chunk->code[offset + 3];
+    printf("%-16s %4d '", name, constant);
+    printObject(chunk->constants.values[constant]);
+    printf("' cache: %u\n", cache);
+    return offset + 4;
+}
+
 static int classInstruction(const char *name, Chunk *chunk, int offset)
 {
     uint8_t constant = chunk->code[offset + 1];
@@ -109,20 +144,20 @@ int disassembleInstruction(Chunk *chunk, int offset)
         return byteInstruction("OP_GET_LOCAL", chunk, offset);
     case OP_SET_LOCAL:
         return byteInstruction("OP_SET_LOCAL", chunk, offset);
-    case OP_GET_GLOBAL:
-        return constantInstruction("OP_GET_GLOBAL", chunk, offset);
-    case OP_DEFINE_GLOBAL:
-        return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
-    case OP_SET_GLOBAL:
-        return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+    case OP_GET_MODULE_VAR:
+        return moduleVariableInstruction("OP_GET_MODULE_VAR", chunk, offset);
+    case OP_DEFINE_MODULE_VAR:
+        return moduleVariableInstruction("OP_DEFINE_MODULE_VAR", chunk, offset);
+    case OP_SET_MODULE_VAR:
+        return moduleVariableInstruction("OP_SET_MODULE_VAR", chunk, offset);
     case OP_GET_UPVALUE:
         return byteInstruction("OP_GET_UPVALUE", chunk, offset);
     case OP_SET_UPVALUE:
         return byteInstruction("OP_SET_UPVALUE", chunk, offset);
     case OP_GET_PROPERTY:
-        return constantInstruction("OP_GET_PROPERTY", chunk, offset);
+        return cachedConstantInstruction("OP_GET_PROPERTY", chunk, offset);
     case OP_SET_PROPERTY:
-        return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+        return cachedConstantInstruction("OP_SET_PROPERTY", chunk, offset);
     case OP_GET_SUPER:
         return constantInstruction("OP_GET_SUPER", chunk, offset);
     case OP_EQUAL:
@@ -133,10 +168,14 @@ int disassembleInstruction(Chunk *chunk, int offset)
         return simpleInstruction("OP_GREATER_EQUAL", offset);
     case OP_LESS:
         return simpleInstruction("OP_LESS", offset);
+    case OP_LESS_JUMP:
+        return simpleInstruction("OP_LESS_JUMP", offset);
     case OP_LESS_EQUAL:
         return simpleInstruction("OP_LESS_EQUAL", offset);
     case OP_ADD:
         return simpleInstruction("OP_ADD", offset);
+    case OP_ADD_CONST:
+        return constantInstruction("OP_ADD_CONST", chunk, offset);
     case OP_SUBTRACT:
         return simpleInstruction("OP_SUBTRACT", offset);
     case OP_MULTIPLY:
@@ -168,7 +207,7 @@ int disassembleInstruction(Chunk *chunk, int offset)
     case OP_CALL:
         return byteInstruction("OP_CALL", chunk, offset);
     case OP_INVOKE:
-        return invokeInstruction("OP_INVOKE", chunk, offset);
+        return cachedInvokeInstruction("OP_INVOKE", chunk, offset);
     case OP_SUPER:
         return invokeInstruction("OP_SUPER", chunk, offset);
     case OP_CLOSURE:
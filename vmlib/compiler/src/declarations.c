@@ -149,6 +149,7 @@ void classDeclaration(Parser *parser, uint8_t attributeCount)
         if (match(parser, TOKEN_DOT) && match(parser, TOKEN_IDENTIFIER)) {
             uint8_t name = identifierConstant(parser, &parser->previous);
             emitBytes(parser, OP_GET_PROPERTY, name);
+            emitInlineCache(parser);
         }
     }
     else
@@ -305,6 +306,7 @@ void enumDeclaration(Parser *parser)
             uint8_t name = identifierConstant(parser, &addToken);
             emitBytes(parser, OP_INVOKE, name);
             emitByte(parser, 2); // argCount
+            emitInlineCache(parser);
             emitByte(parser, OP_POP);
 
             match(parser, TOKEN_EOL); // optional end of line.
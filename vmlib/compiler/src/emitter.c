@@ -46,6 +46,16 @@ void emitReturn(Parser *parser)
     emitByte(parser, OP_RETURN);
 }
 
+void emitInlineCache(Parser *parser)
+{
+    int cache = addInlineCache(currentChunk(parser->currentFunction));
+    if (cache > UINT16_MAX)
+        error(parser, "Too many property accesses in one function.");
+
+    emitByte(parser, (cache >> 8) & 0xff);
+    emitByte(parser, cache & 0xff);
+}
+
 void emitConstant(Parser *parser, Value value)
 {
     emitBytes(parser, OP_CONSTANT, makeConstant(parser, value));
@@ -9,5 +9,6 @@ void emitLoop(Parser *parser);
 int emitJump(Parser *parser, uint8_t instruction);
 void emitReturn(Parser *parser);
 void emitConstant(Parser *parser, Value value);
+void emitInlineCache(Parser *parser);
 
 #endif
@@ -64,12 +64,43 @@ static void ternary(Parser* parser, bool UNUSED(canAssign))
     patchJump(parser, endJump);
 }
 
+void emitAdd(Parser *parser, int operandStart)
+{
+    // A number literal on the right, e.g. a loop counter's 'i + 1', is added
+    // straight from the constant table.
+    Chunk *chunk = currentChunk(parser->currentFunction);
+    if (chunk->count == operandStart + 2 &&
+        chunk->code[operandStart] == OP_CONSTANT &&
+        IS_NUMBER(chunk->constants.values[chunk->code[operandStart + 1]]))
+    {
+        setCodeOffset(parser->currentFunction, operandStart, OP_ADD_CONST);
+        return;
+    }
+    emitByte(parser, OP_ADD);
+}
+
+int emitConditionJump(Parser *parser)
+{
+    // A condition that finished with '<' gets OP_LESS_JUMP instead, which
+    // compares two numbers and does the jump and pop in a single instruction.
+    // The OP_JUMP_IF_FALSE and OP_POP are still needed for any other operands.
+    Compiler *function = parser->currentFunction;
+    if (function->lessOffset >= 0 && function->lessOffset == getCurrentOffset(function) - 1)
+    {
+        setCodeOffset(function, function->lessOffset, OP_LESS_JUMP);
+    }
+    int jump = emitJump(parser, OP_JUMP_IF_FALSE);
+    emitByte(parser, OP_POP);
+    return jump;
+}
+
 static void binary(Parser *parser, bool UNUSED(canAssign))
 {
     // Remember the operator.
     TokenType_t operatorType = parser->previous.type;
 
     // Compile the right operand.
+    int operandStart = getCurrentOffset(parser->currentFunction);
     ParseRule *rule = getRule(operatorType);
     parsePrecedence(parser, (Precedence)(rule->precedence + 1));
 
@@ -89,13 +120,14 @@ static void binary(Parser *parser, bool UNUSED(canAssign))
         emitByte(parser, OP_GREATER_EQUAL);
         break;
     case TOKEN_LESS:
+        parser->currentFunction->lessOffset = getCurrentOffset(parser->currentFunction);
         emitByte(parser, OP_LESS);
         break;
     case TOKEN_LESS_EQUAL:
         emitByte(parser, OP_LESS_EQUAL);
         break;
     case TOKEN_PLUS:
-        emitByte(parser, OP_ADD);
+        emitAdd(parser, operandStart);
         break;
     case TOKEN_MINUS:
         emitByte(parser, OP_SUBTRACT);
@@ -142,9 +174,11 @@ static void emitPropertyAssignOpInstructions(Parser *parser, OpCode operation, u
 {
     emitByte(parser, OP_DUP_TOP);
     emitBytes(parser, OP_GET_PROPERTY, name);
+    emitInlineCache(parser);
     expression(parser);
     emitByte(parser, operation);
     emitBytes(parser, OP_SET_PROPERTY, name);
+    emitInlineCache(parser);
 }
 
 static void dot(Parser *parser, bool canAssign)
@@ -157,6 +191,7 @@ static void dot(Parser *parser, bool canAssign)
         if (match(parser, TOKEN_EQUAL)) {
             expression(parser);
             emitBytes(parser, OP_SET_PROPERTY, name);
+            emitInlineCache(parser);
             return;
         }
         else if (match(parser, TOKEN_PLUS_EQUAL)) {
@@ -182,10 +217,12 @@ static void dot(Parser *parser, bool canAssign)
         uint8_t argCount = argumentList(parser, TOKEN_RIGHT_PAREN);
         emitBytes(parser, OP_INVOKE, name);
         emitByte(parser, argCount);
+        emitInlineCache(parser);
     }
     else
     {
         emitBytes(parser, OP_GET_PROPERTY, name);
+        emitInlineCache(parser);
     }
 }
 
@@ -227,7 +264,7 @@ static void replacement(Parser *parser, bool UNUSED(canAssign))
 {
     if (parser->previous.type == TOKEN_FILE_NAME)
     {
-        Value filename = copyString(
+        Value filename = copyInternedString(
         parser->compilation_thread, parser->filename, strlen(parser->filename));
         emitConstant(parser, filename);
     }
@@ -326,6 +363,7 @@ static void attribute(Parser *parser, bool canAssign)
         if (match(parser, TOKEN_DOT) && match(parser, TOKEN_IDENTIFIER)) {
             uint8_t name = identifierConstant(parser, &parser->previous);
             emitBytes(parser, OP_GET_PROPERTY, name);
+            emitInlineCache(parser);
         }
         consume(parser, TOKEN_LEFT_PAREN, "Expected '(' after an attribute");
         call(parser, canAssign);
@@ -373,6 +411,7 @@ static void literal_hash(Parser *parser, bool canAssign)
             uint8_t name = identifierConstant(parser, &addToken);
             emitBytes(parser, OP_INVOKE, name);
             emitByte(parser, 2); // argCount
+            emitInlineCache(parser);
             emitByte(parser, OP_POP);
         } while (match(parser, TOKEN_COMMA));
     }
@@ -394,6 +433,7 @@ static void literal_list(Parser *parser, bool canAssign)
         uint8_t name = identifierConstant(parser, &addToken);
         emitBytes(parser, OP_INVOKE, name);
         emitByte(parser, argCount);
+        emitInlineCache(parser);
     }
     emitByte(parser, OP_POP);
 }
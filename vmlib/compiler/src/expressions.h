@@ -5,5 +5,10 @@
 void parsePrecedence(Parser *parser, Precedence precedence);
 void expression(Parser *parser);
 ParseRule *getRule(TokenType_t type);
+// Emits the addition of the value that was compiled starting at operandStart
+void emitAdd(Parser *parser, int operandStart);
+// Emits the jump over a loop or if body when the condition just compiled is
+// false, followed by the pop of the condition. Returns the jump to patch.
+int emitConditionJump(Parser *parser);
 
 #endif
\ No newline at end of file
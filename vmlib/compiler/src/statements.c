@@ -62,8 +62,7 @@ void forStatement(Parser *parser)
         consume(parser, TOKEN_SEMI_COLON, "Expect ';' after loop condition.");
 
         // Jump out of the loop if the condition is false.
-        loop.exitAddress = emitJump(parser, OP_JUMP_IF_FALSE);
-        emitByte(parser, OP_POP); // Condition.
+        loop.exitAddress = emitConditionJump(parser);
     }
     if (!match(parser, TOKEN_RIGHT_PAREN))
     {
@@ -103,6 +102,7 @@ static void syntheticMethodCall(Parser *parser, const char *method_name)
     uint8_t constant = identifierConstant(parser, &methodNameToken);
     emitBytes(parser, OP_INVOKE, constant);
     emitByte(parser, 0); // zero arguments
+    emitInlineCache(parser);
 }
 
 void foreachStatement(Parser *parser)
@@ -163,8 +163,7 @@ void ifStatement(Parser *parser)
     expression(parser);
     consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-    int thenJump = emitJump(parser, OP_JUMP_IF_FALSE);
-    emitByte(parser, OP_POP);
+    int thenJump = emitConditionJump(parser);
     statement(parser);
 
     int elseJump = emitJump(parser, OP_JUMP);
@@ -215,9 +214,8 @@ void whileStatement(Parser *parser)
     expression(parser);
     consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-    loop.exitAddress = emitJump(parser, OP_JUMP_IF_FALSE);
+    loop.exitAddress = emitConditionJump(parser);
 
-    emitByte(parser, OP_POP);
     statement(parser);
 
     emitLoop(parser);
@@ -4,6 +4,8 @@
 #include "compiler_defs.h"
 #include "expressions.h"
 #include "emitter.h"
+#include "shape.h"
+#include "mem.h"
 
 #define GLOBAL_SCOPE 0
 #define UNINITIALIZED_SCOPE -1
@@ -13,6 +15,7 @@ static int addConstant(Parser *parser, Chunk *chunk, Value value)
 {
     push(parser->compilation_thread, value);
     writeValueArray(&chunk->constants, value);
+    writeBarrier((Obj *)parser->currentFunction->function, value);
     pop(parser->compilation_thread);
     return chunk->constants.count - 1;
 }
@@ -31,7 +34,7 @@ uint8_t makeConstant(Parser *parser, Value value)
 
 uint8_t identifierConstant(Parser *parser, Token *name)
 {
-    return makeConstant(parser, copyString(parser->compilation_thread, name->start, name->length));
+    return makeConstant(parser, copyInternedString(parser->compilation_thread, name->start, name->length));
 }
 
 bool identifiersEqual(Token *a, Token *b)
@@ -162,6 +165,35 @@ void markInitialized(Parser *parser)
     parser->currentFunction->locals[parser->currentFunction->localCount - 1].depth = parser->currentFunction->scopeDepth;
 }
 
+// Module variables are stored by slot in the module, so that they can be
+// accessed without hashing their names. Slots are handed out the first time a
+// name is seen, which may be before it is defined. Anything the module never
+// defines is looked up by name in the globals at runtime.
+static int moduleVariableSlot(Parser *parser, uint8_t nameConstant)
+{
+    Value name = currentChunk(parser->currentFunction)->constants.values[nameConstant];
+    ObjInstance *module = AS_INSTANCE(parser->currentModule);
+    int slot = instanceFindSlot(module, name);
+    if (slot >= 0)
+        return slot;
+
+    // The next slot would be dictionary->count, check it fits in the operand
+    // before reserving it
+    if (module->dictionary->count > UINT16_MAX)
+    {
+        error(parser, "Too many module variables.");
+        return 0;
+    }
+    return instanceReserveField(module, name);
+}
+
+static void emitModuleVariable(Parser *parser, OpCode op, uint8_t nameConstant, int slot)
+{
+    emitBytes(parser, op, nameConstant);
+    emitByte(parser, (slot >> 8) & 0xff);
+    emitByte(parser, slot & 0xff);
+}
+
 void defineVariable(Parser *parser, uint8_t global)
 {
     if (parser->currentFunction->scopeDepth > GLOBAL_SCOPE)
@@ -169,12 +201,25 @@ void defineVariable(Parser *parser, uint8_t global)
         markInitialized(parser);
         return;
     }
-    emitBytes(parser, OP_DEFINE_GLOBAL, global);
+    emitModuleVariable(parser, OP_DEFINE_MODULE_VAR, global, moduleVariableSlot(parser, global));
+}
+
+static void emitVariableOp(Parser *parser, OpCode op, int arg, int moduleSlot)
+{
+    if (moduleSlot != UNRESOLVED_VARIABLE_INDEX)
+    {
+        emitModuleVariable(parser, op, (uint8_t)arg, moduleSlot);
+    }
+    else
+    {
+        emitBytes(parser, op, (uint8_t)arg);
+    }
 }
 
 void namedVariable(Parser *parser, Token name, bool canAssign)
 {
     OpCode getOp, setOp;
+    int moduleSlot = UNRESOLVED_VARIABLE_INDEX;
     int arg = resolveLocal(parser, parser->currentFunction, &name);
     if (arg != UNRESOLVED_VARIABLE_INDEX)
     {
@@ -189,8 +234,9 @@ void namedVariable(Parser *parser, Token name, bool canAssign)
     else
     {
         arg = identifierConstant(parser, &name);
-        getOp = OP_GET_GLOBAL;
-        setOp = OP_SET_GLOBAL;
+        moduleSlot = moduleVariableSlot(parser, (uint8_t)arg);
+        getOp = OP_GET_MODULE_VAR;
+        setOp = OP_SET_MODULE_VAR;
     }
 
     if (canAssign)
@@ -198,52 +244,53 @@ void namedVariable(Parser *parser, Token name, bool canAssign)
         if (match(parser, TOKEN_EQUAL))
         {
             expression(parser);
-            emitBytes(parser, setOp, (uint8_t)arg);
+            emitVariableOp(parser, setOp, arg, moduleSlot);
             return;
         }
         else if (match(parser, TOKEN_PLUS_EQUAL))
         {
-            emitBytes(parser, getOp, (uint8_t)arg);
+            emitVariableOp(parser, getOp, arg, moduleSlot);
+            int operandStart = getCurrentOffset(parser->currentFunction);
             expression(parser);
-            emitByte(parser, OP_ADD);
-            emitBytes(parser, setOp, (uint8_t)arg);
+            emitAdd(parser, operandStart);
+            emitVariableOp(parser, setOp, arg, moduleSlot);
             return;
         }
         else if (match(parser, TOKEN_STAR_EQUAL))
         {
-            emitBytes(parser, getOp, (uint8_t)arg);
+            emitVariableOp(parser, getOp, arg, moduleSlot);
             expression(parser);
             emitByte(parser, OP_MULTIPLY);
-            emitBytes(parser, setOp, (uint8_t)arg);
+            emitVariableOp(parser, setOp, arg, moduleSlot);
             return;
         }
         else if (match(parser, TOKEN_MINUS_EQUAL))
         {
-            emitBytes(parser, getOp, (uint8_t)arg);
+            emitVariableOp(parser, getOp, arg, moduleSlot);
             expression(parser);
             emitByte(parser, OP_SUBTRACT);
-            emitBytes(parser, setOp, (uint8_t)arg);
+            emitVariableOp(parser, setOp, arg, moduleSlot);
             return;
         }
         else if (match(parser, TOKEN_SLASH_EQUAL))
         {
-            emitBytes(parser, getOp, (uint8_t)arg);
+            emitVariableOp(parser, getOp, arg, moduleSlot);
             expression(parser);
             emitByte(parser, OP_DIVIDE);
-            emitBytes(parser, setOp, (uint8_t)arg);
+            emitVariableOp(parser, setOp, arg, moduleSlot);
             return;
         }
         else if (match(parser, TOKEN_PERCENT_EQUAL))
         {
-            emitBytes(parser, getOp, (uint8_t)arg);
+            emitVariableOp(parser, getOp, arg, moduleSlot);
             expression(parser);
             emitByte(parser, OP_MODULO);
-            emitBytes(parser, setOp, (uint8_t)arg);
+            emitVariableOp(parser, setOp, arg, moduleSlot);
             return;
         }
     }
 
-    emitBytes(parser, getOp, (uint8_t)arg);
+    emitVariableOp(parser, getOp, arg, moduleSlot);
 }
 
 void variable(Parser *parser, bool canAssign)
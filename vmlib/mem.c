@@ -4,12 +4,17 @@
 #else
 #define _GNU_SOURCE
 #include <pthread.h>
-#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
 #endif
+#include <errno.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include "common.h"
 #include "mem.h"
+#include "slab.h"
 #include "compiler.h"
 #include "comet.h"
 
@@ -21,24 +26,151 @@
 // 128kB
 #define MINIMUM_GC_MARK 131072
 
+// Defaults for the settings below, see setGarbageCollectionOption()
+#define DEFAULT_NURSERY_SIZE (1024 * 1024)
+#define DEFAULT_INITIAL_HEAP_SIZE (4 * 1024 * 1024)
+#define DEFAULT_HEAP_GROWTH_FACTOR 2.0
+
+// The share of its time the program should spend collecting garbage. While
+// it spends more, the heap is let grow faster than heap_growth_factor so that
+// full collections come around less often, up to this many times faster.
+#define TARGET_GC_TIME_RATIO 0.05
+#define MAX_GROWTH_BOOST 8.0
+#define GROWTH_BOOST_STEP 1.5
+
+// Threads keep a running total of what they have allocated and only add it to
+// _bytes_allocated once it grows past this, so they don't all contend on it.
+#define ALLOCATION_BUFFER_SIZE (64 * 1024)
+
+// The most threads, the collecting one included, that mark the heap at once.
+// Defaults to the number of cores.
+#define MAX_MARK_WORKERS 16
+// Smaller heaps are marked by the collecting thread alone, waking the other
+// workers would take longer than they'd save
+#define PARALLEL_MARK_MINIMUM (4 * 1024 * 1024)
+// A worker with more grey objects than this hands half of them over whenever
+// another worker has run out
+#define MARK_SHARE_THRESHOLD 32
+
+// How many old objects are swept each time an object is allocated, while a
+// full collection has left some unswept
+#define SWEEP_SLICE_SIZE 256
+
 size_t _bytes_allocated = 0;
-size_t _next_GC = MINIMUM_GC_MARK;
+size_t _next_GC = DEFAULT_NURSERY_SIZE;
+size_t _next_full_GC = DEFAULT_INITIAL_HEAP_SIZE;
+
+// A minor collection of the nursery runs each time this much has been
+// allocated since the last collection.
+static size_t nursery_size = DEFAULT_NURSERY_SIZE;
+// The heap can grow to this before the first full collection, and full
+// collections never run more often than it takes to reach it again
+static size_t initial_heap_size = DEFAULT_INITIAL_HEAP_SIZE;
+// The old generation is only collected once the heap has grown by this
+// factor since the last full collection.
+static double heap_growth_factor = DEFAULT_HEAP_GROWTH_FACTOR;
+// Full collections run before the heap grows past this, however often that
+// means they have to run. 0 for no limit.
+static size_t max_heap_size = 0;
+// 0 for one per core
+static int mark_threads = 0;
+
+// Everything ever allocated, see gc_get_stats()
+static size_t total_bytes_allocated;
+static uint32_t full_gc_count;
+static uint64_t total_gc_pause;
+static uint64_t max_gc_pause;
+
+// Scales heap_growth_factor while collecting is taking too much of the time
+static double growth_boost = 1.0;
+// Time spent collecting since the last full collection, and when that ended
+static uint64_t gc_time_since_full;
+static uint64_t last_full_gc_end;
 static bool collecting_garbage;
+// Set while a minor collection is marking, old objects count as reachable
+static bool minor_collection;
+// Non zero from the point a collection wants to start until it finishes.
+// Running threads stop at their next safepoint and wait on gc_lock.
+volatile int _safepoint_requested;
 
-static void collectGarbage(void);
+static void collectGarbage(bool full);
+static void loadGarbageCollectionOptions(void);
+#if !REF_COUNT_MEM_MANAGEMENT
+static void sweepSlice(void);
+// Set by the heap snapshot while the world is stopped. markObject() hands
+// every object it's given to this instead of marking it, which lets the
+// snapshot list an object's references with blackenObject().
+static void (*reference_visitor)(Obj *object);
+#endif
 
 static VM **threads;
 static volatile int num_threads = 0;
 static volatile int thread_capacity = 0;
 
 #if !REF_COUNT_MEM_MANAGEMENT
-static Obj **grey_stack;
-static int grey_capacity = 0;
-static int grey_count = 0;
+// The grey objects of one mark worker. Only the owner touches objects, the
+// other workers can only take what has been moved to shared.
+typedef struct
+{
+    Obj **objects;
+    int count;
+    int capacity;
+    Obj **shared;
+    volatile int sharedCount;
+    int sharedCapacity;
+#ifdef WIN32
+    CRITICAL_SECTION sharedLock;
+#else
+    pthread_mutex_t sharedLock;
+#endif
+} MarkStack;
+
+static MarkStack mark_stacks[MAX_MARK_WORKERS];
+// Helper threads started so far, they belong to mark_stacks[1...]
+static int mark_helpers = 0;
+static bool mark_helpers_configured = false;
+// Workers marking the current collection, 1 when the helpers sit it out
+static int active_mark_workers = 1;
+// Workers that have run out of grey objects, marking is over once they all have
+static volatile int idle_mark_workers;
+// Helpers wait for mark_round to change, then take part in that round
+static int mark_round = 0;
+static int busy_mark_helpers = 0;
+static bool mark_helpers_exit = false;
+
+// Old objects that have had a young object stored in them since the last
+// collection
+static Obj **remembered_set;
+static int remembered_capacity = 0;
+static int remembered_count = 0;
+
+// Objects holding weak references that marking has come across, see
+// markWeakReferences()
+typedef struct
+{
+    Value object;
+    const WeakReferenceCallbacks *callbacks;
+} WeakReferences;
+
+static WeakReferences *weak_references;
+static int weak_capacity = 0;
+static volatile int weak_count = 0;
 #endif
 
 static uint32_t gc_count;
+// The nursery, everything allocated since the last collection. Each VM has a
+// nursery of its own, this one holds what's left over from threads that have
+// finished.
 static Obj *generation_0;
+// Objects that have survived a collection
+static Obj *generation_1;
+// The old generation as a full collection left it, still to be swept. Objects
+// are moved back to generation_1 or freed a slice at a time by the allocator.
+static Obj *unswept_objects;
+// Unreachable classes found while sweeping. They are only freed once the
+// sweep is over, since instances of theirs that are yet to be swept need them.
+static Obj *unswept_classes;
+static volatile bool sweep_pending;
 
 #if DEBUG_LOG_GC || DEBUG_LOG_GC_MINIMAL
 static uint64_t total_gc_clocks;
@@ -46,13 +178,16 @@ static uint64_t total_gc_clocks;
 
 #ifdef WIN32
 static HANDLE gc_lock;
+static HANDLE remembered_lock;
 #define MUTEX_LOCK(mut) WaitForSingleObject(mut, INFINITE)
 #define MUTEX_UNLOCK(mut) ReleaseMutex(mut)
 #define MUTEX_DESTROY(mut) CloseHandle(mut)
-#define MUTEX_TRY_LOCK(mut) WaitForSingleObject(mut, 1)
-#define MUTEX_LOCK_FAILED WAIT_ABANDONED
+#define MUTEX_TRY_LOCK(mut) WaitForSingleObject(mut, 0)
+#define MUTEX_LOCK_FAILED WAIT_TIMEOUT
 #else
 static pthread_mutex_t gc_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+// Only ever held by running threads, a collection doesn't need it
+static pthread_mutex_t remembered_lock = PTHREAD_MUTEX_INITIALIZER;
 #define MUTEX_LOCK(mut) pthread_mutex_lock(&mut)
 #define MUTEX_UNLOCK(mut) pthread_mutex_unlock(&mut)
 #define MUTEX_DESTROY(mut) pthread_mutex_destroy(&mut)
@@ -60,6 +195,69 @@ static pthread_mutex_t gc_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 #define MUTEX_LOCK_FAILED EBUSY
 #endif
 
+// The mark workers use locks and condition variables that only they share
+#ifdef WIN32
+static CRITICAL_SECTION mark_pool_lock;
+static CRITICAL_SECTION weak_lock;
+static CONDITION_VARIABLE mark_pool_start;
+static CONDITION_VARIABLE mark_pool_done;
+static HANDLE mark_helper_threads[MAX_MARK_WORKERS];
+#define MARK_LOCK_INIT(lock) InitializeCriticalSection(&(lock))
+#define MARK_LOCK_DESTROY(lock) DeleteCriticalSection(&(lock))
+#define MARK_LOCK(lock) EnterCriticalSection(&(lock))
+#define MARK_UNLOCK(lock) LeaveCriticalSection(&(lock))
+#define MARK_WAIT(cond, lock) SleepConditionVariableCS(&(cond), &(lock), INFINITE)
+#define MARK_SIGNAL(cond) WakeConditionVariable(&(cond))
+#define MARK_BROADCAST(cond) WakeAllConditionVariable(&(cond))
+#else
+static pthread_mutex_t mark_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t weak_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mark_pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t mark_pool_done = PTHREAD_COND_INITIALIZER;
+static pthread_t mark_helper_threads[MAX_MARK_WORKERS];
+#define MARK_LOCK_INIT(lock) pthread_mutex_init(&(lock), NULL)
+#define MARK_LOCK_DESTROY(lock) pthread_mutex_destroy(&(lock))
+#define MARK_LOCK(lock) pthread_mutex_lock(&(lock))
+#define MARK_UNLOCK(lock) pthread_mutex_unlock(&(lock))
+#define MARK_WAIT(cond, lock) pthread_cond_wait(&(cond), &(lock))
+#define MARK_SIGNAL(cond) pthread_cond_signal(&(cond))
+#define MARK_BROADCAST(cond) pthread_cond_broadcast(&(cond))
+#endif
+
+#ifdef WIN32
+#define THREAD_LOCAL __declspec(thread)
+#define ATOMIC_ADD(var, amount) InterlockedExchangeAdd64((volatile LONG64 *)&(var), (LONG64)(amount))
+#define ATOMIC_LOAD(var) InterlockedCompareExchange((volatile LONG *)&(var), 0, 0)
+#define ATOMIC_STORE(var, value) InterlockedExchange((volatile LONG *)&(var), (value))
+#define ATOMIC_INCREMENT(var) InterlockedIncrement((volatile LONG *)&(var))
+#define ATOMIC_DECREMENT(var) InterlockedDecrement((volatile LONG *)&(var))
+#define ATOMIC_LOAD_FLAG(var) (*(volatile bool *)&(var))
+#define ATOMIC_TEST_AND_SET(var) InterlockedExchange8((volatile char *)&(var), 1)
+#define THREAD_YIELD() SwitchToThread()
+#else
+#define THREAD_LOCAL _Thread_local
+#define ATOMIC_ADD(var, amount) __atomic_add_fetch(&(var), (amount), __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(var) __atomic_load_n(&(var), __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE(var, value) __atomic_store_n(&(var), (value), __ATOMIC_SEQ_CST)
+#define ATOMIC_INCREMENT(var) __atomic_add_fetch(&(var), 1, __ATOMIC_SEQ_CST)
+#define ATOMIC_DECREMENT(var) __atomic_sub_fetch(&(var), 1, __ATOMIC_SEQ_CST)
+#define ATOMIC_LOAD_FLAG(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define ATOMIC_TEST_AND_SET(var) __atomic_exchange_n(&(var), true, __ATOMIC_RELAXED)
+#define THREAD_YIELD() sched_yield()
+#endif
+
+// The VM registered on the current thread, NULL until initVM() has run.
+static THREAD_LOCAL VM *thread_vm;
+// Set on the thread that is running a collection
+static THREAD_LOCAL bool thread_collecting;
+static THREAD_LOCAL ptrdiff_t thread_unflushed_bytes;
+// Allocations only, flushed into total_bytes_allocated alongside the above
+static THREAD_LOCAL size_t thread_unflushed_allocations;
+#if !REF_COUNT_MEM_MANAGEMENT
+// Where objects marked on this thread are pushed
+static THREAD_LOCAL MarkStack *thread_mark_stack;
+#endif
+
 uint32_t get_current_thread_id()
 {
 #ifdef WIN32
@@ -72,6 +270,17 @@ uint32_t get_current_thread_id()
 void register_thread(VM *vm)
 {
     MUTEX_LOCK(gc_lock);
+    for (int i = 0; i < num_threads; i++)
+    {
+        if (threads[i] == vm)
+        {
+            thread_vm = vm;
+            MUTEX_UNLOCK(gc_lock);
+            return;
+        }
+    }
+    vm->youngObjects = NULL;
+    vm->parked = 0;
     if (thread_capacity <= num_threads)
     {
         int new_capacity = GROW_CAPACITY(thread_capacity);
@@ -83,85 +292,390 @@ void register_thread(VM *vm)
         }
     }
     threads[num_threads++] = vm;
+    thread_vm = vm;
     MUTEX_UNLOCK(gc_lock);
 }
 
 void deregister_thread(VM *vm)
 {
+    // The thread is done with the heap, a collection needn't wait for it
+    enterSafeRegion(vm);
     MUTEX_LOCK(gc_lock);
     int index = 0;
-    for (; index < thread_capacity; index++)
+    while (index < num_threads && threads[index] != vm)
+        index++;
+
+    if (index < num_threads)
     {
-        if (threads[index] == vm)
+        // Anything the thread allocated that is still alive is left to the
+        // next collection
+        Obj *object = vm->youngObjects;
+        while (object != NULL)
+        {
+            Obj *next = object->next;
+            object->next = generation_0;
+            generation_0 = object;
+            object = next;
+        }
+        vm->youngObjects = NULL;
+
+        for (; index < num_threads - 1; index++)
         {
-            threads[index] = NULL;
+            threads[index] = threads[index + 1];
         }
+        threads[--num_threads] = NULL;
     }
+    if (thread_vm == vm)
+        thread_vm = NULL;
+    slabReleaseThreadPages();
+    MUTEX_UNLOCK(gc_lock);
+}
+
+void enterSafeRegion(VM *vm)
+{
+    ATOMIC_STORE(vm->parked, 1);
+}
 
-    for (; index < (thread_capacity - 1); index++)
+void leaveSafeRegion(VM *vm)
+{
+    for (;;)
     {
-        threads[index] = threads[index + 1];
+        ATOMIC_STORE(vm->parked, 0);
+        if (!ATOMIC_LOAD(_safepoint_requested))
+            return;
+
+        // A collection holds gc_lock for as long as it runs
+        ATOMIC_STORE(vm->parked, 1);
+        MUTEX_LOCK(gc_lock);
+        MUTEX_UNLOCK(gc_lock);
     }
-    num_threads--;
-    MUTEX_UNLOCK(gc_lock);
 }
 
-void *reallocate(void *previous, size_t oldSize, size_t newSize)
+void stopAtSafepoint(VM *vm)
 {
-    MUTEX_LOCK(gc_lock);
-    _bytes_allocated += newSize - oldSize;
-#if DEBUG_STRESS_GC
-    if (newSize > oldSize && _bytes_allocated > MINIMUM_GC_MARK)
+    enterSafeRegion(vm);
+    leaveSafeRegion(vm);
+}
+
+// Waits for every other thread to stop at a safepoint or enter a safe region.
+// Has to be called holding gc_lock.
+static void stopTheWorld(void)
+{
+    ATOMIC_STORE(_safepoint_requested, 1);
+    for (int i = 0; i < num_threads; i++)
     {
-        collectGarbage();
+        if (threads[i] == thread_vm)
+            continue;
+        while (!ATOMIC_LOAD(threads[i]->parked))
+            THREAD_YIELD();
     }
+}
+
+static void resumeTheWorld(void)
+{
+    ATOMIC_STORE(_safepoint_requested, 0);
+}
+
+// Allocating is a safepoint, a thread can only be part way through
+// initialising an object when it next allocates, which a collection on its own
+// thread would see anyway. Threads without a VM hold gc_lock instead.
+static void enterAllocator(void)
+{
+    if (thread_collecting)
+        return;
+
+    if (thread_vm == NULL)
+    {
+        MUTEX_LOCK(gc_lock);
+        return;
+    }
+    safepoint(thread_vm);
+}
+
+static void leaveAllocator(void)
+{
+    if (thread_collecting)
+        return;
+
+    if (thread_vm == NULL)
+        MUTEX_UNLOCK(gc_lock);
+}
+
+static void countBytes(ptrdiff_t bytes)
+{
+    thread_unflushed_bytes += bytes;
+    if (bytes > 0)
+        thread_unflushed_allocations += bytes;
+    if (thread_collecting ||
+        thread_unflushed_bytes > ALLOCATION_BUFFER_SIZE ||
+        thread_unflushed_bytes < -ALLOCATION_BUFFER_SIZE)
+    {
+        ATOMIC_ADD(_bytes_allocated, thread_unflushed_bytes);
+        ATOMIC_ADD(total_bytes_allocated, thread_unflushed_allocations);
+        thread_unflushed_bytes = 0;
+        thread_unflushed_allocations = 0;
+    }
+}
+
+static bool isCollectionNeeded(size_t oldSize, size_t newSize)
+{
+    if (collecting_garbage || thread_collecting)
+        return false;
+    // Only growing can start a collection, so freeing never has to worry
+    // about one happening part way through
+    if (newSize <= oldSize)
+        return false;
+#if DEBUG_STRESS_GC
+    return _bytes_allocated > MINIMUM_GC_MARK;
+#else
+    return _bytes_allocated > _next_GC;
+#endif
+}
+
+static void setNextFullCollection(void)
+{
+    size_t next = (size_t)(_bytes_allocated * heap_growth_factor * growth_boost);
+    if (next < initial_heap_size)
+        next = initial_heap_size;
+    if (max_heap_size > 0 && next > max_heap_size)
+        next = max_heap_size;
+    _next_full_GC = next;
+}
+
+// Lets the heap grow faster while collections since the last full one have
+// taken up more than their share of the time, and slower again once they
+// don't. Called as a full collection starts.
+static void adaptHeapGrowth(uint64_t now)
+{
+    uint64_t elapsed = now - last_full_gc_end;
+    if (last_full_gc_end == 0 || elapsed == 0)
+        return;
+
+    double ratio = (double)gc_time_since_full / (double)elapsed;
+    if (ratio > TARGET_GC_TIME_RATIO)
+        growth_boost *= GROWTH_BOOST_STEP;
+    else if (ratio < TARGET_GC_TIME_RATIO / 2)
+        growth_boost /= GROWTH_BOOST_STEP;
+
+    if (growth_boost > MAX_GROWTH_BOOST)
+        growth_boost = MAX_GROWTH_BOOST;
+    if (growth_boost < 1.0)
+        growth_boost = 1.0;
+}
+
+// In nanoseconds, from some arbitrary point
+static uint64_t monotonicTime(void)
+{
+#ifdef WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1000000000.0 / (double)frequency.QuadPart);
 #else
-    if ((_bytes_allocated > _next_GC) && !collecting_garbage)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static void lockHeap(void)
+{
+    VM *vm = thread_vm;
+    // Another thread may want to collect at the same time, it can go first
+    if (vm != NULL)
+        enterSafeRegion(vm);
+    MUTEX_LOCK(gc_lock);
+    if (vm != NULL)
+        ATOMIC_STORE(vm->parked, 0);
+}
+
+// The calling thread is the only one that runs until the collection is over.
+static void startCollection(void)
+{
+    lockHeap();
+    // Which means there might be nothing left to do
+    if (isCollectionNeeded(0, 1))
     {
-        collectGarbage();
+        uint64_t start = monotonicTime();
+        bool full = _bytes_allocated > _next_full_GC;
+        if (full)
+            adaptHeapGrowth(start);
+        stopTheWorld();
+        thread_collecting = true;
+        collectGarbage(full);
+        thread_collecting = false;
+        resumeTheWorld();
+
+        uint64_t end = monotonicTime();
+        uint64_t pause = end - start;
+        gc_time_since_full += pause;
+        total_gc_pause += pause;
+        if (pause > max_gc_pause)
+            max_gc_pause = pause;
+        if (full)
+        {
+            full_gc_count++;
+            gc_time_since_full = 0;
+            last_full_gc_end = end;
+        }
     }
+    MUTEX_UNLOCK(gc_lock);
+}
+
+static const char *obj_type_names[NUM_OBJ_TYPES] = {
+    "BoundMethod",
+    "Class",
+    "NativeClass",
+    "NativeMethod",
+    "Closure",
+    "Function",
+    "Instance",
+    "NativeInstance",
+    "Native",
+    "Upvalue",
+    "Shape",
+};
+
+const char *gc_obj_type_name(ObjType type)
+{
+    return obj_type_names[type];
+}
+
+static void countObjects(GCStats *stats, Obj *list, bool markedOnly)
+{
+    for (Obj *object = list; object != NULL; object = object->next)
+    {
+#if !REF_COUNT_MEM_MANAGEMENT
+        if (markedOnly && !object->isMarked)
+            continue;
 #endif
+        stats->live_objects[object->type]++;
+        if (object->type == OBJ_INSTANCE || object->type == OBJ_NATIVE_INSTANCE)
+            stats->live_instances[((ObjInstance *)object)->klass->classType]++;
+    }
+}
+
+// Stops every other thread while it counts what's on the heap, so that it
+// sees every nursery as it is.
+void gc_get_stats(GCStats *stats)
+{
+    memset(stats, 0, sizeof(GCStats));
+    lockHeap();
+    stopTheWorld();
+    stats->collections = gc_count;
+    stats->full_collections = full_gc_count;
+    stats->total_pause_ns = total_gc_pause;
+    stats->max_pause_ns = max_gc_pause;
+    stats->heap_size = _bytes_allocated;
+    stats->bytes_allocated = ATOMIC_ADD(total_bytes_allocated, 0);
+    stats->bytes_freed = stats->bytes_allocated > stats->heap_size ? stats->bytes_allocated - stats->heap_size : 0;
+    stats->next_collection = _next_GC;
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        countObjects(stats, threads[i]->youngObjects, false);
+    }
+    countObjects(stats, generation_0, false);
+    countObjects(stats, generation_1, false);
+    // Whatever the last full collection didn't mark is garbage waiting to be
+    // swept, including all of unswept_classes
+    countObjects(stats, unswept_objects, true);
+    resumeTheWorld();
+    MUTEX_UNLOCK(gc_lock);
+}
+
+static void *allocate(void *previous, size_t oldSize, size_t newSize)
+{
+    countBytes((ptrdiff_t)newSize - (ptrdiff_t)oldSize);
+    if (isCollectionNeeded(oldSize, newSize))
+    {
+        startCollection();
+    }
     if (newSize == 0)
     {
         free(previous);
-        MUTEX_UNLOCK(gc_lock);
         return NULL;
     }
-    void *result = realloc(previous, newSize);
-    MUTEX_UNLOCK(gc_lock);
+    return realloc(previous, newSize);
+}
+
+void *reallocate(void *previous, size_t oldSize, size_t newSize)
+{
+    enterAllocator();
+    void *result = allocate(previous, oldSize, newSize);
+    leaveAllocator();
     return result;
 }
 
+// Objects come from the slab allocator rather than malloc, see slab.h
+static void *allocateCell(size_t size)
+{
+    countBytes((ptrdiff_t)size);
+    if (isCollectionNeeded(0, size))
+    {
+        startCollection();
+    }
+    return slabAllocate(size);
+}
+
 Obj *allocateObject(VM *vm, size_t size, ObjType type)
 {
-    MUTEX_LOCK(gc_lock);
-    Obj *object = (Obj *)reallocate(NULL, 0, size);
+#if !REF_COUNT_MEM_MANAGEMENT
+    if (sweep_pending)
+        sweepSlice();
+#endif
+    enterAllocator();
+    Obj *object = (Obj *)allocateCell(size);
+    // A collection can happen before the caller has initialised every field,
+    // zeroing means it only ever sees NULLs and empty tables.
+    memset(object, 0, size);
     object->type = type;
 #if REF_COUNT_MEM_MANAGEMENT
     object->refCount = 1;
-#else
-    object->isMarked = true;
 #endif
 
-    object->next = generation_0;
-    generation_0 = object;
+    object->next = vm->youngObjects;
+    vm->youngObjects = object;
 
 #if DEBUG_LOG_GC
     printf("%p allocate %ld for %s\n", (void *)object, size, objTypeName(type));
 #endif
 
     push(vm, OBJ_VAL(object));
-    MUTEX_UNLOCK(gc_lock);
+    leaveAllocator();
     return object;
 }
 
+#if !REF_COUNT_MEM_MANAGEMENT
+static void pushGrey(MarkStack *stack, Obj *object)
+{
+    if (stack->capacity < stack->count + 1)
+    {
+        stack->capacity = GROW_CAPACITY(stack->capacity);
+        stack->objects = realloc(stack->objects, sizeof(Obj *) * stack->capacity);
+    }
+    stack->objects[stack->count++] = object;
+}
+#endif
+
 void markObject(Obj *object)
 {
     if (object == NULL)
         return;
 
 #if !REF_COUNT_MEM_MANAGEMENT
-    if (object->isMarked)
+    if (reference_visitor != NULL)
+    {
+        reference_visitor(object);
+        return;
+    }
+    if (ATOMIC_LOAD_FLAG(object->isMarked))
+        return;
+    if (minor_collection && object->isOld)
+        return;
+    // Other workers can reach the same object at the same time, only the one
+    // that sets the mark goes on to trace it
+    if (ATOMIC_TEST_AND_SET(object->isMarked))
         return;
 #endif
 
@@ -172,14 +686,7 @@ void markObject(Obj *object)
 #endif
 
 #if !REF_COUNT_MEM_MANAGEMENT
-    object->isMarked = true;
-    if (grey_capacity < grey_count + 1)
-    {
-        grey_capacity = GROW_CAPACITY(grey_capacity);
-        grey_stack = realloc(grey_stack, sizeof(Obj *) * grey_capacity);
-    }
-
-    grey_stack[grey_count++] = object;
+    pushGrey(thread_mark_stack, object);
 #endif
 }
 
@@ -190,6 +697,57 @@ void markValue(Value value)
     markObject(AS_OBJ(value));
 }
 
+bool isObjectUnreachable(Obj *object)
+{
+#if REF_COUNT_MEM_MANAGEMENT
+    return object->refCount == 0;
+#else
+    return !object->isMarked && !(minor_collection && object->isOld);
+#endif
+}
+
+void rememberObject(Obj *object)
+{
+#if !REF_COUNT_MEM_MANAGEMENT
+    if (!object->isOld || object->isRemembered)
+        return;
+
+    MUTEX_LOCK(remembered_lock);
+    if (!object->isRemembered)
+    {
+        object->isRemembered = true;
+        if (remembered_capacity < remembered_count + 1)
+        {
+            remembered_capacity = GROW_CAPACITY(remembered_capacity);
+            remembered_set = realloc(remembered_set, sizeof(Obj *) * remembered_capacity);
+        }
+        remembered_set[remembered_count++] = object;
+    }
+    MUTEX_UNLOCK(remembered_lock);
+#endif
+}
+
+void markWeakReferences(Value object, const WeakReferenceCallbacks *callbacks)
+{
+#if !REF_COUNT_MEM_MANAGEMENT
+    // The heap snapshot only wants strong references
+    if (reference_visitor != NULL)
+        return;
+
+    // Any of the mark workers can get here
+    MARK_LOCK(weak_lock);
+    if (weak_capacity < weak_count + 1)
+    {
+        weak_capacity = GROW_CAPACITY(weak_capacity);
+        weak_references = realloc(weak_references, sizeof(WeakReferences) * weak_capacity);
+    }
+    weak_references[weak_count].object = object;
+    weak_references[weak_count].callbacks = callbacks;
+    weak_count++;
+    MARK_UNLOCK(weak_lock);
+#endif
+}
+
 #if !REF_COUNT_MEM_MANAGEMENT
 static void markArray(ValueArray *array)
 {
@@ -229,6 +787,7 @@ static void blackenObject(Obj *object)
         {
             markValue(klass->attributes[i]);
         }
+        markObject((Obj *)klass->rootShape);
         break;
     }
     case OBJ_CLOSURE:
@@ -264,7 +823,7 @@ static void blackenObject(Obj *object)
     {
         ObjInstance *instance = (ObjInstance *)object;
         markObject((Obj *)instance->klass);
-        markTable(&instance->fields);
+        markInstanceFields(instance);
         break;
     }
     case OBJ_NATIVE_INSTANCE:
@@ -276,12 +835,15 @@ static void blackenObject(Obj *object)
             marker(OBJ_VAL(object));
         }
         markObject((Obj *)instance->klass);
-        markTable(&instance->fields);
+        markInstanceFields(instance);
         break;
     }
     case OBJ_UPVALUE:
         markValue(((ObjUpvalue *)object)->closed);
         break;
+    case OBJ_SHAPE:
+        markShape((ObjShape *)object);
+        break;
     case OBJ_NATIVE_METHOD:
     {
         ObjNativeMethod *method = (ObjNativeMethod *)object;
@@ -294,6 +856,16 @@ static void blackenObject(Obj *object)
 }
 #endif
 
+static void releaseObject(Obj *object, size_t size)
+{
+    enterAllocator();
+    countBytes(-(ptrdiff_t)size);
+    slabFree(object, size);
+    leaveAllocator();
+}
+
+#define FREE_OBJ(type, object) releaseObject(object, sizeof(type))
+
 static void freeObject(Obj *object)
 {
 #if DEBUG_LOG_GC || DEBUG_LOG_GC_OBJ_FREES
@@ -335,7 +907,7 @@ static void freeObject(Obj *object)
     switch (object->type)
     {
     case OBJ_BOUND_METHOD:
-        FREE(ObjBoundMethod, object);
+        FREE_OBJ(ObjBoundMethod, object);
         break;
     case OBJ_CLASS:
     {
@@ -344,7 +916,7 @@ static void freeObject(Obj *object)
         freeTable(&klass->methods);
         freeTable(&klass->staticMethods);
         FREE_ARRAY(Value, klass->attributes, klass->attributeCount);
-        FREE(ObjClass, object);
+        FREE_OBJ(ObjClass, object);
         break;
     }
     case OBJ_NATIVE_CLASS:
@@ -354,19 +926,19 @@ static void freeObject(Obj *object)
         freeTable(&klass->klass.methods);
         freeTable(&klass->klass.staticMethods);
         FREE_ARRAY(Value, klass->klass.attributes, klass->klass.attributeCount);
-        FREE(ObjNativeClass, object);
+        FREE_OBJ(ObjNativeClass, object);
         break;
     }
     case OBJ_NATIVE_METHOD:
     {
-        FREE(ObjNativeMethod, object);
+        FREE_OBJ(ObjNativeMethod, object);
         break;
     }
     case OBJ_CLOSURE:
     {
         ObjClosure *closure = (ObjClosure *)object;
         FREE_ARRAY(ObjUpvalue *, closure->upvalues, closure->upvalueCount);
-        FREE(ObjClosure, object);
+        FREE_OBJ(ObjClosure, object);
         break;
     }
     case OBJ_FUNCTION:
@@ -377,14 +949,15 @@ static void freeObject(Obj *object)
         {
             FREE_ARRAY(Value, function->attributes, function->attributeCount);
         }
-        FREE(ObjFunction, object);
+        FREE_OBJ(ObjFunction, object);
         break;
     }
     case OBJ_INSTANCE:
     {
         ObjInstance *instance = (ObjInstance *)object;
-        freeTable(&instance->fields);
-        FREE(ObjInstance, object);
+        size_t size = sizeof(ObjInstance) + sizeof(Value) * instance->inlineFieldCapacity;
+        freeInstanceFields(instance);
+        releaseObject(object, size);
         break;
     }
     case OBJ_NATIVE_INSTANCE:
@@ -395,19 +968,28 @@ static void freeObject(Obj *object)
         {
             klass->destructor(instance);
         }
-        freeTable(&instance->fields);
-        FREE_NATIVE_INSTANCE(object);
+        freeInstanceFields(instance);
+        releaseObject(object, klass->allocSize);
         break;
     }
     case OBJ_NATIVE:
-        FREE(ObjNative, object);
+        FREE_OBJ(ObjNative, object);
         break;
     case OBJ_UPVALUE:
-        FREE(ObjUpvalue, object);
+        FREE_OBJ(ObjUpvalue, object);
+        break;
+    case OBJ_SHAPE:
+        freeTable(&((ObjShape *)object)->transitions);
+        FREE_OBJ(ObjShape, object);
         break;
     }
 }
 
+static bool isClass(Obj *object)
+{
+    return object->type == OBJ_CLASS || object->type == OBJ_NATIVE_CLASS;
+}
+
 #if !REF_COUNT_MEM_MANAGEMENT
 
 static void markRoots(VM *vm)
@@ -430,67 +1012,401 @@ static void markRoots(VM *vm)
     {
         markObject((Obj *)upvalue);
     }
+
+    markValue(vm->pendingException);
 }
 
-static void traceReferences()
+// Hands the oldest half of the stack's grey objects to the other workers.
+// Objects near the bottom tend to lead to the most work.
+static void shareGreyObjects(MarkStack *stack)
 {
-    while (grey_count > 0)
+    int count = stack->count / 2;
+    MARK_LOCK(stack->sharedLock);
+    int sharedCount = stack->sharedCount;
+    if (stack->sharedCapacity < sharedCount + count)
     {
-        Obj *object = grey_stack[--grey_count];
-        blackenObject(object);
+        while (stack->sharedCapacity < sharedCount + count)
+            stack->sharedCapacity = GROW_CAPACITY(stack->sharedCapacity);
+        stack->shared = realloc(stack->shared, sizeof(Obj *) * stack->sharedCapacity);
     }
+    memcpy(stack->shared + sharedCount, stack->objects, sizeof(Obj *) * count);
+    ATOMIC_STORE(stack->sharedCount, sharedCount + count);
+    MARK_UNLOCK(stack->sharedLock);
+
+    stack->count -= count;
+    memmove(stack->objects, stack->objects + count, sizeof(Obj *) * stack->count);
 }
 
-static Obj *sweep_object_list(Obj *object, Obj **base)
+// Moves shared objects from one stack to another, half of them when stealing
+// from another worker and all of them when a worker takes its own back.
+static int takeSharedObjects(MarkStack *to, MarkStack *from)
 {
-    Obj *previous = NULL;
-    while (object != NULL)
+    MARK_LOCK(from->sharedLock);
+    int sharedCount = from->sharedCount;
+    int count = to == from ? sharedCount : (sharedCount + 1) / 2;
+    for (int i = 0; i < count; i++)
+    {
+        pushGrey(to, from->shared[--sharedCount]);
+    }
+    ATOMIC_STORE(from->sharedCount, sharedCount);
+    MARK_UNLOCK(from->sharedLock);
+    return count;
+}
+
+// Blackens grey objects until the worker has none left, its shared ones
+// included. Only other workers can add to a worker's shared objects once it
+// has none, so a worker that's out of work stays that way.
+static void drainMarkStack(MarkStack *stack)
+{
+    for (;;)
+    {
+        while (stack->count > 0)
+        {
+            if (active_mark_workers > 1 &&
+                stack->count > MARK_SHARE_THRESHOLD &&
+                ATOMIC_LOAD(idle_mark_workers) > 0 &&
+                ATOMIC_LOAD(stack->sharedCount) == 0)
+            {
+                shareGreyObjects(stack);
+            }
+            blackenObject(stack->objects[--stack->count]);
+        }
+        if (ATOMIC_LOAD(stack->sharedCount) == 0 || takeSharedObjects(stack, stack) == 0)
+            return;
+    }
+}
+
+static bool stealGreyObjects(MarkStack *stack)
+{
+    int self = (int)(stack - mark_stacks);
+    for (int i = 1; i < active_mark_workers; i++)
+    {
+        MarkStack *victim = &mark_stacks[(self + i) % active_mark_workers];
+        if (ATOMIC_LOAD(victim->sharedCount) == 0)
+            continue;
+
+        // Counted as busy before holding anything, so that the others can't
+        // decide marking is over while objects are on their way here
+        ATOMIC_DECREMENT(idle_mark_workers);
+        if (takeSharedObjects(stack, victim) > 0)
+            return true;
+        ATOMIC_INCREMENT(idle_mark_workers);
+    }
+    return false;
+}
+
+// Run by every worker taking part in a round. Marking is over once all of
+// them are idle, as idle workers hold no grey objects and can't make any.
+static void markInParallel(MarkStack *stack)
+{
+    for (;;)
+    {
+        drainMarkStack(stack);
+        ATOMIC_INCREMENT(idle_mark_workers);
+        while (!stealGreyObjects(stack))
+        {
+            if (ATOMIC_LOAD(idle_mark_workers) == active_mark_workers)
+                return;
+            THREAD_YIELD();
+        }
+    }
+}
+
+#ifdef WIN32
+static DWORD WINAPI markHelper(LPVOID arg)
+#else
+static void *markHelper(void *arg)
+#endif
+{
+    MarkStack *stack = (MarkStack *)arg;
+    thread_mark_stack = stack;
+    int round = 0;
+    MARK_LOCK(mark_pool_lock);
+    for (;;)
     {
+        while (mark_round == round && !mark_helpers_exit)
+            MARK_WAIT(mark_pool_start, mark_pool_lock);
+        if (mark_helpers_exit)
+            break;
+
+        round = mark_round;
+        MARK_UNLOCK(mark_pool_lock);
+        markInParallel(stack);
+        MARK_LOCK(mark_pool_lock);
+        if (--busy_mark_helpers == 0)
+            MARK_SIGNAL(mark_pool_done);
+    }
+    MARK_UNLOCK(mark_pool_lock);
+    return 0;
+}
+
+static int countMarkWorkers(void)
+{
+    int workers = mark_threads;
+    if (workers == 0)
+    {
+#ifdef WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        workers = (int)info.dwNumberOfProcessors;
+#else
+        workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    }
+    if (workers < 1)
+        return 1;
+    return workers < MAX_MARK_WORKERS ? workers : MAX_MARK_WORKERS;
+}
+
+// The helpers are only started by the first collection that can use them
+static void startMarkHelpers(void)
+{
+    mark_helpers_configured = true;
+    int workers = countMarkWorkers();
+    for (int i = 1; i < workers; i++)
+    {
+#ifdef WIN32
+        mark_helper_threads[i] = CreateThread(NULL, 0, &markHelper, &mark_stacks[i], 0, NULL);
+        if (mark_helper_threads[i] == NULL)
+            break;
+#else
+        if (pthread_create(&mark_helper_threads[i], NULL, &markHelper, &mark_stacks[i]) != 0)
+            break;
+#endif
+        mark_helpers++;
+    }
+}
+
+static void stopMarkHelpers(void)
+{
+    MARK_LOCK(mark_pool_lock);
+    mark_helpers_exit = true;
+    MARK_BROADCAST(mark_pool_start);
+    MARK_UNLOCK(mark_pool_lock);
+    for (int i = 1; i <= mark_helpers; i++)
+    {
+#ifdef WIN32
+        WaitForSingleObject(mark_helper_threads[i], INFINITE);
+        CloseHandle(mark_helper_threads[i]);
+#else
+        pthread_join(mark_helper_threads[i], NULL);
+#endif
+    }
+    mark_helpers = 0;
+    mark_helpers_configured = false;
+}
+
+// Everything marked so far is on the collecting thread's stack, which the
+// helpers start out by stealing from.
+static void traceReferences(bool parallel)
+{
+    if (parallel && !mark_helpers_configured)
+        startMarkHelpers();
+    if (!parallel || mark_helpers == 0)
+    {
+        active_mark_workers = 1;
+        drainMarkStack(&mark_stacks[0]);
+        return;
+    }
+
+    active_mark_workers = mark_helpers + 1;
+    idle_mark_workers = 0;
+    MARK_LOCK(mark_pool_lock);
+    busy_mark_helpers = mark_helpers;
+    mark_round++;
+    MARK_BROADCAST(mark_pool_start);
+    MARK_UNLOCK(mark_pool_lock);
+
+    markInParallel(&mark_stacks[0]);
+
+    // The helpers may still be looking at the other stacks
+    MARK_LOCK(mark_pool_lock);
+    while (busy_mark_helpers > 0)
+        MARK_WAIT(mark_pool_done, mark_pool_lock);
+    MARK_UNLOCK(mark_pool_lock);
+}
+
+// Once everything strongly reachable has been marked, whatever the weak
+// objects hold on to through a reachable key is marked too. That can make more
+// keys reachable and turn up more weak objects, so it carries on until nothing
+// new is marked. The references left unreached are then cleared, while the
+// objects they point to are still there to be looked at.
+static void processWeakReferences(void)
+{
+    bool marked;
+    do
+    {
+        for (int i = 0; i < weak_count; i++)
+        {
+            WeakReferences *weak = &weak_references[i];
+            if (weak->callbacks->markEphemerons != NULL)
+                weak->callbacks->markEphemerons(weak->object);
+        }
+        marked = mark_stacks[0].count > 0;
+        traceReferences(false);
+    } while (marked);
+
+    for (int i = 0; i < weak_count; i++)
+    {
+        WeakReferences *weak = &weak_references[i];
+        if (weak->callbacks->clearUnreachable != NULL)
+            weak->callbacks->clearUnreachable(weak->object);
+    }
+    weak_count = 0;
+}
+
+// Young objects reachable from the old generation are found by tracing from
+// the remembered objects, rather than from the whole of the old generation.
+static void markRememberedSet()
+{
+    for (int i = 0; i < remembered_count; i++)
+    {
+        blackenObject(remembered_set[i]);
+    }
+}
+
+// Once everything has been marked no young objects are left to be remembered,
+// the survivors are all about to be promoted.
+static void forgetRememberedSet()
+{
+    for (int i = 0; i < remembered_count; i++)
+    {
+        remembered_set[i]->isRemembered = false;
+    }
+    remembered_count = 0;
+}
+
+// Sweeps up to count of the unswept objects. Minor collections can run part
+// way through, they promote into generation_1 and never look at old objects'
+// marks. Has to be called holding gc_lock.
+static void sweepOldObjects(int count)
+{
+    size_t before = _bytes_allocated;
+    while (unswept_objects != NULL && count-- > 0)
+    {
+        Obj *object = unswept_objects;
+        unswept_objects = object->next;
         if (object->isMarked)
         {
             object->isMarked = false;
-            previous = object;
-            object = object->next;
+            object->next = generation_1;
+            generation_1 = object;
+        }
+        else if (isClass(object))
+        {
+            object->next = unswept_classes;
+            unswept_classes = object;
         }
         else
         {
-            Obj *unreached = object;
+            freeObject(object);
+        }
+    }
+    // The next minor collection is still due after the same amount of new
+    // allocation
+    size_t freed = before > _bytes_allocated ? before - _bytes_allocated : 0;
+    _next_GC = _next_GC > freed ? _next_GC - freed : 0;
+    if (unswept_objects != NULL)
+        return;
 
-            object = object->next;
-            if (previous != NULL)
-            {
-                previous->next = object;
-            }
-            else
-            {
-                *base = object;
-            }
+    while (unswept_classes != NULL)
+    {
+        Obj *klass = unswept_classes;
+        unswept_classes = klass->next;
+        freeObject(klass);
+    }
+    // Until now the heap size included everything waiting to be freed
+    if (sweep_pending)
+    {
+        setNextFullCollection();
+        slabReleaseEmptyPages(true);
+    }
+    sweep_pending = false;
+}
 
-            freeObject(unreached);
+static void finishSweeping(void)
+{
+    while (sweep_pending)
+        sweepOldObjects(SWEEP_SLICE_SIZE);
+}
+
+// Runs on whichever thread is allocating, while everything else carries on.
+// The objects being freed are unreachable, so no other thread can be using
+// them.
+static void sweepSlice(void)
+{
+    if (thread_collecting || MUTEX_TRY_LOCK(gc_lock) == MUTEX_LOCK_FAILED)
+        return;
+
+    // Freeing mustn't stop at a safepoint while holding gc_lock
+    thread_collecting = true;
+    if (sweep_pending)
+        sweepOldObjects(SWEEP_SLICE_SIZE);
+    thread_collecting = false;
+    MUTEX_UNLOCK(gc_lock);
+}
+
+// Frees the unreached young objects and promotes the rest, leaving the
+// nursery empty. Survivors keep their order, newest first.
+static void sweepNursery(Obj **nursery)
+{
+    Obj *survivors = NULL;
+    Obj *lastSurvivor = NULL;
+    Obj *object = *nursery;
+    while (object != NULL)
+    {
+        Obj *next = object->next;
+        if (object->isMarked)
+        {
+            object->isMarked = false;
+            object->isOld = true;
+            object->next = NULL;
+            if (lastSurvivor != NULL)
+                lastSurvivor->next = object;
+            else
+                survivors = object;
+            lastSurvivor = object;
+        }
+        else
+        {
+            freeObject(object);
         }
+        object = next;
     }
-    if (previous != NULL)
+    if (lastSurvivor != NULL)
     {
-        return previous->next != NULL ? previous->next : previous;
+        lastSurvivor->next = generation_1;
+        generation_1 = survivors;
     }
-    return *base;
+    *nursery = NULL;
 }
 
-static void sweep()
+// Only the nurseries are swept while the world is stopped. The old generation
+// is set aside after a full collection and swept bit by bit afterwards.
+static void sweep(bool full)
 {
-    sweep_object_list(generation_0, &generation_0);
+    if (full && generation_1 != NULL)
+    {
+        unswept_objects = generation_1;
+        generation_1 = NULL;
+        sweep_pending = true;
+    }
+    sweepNursery(&generation_0);
+    for (int i = 0; i < num_threads; i++)
+    {
+        sweepNursery(&threads[i]->youngObjects);
+    }
     gc_count++;
 }
 #endif
 
-static void collectGarbage()
+static void collectGarbage(bool full)
 {
 #if DEBUG_LOG_GC || DEBUG_LOG_GC_MINIMAL
-    printf("-- gc begin on thread: 0x%X\n", get_current_thread_id());
+    printf("-- %s gc begin on thread: 0x%X\n", full ? "full" : "minor", get_current_thread_id());
     size_t before = _bytes_allocated;
     clock_t start = clock();
 #endif
-    collecting_garbage = true;
 
 #if REF_COUNT_MEM_MANAGEMENT
     Obj *object = generation_0;
@@ -504,53 +1420,493 @@ static void collectGarbage()
         object = next;
     }
 #else
-    for (int i = 0; i < thread_capacity; i++)
+    // Marks left on the old generation by the last full collection would be
+    // mistaken for new ones
+    if (full)
+        finishSweeping();
+    minor_collection = !full;
+    thread_mark_stack = &mark_stacks[0];
+    for (int i = 0; i < num_threads; i++)
     {
-        if (threads[i] != NULL)
-            markRoots(threads[i]);
+        markRoots(threads[i]);
     }
     markGlobals();
-    traceReferences();
+    if (minor_collection)
+        markRememberedSet();
+    traceReferences(full && _bytes_allocated >= PARALLEL_MARK_MINIMUM);
+    processWeakReferences();
+    forgetRememberedSet();
     removeWhiteStrings();
-    sweep();
+    sweep(full);
+    slabReleaseEmptyPages(true);
+    minor_collection = false;
 #endif
 
-    _next_GC = _bytes_allocated + MINIMUM_GC_MARK;
-    collecting_garbage = false;
+    _next_GC = _bytes_allocated + nursery_size;
+    if (full)
+        setNextFullCollection();
 #if DEBUG_LOG_GC || DEBUG_LOG_GC_MINIMAL
     clock_t end = clock();
     total_gc_clocks += (end - start);
     printf("-- gc end on thread 0x%X\n", get_current_thread_id());
-    printf("   collected %ld bytes (from %ld to %ld) next at %ld\n",
+    printf("   collected %ld bytes (from %ld to %ld) next at %ld, full at %ld\n",
            before - _bytes_allocated, before, _bytes_allocated,
-           _next_GC);
+           _next_GC, _next_full_GC);
     printf("   GC lasted %lu clocks\n", end - start);
 #endif
 }
 
-void initializeGarbageCollection()
+// The size of the object itself, as allocated by allocateObject()
+static size_t objectSize(Obj *object)
+{
+    switch (object->type)
+    {
+    case OBJ_BOUND_METHOD:
+        return sizeof(ObjBoundMethod);
+    case OBJ_CLASS:
+        return sizeof(ObjClass);
+    case OBJ_NATIVE_CLASS:
+        return sizeof(ObjNativeClass);
+    case OBJ_NATIVE_METHOD:
+        return sizeof(ObjNativeMethod);
+    case OBJ_CLOSURE:
+        return sizeof(ObjClosure);
+    case OBJ_FUNCTION:
+        return sizeof(ObjFunction);
+    case OBJ_INSTANCE:
+        return sizeof(ObjInstance) + sizeof(Value) * ((ObjInstance *)object)->inlineFieldCapacity;
+    case OBJ_NATIVE_INSTANCE:
+        return ((ObjNativeClass *)((ObjInstance *)object)->klass)->allocSize;
+    case OBJ_NATIVE:
+        return sizeof(ObjNative);
+    case OBJ_UPVALUE:
+        return sizeof(ObjUpvalue);
+    case OBJ_SHAPE:
+        return sizeof(ObjShape);
+    }
+    return 0;
+}
+
+#if !REF_COUNT_MEM_MANAGEMENT
+// Stops the world and runs a full collection, sweeping all of it, so that
+// everything left on the heap is reachable and in generation_1. The world
+// stays stopped until resumeHeap().
+static void collectWholeHeap(void)
+{
+    lockHeap();
+    stopTheWorld();
+    thread_collecting = true;
+    collectGarbage(true);
+    full_gc_count++;
+    finishSweeping();
+}
+
+static void resumeHeap(void)
+{
+    thread_collecting = false;
+    resumeTheWorld();
+    MUTEX_UNLOCK(gc_lock);
+}
+#endif
+
+typedef struct
+{
+    // The class of instances, otherwise the object type
+    const void *key;
+    const char *name;
+    size_t count;
+    size_t bytes;
+} CensusSlot;
+
+typedef struct
+{
+    CensusSlot *slots;
+    int capacity;
+    int count;
+} Census;
+
+static CensusSlot *findCensusSlot(Census *census, const void *key)
+{
+    uint32_t index = (uint32_t)(((uintptr_t)key >> 4) * 2654435761u) & (census->capacity - 1);
+    while (census->slots[index].key != NULL && census->slots[index].key != key)
+        index = (index + 1) & (census->capacity - 1);
+    return &census->slots[index];
+}
+
+static void growCensus(Census *census)
+{
+    CensusSlot *old = census->slots;
+    int oldCapacity = census->capacity;
+    census->capacity = GROW_CAPACITY(oldCapacity) * 2;
+    census->slots = calloc(census->capacity, sizeof(CensusSlot));
+    for (int i = 0; i < oldCapacity; i++)
+    {
+        if (old[i].key != NULL)
+            *findCensusSlot(census, old[i].key) = old[i];
+    }
+    free(old);
+}
+
+static void censusAdd(Census *census, const void *key, const char *name, size_t bytes)
+{
+    if ((census->count + 1) * 2 > census->capacity)
+        growCensus(census);
+    CensusSlot *slot = findCensusSlot(census, key);
+    if (slot->key == NULL)
+    {
+        slot->key = key;
+        slot->name = name;
+        census->count++;
+    }
+    slot->count++;
+    slot->bytes += bytes;
+}
+
+static int compareCensusEntries(const void *a, const void *b)
+{
+    size_t bytesA = ((const GCCensusEntry *)a)->bytes;
+    size_t bytesB = ((const GCCensusEntry *)b)->bytes;
+    return bytesA < bytesB ? 1 : bytesA > bytesB ? -1 : 0;
+}
+
+// Only a slot per class is kept, however large the heap.
+int gc_heap_census(GCCensusEntry **entries)
+{
+    Census census = {NULL, 0, 0};
+    *entries = NULL;
+#if !REF_COUNT_MEM_MANAGEMENT
+    collectWholeHeap();
+    for (Obj *object = generation_1; object != NULL; object = object->next)
+    {
+        if (object->type == OBJ_INSTANCE || object->type == OBJ_NATIVE_INSTANCE)
+        {
+            ObjClass *klass = ((ObjInstance *)object)->klass;
+            censusAdd(&census, klass, klass->name, objectSize(object));
+        }
+        else
+        {
+            // Object types can't be mistaken for addresses
+            censusAdd(&census, (const void *)(uintptr_t)(object->type + 1), gc_obj_type_name(object->type), objectSize(object));
+        }
+    }
+
+    // Copied before the world resumes, the classes may not be around for long
+    GCCensusEntry *result = malloc(sizeof(GCCensusEntry) * (census.count > 0 ? census.count : 1));
+    int count = 0;
+    for (int i = 0; i < census.capacity; i++)
+    {
+        CensusSlot *slot = &census.slots[i];
+        if (slot->key == NULL)
+            continue;
+        size_t length = strlen(slot->name);
+        char *name = malloc(length + 1);
+        memcpy(name, slot->name, length + 1);
+        result[count].name = name;
+        result[count].count = slot->count;
+        result[count].bytes = slot->bytes;
+        count++;
+    }
+    resumeHeap();
+    free(census.slots);
+
+    qsort(result, count, sizeof(GCCensusEntry), compareCensusEntries);
+    *entries = result;
+    return count;
+#else
+    return 0;
+#endif
+}
+
+void gc_free_census(GCCensusEntry *entries, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        free((char *)entries[i].name);
+    }
+    free(entries);
+}
+
+#if !REF_COUNT_MEM_MANAGEMENT
+static FILE *snapshot_file;
+static const char *snapshot_root;
+
+static void writeRoot(Obj *object)
+{
+    fprintf(snapshot_file, "root %s %" PRIxPTR "\n", snapshot_root, (uintptr_t)object);
+}
+
+static void writeReference(Obj *object)
+{
+    fprintf(snapshot_file, " %" PRIxPTR, (uintptr_t)object);
+}
+
+static const char *snapshotName(Obj *object)
+{
+    switch (object->type)
+    {
+    case OBJ_INSTANCE:
+    case OBJ_NATIVE_INSTANCE:
+        return ((ObjInstance *)object)->klass->name;
+    case OBJ_CLASS:
+    case OBJ_NATIVE_CLASS:
+        return ((ObjClass *)object)->name;
+    case OBJ_CLOSURE:
+        object = (Obj *)((ObjClosure *)object)->function;
+        // fall through
+    case OBJ_FUNCTION:
+        if (object != NULL && ((ObjFunction *)object)->name != NIL_VAL)
+            return string_get_cstr(((ObjFunction *)object)->name);
+        return "-";
+    default:
+        return "-";
+    }
+}
+#endif
+
+// Streams straight to the file, nothing is kept in memory per object.
+bool gc_write_heap_snapshot(const char *path)
+{
+#if !REF_COUNT_MEM_MANAGEMENT
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return false;
+
+    collectWholeHeap();
+    snapshot_file = file;
+    fprintf(file, "comet-heap-snapshot 1\n");
+
+    reference_visitor = writeRoot;
+    char threadRoot[32];
+    for (int i = 0; i < num_threads; i++)
+    {
+        snprintf(threadRoot, sizeof(threadRoot), "thread:%d", i);
+        snapshot_root = threadRoot;
+        markRoots(threads[i]);
+    }
+    snapshot_root = "globals";
+    markGlobals();
+
+    reference_visitor = writeReference;
+    for (Obj *object = generation_1; object != NULL; object = object->next)
+    {
+        fprintf(file, "%" PRIxPTR " %s %s %zu", (uintptr_t)object,
+                gc_obj_type_name(object->type), snapshotName(object), objectSize(object));
+        blackenObject(object);
+        fputc('\n', file);
+    }
+    reference_visitor = NULL;
+    snapshot_file = NULL;
+    resumeHeap();
+
+    return fclose(file) == 0;
+#else
+    return false;
+#endif
+}
+
+// Accepts a number of bytes, optionally followed by k, m or g
+static bool parseSize(const char *value, size_t *result)
+{
+    char *end;
+    errno = 0;
+    unsigned long long size = strtoull(value, &end, 10);
+    if (end == value || errno != 0 || value[0] == '-')
+        return false;
+    switch (*end)
+    {
+    case 'g':
+    case 'G':
+        size *= 1024;
+        // fall through
+    case 'm':
+    case 'M':
+        size *= 1024;
+        // fall through
+    case 'k':
+    case 'K':
+        size *= 1024;
+        end++;
+        break;
+    }
+    if (*end != '\0')
+        return false;
+    *result = (size_t)size;
+    return true;
+}
+
+typedef enum
+{
+    GC_OPTION_NURSERY_SIZE,
+    GC_OPTION_INITIAL_HEAP,
+    GC_OPTION_GROWTH_FACTOR,
+    GC_OPTION_MAX_HEAP,
+    GC_OPTION_THREADS,
+    NUM_GC_OPTIONS
+} GcOption;
+
+static const struct
+{
+    const char *name;
+    const char *env_varname;
+} gc_options[NUM_GC_OPTIONS] = {
+    {"nursery-size", "COMET_GC_NURSERY_SIZE"},
+    {"initial-heap", "COMET_GC_INITIAL_HEAP"},
+    {"growth-factor", "COMET_GC_GROWTH_FACTOR"},
+    {"max-heap", "COMET_GC_MAX_HEAP"},
+    {"threads", "COMET_GC_THREADS"},
+};
+
+// Options given explicitly win over the environment
+static bool gc_option_set[NUM_GC_OPTIONS];
+
+static bool applyGarbageCollectionOption(GcOption option, const char *value)
+{
+    size_t size;
+    char *end;
+    switch (option)
+    {
+    case GC_OPTION_NURSERY_SIZE:
+        if (!parseSize(value, &size) || size == 0)
+            return false;
+        nursery_size = size;
+        break;
+    case GC_OPTION_INITIAL_HEAP:
+        if (!parseSize(value, &size) || size == 0)
+            return false;
+        initial_heap_size = size;
+        break;
+    case GC_OPTION_GROWTH_FACTOR:
+    {
+        double factor = strtod(value, &end);
+        if (end == value || *end != '\0' || !(factor > 1.0))
+            return false;
+        heap_growth_factor = factor;
+        break;
+    }
+    case GC_OPTION_MAX_HEAP:
+        if (!parseSize(value, &size))
+            return false;
+        max_heap_size = size;
+        break;
+    case GC_OPTION_THREADS:
+    {
+        long threads = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || threads < 0)
+            return false;
+        mark_threads = (int)(threads > MAX_MARK_WORKERS ? MAX_MARK_WORKERS : threads);
+        break;
+    }
+    default:
+        return false;
+    }
+
+    // Before the first collection the thresholds still come from the defaults
+    if (gc_count == 0)
+    {
+        _next_GC = nursery_size;
+        _next_full_GC = initial_heap_size;
+        if (max_heap_size > 0 && _next_full_GC > max_heap_size)
+            _next_full_GC = max_heap_size;
+    }
+    return true;
+}
+
+bool setGarbageCollectionOption(const char *name, const char *value)
+{
+    for (int i = 0; i < NUM_GC_OPTIONS; i++)
+    {
+        if (strcmp(gc_options[i].name, name) == 0)
+        {
+            if (!applyGarbageCollectionOption((GcOption)i, value))
+                return false;
+            gc_option_set[i] = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void loadGarbageCollectionOptions(void)
+{
+    for (int i = 0; i < NUM_GC_OPTIONS; i++)
+    {
+        const char *value = getenv(gc_options[i].env_varname);
+        if (gc_option_set[i] || value == NULL)
+            continue;
+        if (!applyGarbageCollectionOption((GcOption)i, value))
+            fprintf(stderr, "Ignoring invalid %s: '%s'\n", gc_options[i].env_varname, value);
+    }
+}
+
+void initializeGarbageCollection(void)
 {
 #ifdef WIN32
     gc_lock = CreateMutex(NULL, false, NULL);
+    remembered_lock = CreateMutex(NULL, false, NULL);
+    InitializeConditionVariable(&mark_pool_start);
+    InitializeConditionVariable(&mark_pool_done);
+#endif
+#if !REF_COUNT_MEM_MANAGEMENT
+    MARK_LOCK_INIT(mark_pool_lock);
+    MARK_LOCK_INIT(weak_lock);
+    mark_helpers_exit = false;
+    for (int i = 0; i < MAX_MARK_WORKERS; i++)
+    {
+        MARK_LOCK_INIT(mark_stacks[i].sharedLock);
+    }
 #endif
     collecting_garbage = false;
+    minor_collection = false;
     gc_count = 0;
     generation_0 = NULL;
+    generation_1 = NULL;
+    unswept_objects = NULL;
+    unswept_classes = NULL;
+    sweep_pending = false;
+    initSlabs();
+    loadGarbageCollectionOptions();
 }
 
-static void free_object_list(Obj *object)
+// Frees either the classes or everything else in the list, leaving the rest
+// linked in place.
+static void free_object_list(Obj **list, bool classes)
 {
-    while (object != NULL)
+    Obj **link = list;
+    while (*link != NULL)
     {
-        Obj *next = object->next;
-        freeObject(object);
-        object = next;
+        Obj *object = *link;
+        if (isClass(object) == classes)
+        {
+            *link = object->next;
+            freeObject(object);
+        }
+        else
+        {
+            link = &object->next;
+        }
     }
 }
 
+static void free_all_objects(bool classes)
+{
+    for (int i = 0; i < num_threads; i++)
+    {
+        free_object_list(&threads[i]->youngObjects, classes);
+    }
+    free_object_list(&generation_0, classes);
+    free_object_list(&generation_1, classes);
+    free_object_list(&unswept_objects, classes);
+    free_object_list(&unswept_classes, classes);
+}
+
 void freeObjects()
 {
-    free_object_list(generation_0);
+    // Instances need their class to be destroyed, so classes go last
+    free_all_objects(false);
+    free_all_objects(true);
+    sweep_pending = false;
+    slabReleaseThreadPages();
+    slabReleaseEmptyPages(false);
 }
 
 void finalizeGarbageCollection(void)
@@ -561,10 +1917,23 @@ void finalizeGarbageCollection(void)
 #endif
 
 #if !REF_COUNT_MEM_MANAGEMENT
-    FREE_ARRAY(Obj*, grey_stack, grey_capacity);
-    grey_stack = NULL;
-    grey_count = 0;
-    grey_capacity = 0;
+    stopMarkHelpers();
+    for (int i = 0; i < MAX_MARK_WORKERS; i++)
+    {
+        MarkStack *stack = &mark_stacks[i];
+        free(stack->objects);
+        free(stack->shared);
+        MARK_LOCK_DESTROY(stack->sharedLock);
+        memset(stack, 0, sizeof(MarkStack));
+    }
+    free(remembered_set);
+    remembered_set = NULL;
+    remembered_count = 0;
+    remembered_capacity = 0;
+    free(weak_references);
+    weak_references = NULL;
+    weak_count = 0;
+    weak_capacity = 0;
 #endif
 
     FREE_ARRAY(VM *, threads, thread_capacity);
@@ -575,4 +1944,9 @@ void finalizeGarbageCollection(void)
     collecting_garbage = true;
     MUTEX_UNLOCK(gc_lock);
     MUTEX_DESTROY(gc_lock);
+    MUTEX_DESTROY(remembered_lock);
+#if !REF_COUNT_MEM_MANAGEMENT
+    MARK_LOCK_DESTROY(mark_pool_lock);
+    MARK_LOCK_DESTROY(weak_lock);
+#endif
 }
\ No newline at end of file
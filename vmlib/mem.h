@@ -15,9 +15,6 @@
 #define FREE(type, pointer) \
     reallocate(pointer, sizeof(type), 0)
 
-#define FREE_NATIVE_INSTANCE(pointer) \
-    reallocate(pointer, ((ObjNativeClass *)((ObjInstance *) pointer)->klass)->allocSize, 0)
-
 #define GROW_CAPACITY(capacity) \
     ((capacity) < 8 ? 8 : (capacity)*2)
 
@@ -35,6 +32,64 @@ void *reallocate(void *previous, size_t oldSize, size_t newSize);
 Obj *allocateObject(VM *vm, size_t size, ObjType type);
 void markObject(Obj* object);
 void markValue(Value value);
+bool isObjectUnreachable(Obj *object);
+void rememberObject(Obj *object);
+
+// For native objects that hold on to other objects weakly, see
+// markWeakReferences(). Either can be NULL.
+typedef struct
+{
+    // Marks whatever the object only holds on to while something else is
+    // reachable, e.g. the values of entries whose keys are reachable. Called
+    // again each time marking it has led to more objects being marked.
+    void (*markEphemerons)(Value object);
+    // Drops the references to everything isObjectUnreachable(), called after
+    // marking is over and before anything is freed
+    void (*clearUnreachable)(Value object);
+} WeakReferenceCallbacks;
+
+// Called from the marker of a native object, in place of marking what it holds
+// weakly. The callbacks are called once the rest of the heap has been marked.
+void markWeakReferences(Value object, const WeakReferenceCallbacks *callbacks);
+
+// Has to be called after storing value in a field of object, without
+// allocating in between. Minor collections only trace from old objects that
+// have been remembered, so a young object referenced only by an old one would
+// otherwise be freed. Use rememberObject() after storing several values.
+static inline void writeBarrier(Obj *object, Value value)
+{
+#if !REF_COUNT_MEM_MANAGEMENT
+    if (object->isOld && !object->isRemembered && IS_OBJ(value) && !AS_OBJ(value)->isOld)
+        rememberObject(object);
+#endif
+}
+
+// Set when a collection is waiting for the other threads to stop
+extern volatile int _safepoint_requested;
+
+void stopAtSafepoint(VM *vm);
+// Natives that block (waiting on a lock, a socket, another thread etc.) call
+// these around the blocking call, so that a collection on another thread
+// doesn't have to wait for them. Nothing in the heap can be read or written in
+// between.
+void enterSafeRegion(VM *vm);
+void leaveSafeRegion(VM *vm);
+
+// Threads stop here while another thread collects garbage. Called wherever
+// the thread's stack fully describes what it's holding on to.
+static inline void safepoint(VM *vm)
+{
+    if (_safepoint_requested)
+        stopAtSafepoint(vm);
+}
+
+// Sets one of the collector's tuning options by name, see docs/index.md for
+// the list. Returns false if there is no such option or the value is invalid.
+// Options not set this way are read from the environment by
+// initializeGarbageCollection().
+bool setGarbageCollectionOption(const char *name, const char *value);
+
 void freeObjects();
+void initializeGarbageCollection(void);
 void finalizeGarbageCollection(void);
 #endif
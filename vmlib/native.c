@@ -8,7 +8,7 @@
 void defineNativeFunction(VM *vm, const char *name, NativeFn function)
 {
     newNativeFunction(vm, function);
-    push(vm, copyString(vm, name, (int)strlen(name)));
+    push(vm, copyInternedString(vm, name, (int)strlen(name)));
     addGlobal(peek(vm, 0), peek(vm, 1));
     pop(vm);
     pop(vm);
@@ -22,7 +22,7 @@ VALUE bootstrapNativeClass(VM *vm, const char *name, NativeConstructor construct
 VALUE completeNativeClassDefinition(VM *vm, VALUE klass_, const char *super_name)
 {
     ObjClass *klass = AS_CLASS(klass_);
-    Value name_string = copyString(vm, klass->name, (int)strlen(klass->name));
+    Value name_string = copyInternedString(vm, klass->name, (int)strlen(klass->name));
     push(vm, name_string);
     if (string_compare_to_cstr(name_string, "Object") != 0)
     {
@@ -31,7 +31,7 @@ VALUE completeNativeClassDefinition(VM *vm, VALUE klass_, const char *super_name
         {
             super_name = "Object";
         }
-        Value superClassName = copyString(vm, super_name, (int)strlen(super_name));
+        Value superClassName = copyInternedString(vm, super_name, (int)strlen(super_name));
         push(vm, superClassName);
         if (!findGlobal(superClassName, &parent))
         {
@@ -57,6 +57,8 @@ VALUE completeNativeClassDefinition(VM *vm, VALUE klass_, const char *super_name
             klass->operators[i] = parent_class->operators[i];
         }
         klass->super_ = AS_CLASS(parent);
+        rememberObject((Obj *)klass);
+        invalidateInlineCaches(klass);
     }
     if (addGlobal(name_string, OBJ_VAL(klass)))
     {
@@ -88,7 +90,7 @@ VALUE defineNativeClass(
 
 void defineNativeMethod(VM *vm, VALUE klass, NativeMethod function, const char *name, uint8_t arity, bool isStatic)
 {
-    Value name_string = copyString(vm, name, strlen(name));
+    Value name_string = copyInternedString(vm, name, strlen(name));
     push(vm, name_string);
     push(vm, klass);
     newNativeMethod(vm, function, arity, isStatic, name_string);
@@ -100,7 +102,7 @@ void defineNativeMethod(VM *vm, VALUE klass, NativeMethod function, const char *
 void defineNativeOperator(VM *vm, VALUE klass, NativeMethod function, uint8_t arity, OPERATOR operator)
 {
     const char *op_method_chars = getOperatorString(operator);
-    Value op_method_name = copyString(vm, op_method_chars, strlen(op_method_chars));
+    Value op_method_name = copyInternedString(vm, op_method_chars, strlen(op_method_chars));
     push(vm, op_method_name);
     push(vm, klass);
     newNativeMethod(vm, function, arity, false, op_method_name);
@@ -109,13 +111,20 @@ void defineNativeOperator(VM *vm, VALUE klass, NativeMethod function, uint8_t ar
     pop(vm);
 }
 
+void defineNativeHash(VALUE klass, NativeHashFunction hasher, NativeEqualsFunction equals)
+{
+    ObjNativeClass *native = AS_NATIVE_CLASS(klass);
+    native->hasher = hasher;
+    native->equals = equals;
+}
+
 void setNativeProperty(VM *vm, VALUE self, const char *property_name, VALUE value)
 {
     push(vm, self);
     push(vm, value);
-    Value name_string = copyString(vm, property_name, strlen(property_name));
+    Value name_string = copyInternedString(vm, property_name, strlen(property_name));
     push(vm, name_string);
-    tableSet(&AS_INSTANCE(self)->fields, name_string, value);
+    instanceSetField(vm, AS_INSTANCE(self), name_string, value);
     pop(vm);
     pop(vm);
     pop(vm);
@@ -124,8 +133,8 @@ void setNativeProperty(VM *vm, VALUE self, const char *property_name, VALUE valu
 VALUE getNativeProperty(VM *vm, VALUE self, const char *property_name)
 {
     Value value;
-    Value name_string = copyString(vm, property_name, strlen(property_name));
-    if (tableGet(&AS_INSTANCE(self)->fields, name_string, &value))
+    Value name_string = copyInternedString(vm, property_name, strlen(property_name));
+    if (instanceGetField(AS_INSTANCE(self), name_string, &value))
     {
         return value;
     }
@@ -17,6 +17,7 @@ VALUE defineNativeClass(
     bool final);
 void defineNativeMethod(VM *vm, VALUE klass, NativeMethod function, const char *name, uint8_t arity, bool isStatic);
 void defineNativeOperator(VM *vm, VALUE klass, NativeMethod function, uint8_t arity, OPERATOR operator_);
+void defineNativeHash(VALUE klass, NativeHashFunction hasher, NativeEqualsFunction equals);
 void setNativeProperty(VM *vm, VALUE self, const char *property_name, VALUE value);
 VALUE getNativeProperty(VM *vm, VALUE self, const char *property_name);
 
@@ -16,6 +16,7 @@
 #define IS_INSTANCE(value) isObjType(value, OBJ_INSTANCE)
 #define IS_NATIVE_INSTANCE(value) isObjType(value, OBJ_NATIVE_INSTANCE)
 #define IS_NATIVE(value) isObjType(value, OBJ_NATIVE)
+#define IS_SHAPE(value) isObjType(value, OBJ_SHAPE)
 
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod *)AS_OBJ(value))
 #define AS_CLASS(value) ((ObjClass *)AS_OBJ(value))
@@ -28,6 +29,7 @@
 #define AS_NATIVE_INSTANCE(value) ((ObjInstance *)AS_OBJ(value))
 #define AS_NATIVE_OBJ(value) (((ObjNative *)AS_OBJ(value)))
 #define AS_NATIVE(value) (((ObjNative *)AS_OBJ(value))->function)
+#define AS_SHAPE(value) ((ObjShape *)AS_OBJ(value))
 
 #define IS_INSTANCE_OF_STDLIB_TYPE(value, classType) isObjOfStdlibClassType(value, classType)
 
@@ -43,8 +45,11 @@ typedef enum
     OBJ_NATIVE_INSTANCE,
     OBJ_NATIVE,
     OBJ_UPVALUE,
+    OBJ_SHAPE,
 } ObjType;
 
+#define NUM_OBJ_TYPES (OBJ_SHAPE + 1)
+
 typedef enum
 {
     CLS_BOOLEAN,
@@ -59,6 +64,7 @@ typedef enum
     CLS_EXCEPTION,
     CLS_FILE,
     CLS_FUNCTION,
+    CLS_GC,
     CLS_ITERABLE,
     CLS_ITERATOR,
     CLS_LIST,
@@ -76,9 +82,13 @@ typedef enum
     CLS_STRING,
     CLS_STRING_BUILDER,
     CLS_THREAD,
+    CLS_WEAK_HASH,
+    CLS_WEAK_REF,
     CLS_USER_DEF,
 } ClassType;
 
+#define NUM_CLASS_TYPES (CLS_USER_DEF + 1)
+
 typedef enum
 {
     OPERATOR_MULTIPLICATION,
@@ -110,6 +120,10 @@ struct sObj
     int8_t refCount;
 #else
     bool isMarked;
+    // Survived a collection and moved out of the nursery
+    bool isOld;
+    // Old object that may reference young ones, see writeBarrier()
+    bool isRemembered;
 #endif
     struct sObj *next;
 };
@@ -153,6 +167,19 @@ typedef struct
     int upvalueCount;
 } ObjClosure;
 
+// A field layout shared between instances. Each shape adds one field (name)
+// to its parent's layout, at slot fieldCount - 1. The root shape of a class
+// has no parent and no fields.
+typedef struct sObjShape
+{
+    Obj obj;
+    struct sObjShape *parent;
+    Value name;
+    uint32_t nameHash;
+    int fieldCount;
+    Table transitions;
+} ObjShape;
+
 typedef struct sObjClass
 {
     Obj obj;
@@ -165,12 +192,17 @@ typedef struct sObjClass
     bool final;
     Value *attributes;
     int attributeCount;
+    uint32_t cacheVersion;
+    ObjShape *rootShape;
+    uint16_t inlineFieldCount;
 } ObjClass;
 
 typedef void (*NativeConstructor)(void *data);
 typedef void(*NativeDestructor)(void *data);
 typedef Value (*NativeMethod)(VM *vm, Value receiver, int argCount, Value *args);
 typedef void (*MarkNativeObject)(Value self);
+typedef uint32_t (*NativeHashFunction)(Value self);
+typedef bool (*NativeEqualsFunction)(Value self, Value other);
 
 typedef struct sNativeClass
 {
@@ -178,6 +210,10 @@ typedef struct sNativeClass
     NativeConstructor constructor;
     NativeDestructor destructor;
     MarkNativeObject marker;
+    // Optional, lets Hash and Set hash and compare instances without calling
+    // back into the interpreter. Must agree with the class's hash() and ==.
+    NativeHashFunction hasher;
+    NativeEqualsFunction equals;
     size_t allocSize;
 } ObjNativeClass;
 
@@ -194,7 +230,14 @@ typedef struct
 {
     Obj obj;
     ObjClass *klass;
-    Table fields;
+    // fields[slot] holds the field that shape put in that slot. Once an
+    // instance has too many fields, shape is NULL and dictionary maps each
+    // name to its slot instead.
+    ObjShape *shape;
+    Value *fields;
+    Table *dictionary;
+    int fieldCapacity;
+    uint16_t inlineFieldCapacity;
 } ObjInstance;
 
 typedef struct
@@ -1,3 +1,6 @@
+#ifdef WIN32
+#include <Windows.h>
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -19,6 +22,25 @@ ObjBoundMethod *newBoundMethod(VM *vm, Value receiver, ObjClosure *method)
     return bound;
 }
 
+#ifdef WIN32
+#define ATOMIC_INCREMENT(var) InterlockedIncrement((volatile LONG *)&(var))
+#define ATOMIC_STORE(var, value) InterlockedExchange((volatile LONG *)&(var), (LONG)(value))
+#else
+#define ATOMIC_INCREMENT(var) __atomic_add_fetch(&(var), 1, __ATOMIC_RELAXED)
+#define ATOMIC_STORE(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELEASE)
+#endif
+
+static uint32_t classCacheVersion = 0;
+
+void invalidateInlineCaches(ObjClass *klass)
+{
+    // Versions are never reused, so a cache entry can't match a class that
+    // has been freed and had its address handed to a new one. Classes can be
+    // defined on several threads at once, and the inline caches read the
+    // version without a lock.
+    ATOMIC_STORE(klass->cacheVersion, ATOMIC_INCREMENT(classCacheVersion));
+}
+
 static void init_class(ObjClass *klass, const char *name, ClassType classType, bool final)
 {
     size_t length = strlen(name) + 1;
@@ -29,6 +51,9 @@ static void init_class(ObjClass *klass, const char *name, ClassType classType, b
     klass->attributeCount = 0;
     klass->attributes = NULL;
     strncpy(klass->name, name, length);
+    invalidateInlineCaches(klass);
+    klass->rootShape = NULL;
+    klass->inlineFieldCount = 0;
     initTable(&klass->methods);
     initTable(&klass->staticMethods);
     for (int i = 0; i < NUM_OPERATORS; i++)
@@ -59,6 +84,8 @@ ObjNativeClass *newNativeClass(
     klass->constructor = constructor;
     klass->destructor = destructor;
     klass->marker = marker;
+    klass->hasher = NULL;
+    klass->equals = NULL;
     klass->allocSize = allocSize == 0 ? sizeof(ObjInstance) : allocSize;
     return klass;
 }
@@ -105,9 +132,13 @@ Obj *newInstance(VM *vm, ObjClass *klass)
     {
     case OBJ_CLASS:
     {
-        ObjInstance *instance = ALLOCATE_OBJ(vm, ObjInstance, OBJ_INSTANCE);
+        // Fields are stored straight after the instance, sized to the
+        // largest layout seen for the class so far.
+        uint16_t inlineFields = klass->inlineFieldCount;
+        ObjInstance *instance = (ObjInstance *)allocateObject(
+            vm, sizeof(ObjInstance) + sizeof(Value) * inlineFields, OBJ_INSTANCE);
         instance->klass = klass;
-        initTable(&instance->fields);
+        initInstanceFields(instance, inlineFields > 0 ? (Value *)(instance + 1) : NULL, inlineFields);
         return AS_OBJ(pop(vm));
     }
     case OBJ_NATIVE_CLASS:
@@ -115,7 +146,7 @@ Obj *newInstance(VM *vm, ObjClass *klass)
         ObjNativeClass *native_klass = (ObjNativeClass *)klass;
         ObjInstance *instance = (ObjInstance *)allocateObject(vm, native_klass->allocSize, OBJ_NATIVE_INSTANCE);
         instance->klass = klass;
-        initTable(&instance->fields);
+        initInstanceFields(instance, NULL, 0);
         push(vm, OBJ_VAL(native_klass));
         if (native_klass->constructor != NULL)
         {
@@ -151,38 +182,44 @@ ObjNativeMethod *newNativeMethod(VM *vm, NativeMethod function, uint8_t arity, b
     return method;
 }
 
-static Value allocateString(VM *vm, char *chars, int length)
+Value takeString(VM *vm, char *chars, int length)
+{
+    return string_create(vm, chars, length);
+}
+
+Value copyString(VM *vm, const char *chars, size_t length)
 {
-    VALUE string_obj = string_create(vm, chars, length);
-    push(vm, string_obj);
-    internString(string_obj);
+    char *copied_string = ALLOCATE(char, length + 1);
+    memcpy(copied_string, chars, length);
+    copied_string[length] = '\0';
+    return string_create(vm, copied_string, length);
+}
+
+static Value internNewString(VM *vm, Value string)
+{
+    push(vm, string);
+    string = internString(string);
     pop(vm);
-    return string_obj;
+    return string;
 }
 
-Value takeString(VM *vm, char *chars, int length)
+Value takeInternedString(VM *vm, char *chars, int length)
 {
-    uint32_t hash = string_hash_cstr(chars, length);
-    Value interned = findInternedString(chars, hash);
+    Value interned = findInternedString(chars, string_hash_cstr(chars, length));
     if (interned != NIL_VAL)
     {
         FREE_ARRAY(char, chars, length + 1);
         return interned;
     }
-    return allocateString(vm, chars, length);
+    return internNewString(vm, takeString(vm, chars, length));
 }
 
-Value copyString(VM *vm, const char *chars, size_t length)
+Value copyInternedString(VM *vm, const char *chars, size_t length)
 {
-    uint32_t hash = string_hash_cstr(chars, length);
-    Value interned = findInternedString(chars, hash);
+    Value interned = findInternedString(chars, string_hash_cstr(chars, length));
     if (interned != NIL_VAL)
         return interned;
-
-    char *copied_string = ALLOCATE(char, length + 1);
-    memcpy(copied_string, chars, length);
-    copied_string[length] = '\0';
-    return allocateString(vm, copied_string, length);
+    return internNewString(vm, copyString(vm, chars, length));
 }
 
 ObjUpvalue *newUpvalue(VM *vm, Value *slot)
@@ -265,6 +302,9 @@ void printObject(Value value)
     case OBJ_UPVALUE:
         printf("upvalue");
         break;
+    case OBJ_SHAPE:
+        printf("shape (%d fields)", AS_SHAPE(value)->fieldCount);
+        break;
     default:
         printf("Unknown object");
     }
@@ -294,6 +334,8 @@ const char *objTypeName(ObjType type)
         return "native function";
     case OBJ_UPVALUE:
         return "upvalue";
+    case OBJ_SHAPE:
+        return "shape";
     }
 
     return "unknown";
@@ -380,6 +422,33 @@ OPERATOR getOperatorFromToken(TokenType_t token)
     return OPERATOR_UNKNOWN;
 }
 
+// Only classes defined natively can supply hooks, a script class deriving from
+// one might have overridden hash() or ==, so it always goes through dispatch.
+static ObjNativeClass *getNativeHashClass(ObjInstance *instance)
+{
+    if (instance->klass->obj.type != OBJ_NATIVE_CLASS)
+        return NULL;
+    return (ObjNativeClass *)instance->klass;
+}
+
+uint32_t get_object_hash(VM *vm, VALUE value)
+{
+    if (IS_NUMBER(value))
+        return number_get_hash(value);
+
+    if (IS_NATIVE_INSTANCE(value) || IS_INSTANCE(value))
+    {
+        ObjNativeClass *native = getNativeHashClass(AS_INSTANCE(value));
+        if (native != NULL && native->hasher != NULL)
+            return native->hasher(value);
+    }
+
+    call_function(vm, value, common_strings[STRING_HASH], 0, NULL);
+    uint32_t hash = (uint32_t)number_get_value(peek(vm, 0));
+    pop(vm);
+    return hash;
+}
+
 bool compare_objects(VM *vm, VALUE lhs, VALUE rhs)
 {
     if (IS_NUMBER(lhs) && IS_NUMBER(rhs))
@@ -392,6 +461,9 @@ bool compare_objects(VM *vm, VALUE lhs, VALUE rhs)
         if (lhs == rhs)
             return true;
         ObjInstance *obj = AS_INSTANCE(lhs);
+        ObjNativeClass *native = getNativeHashClass(obj);
+        if (native != NULL && native->equals != NULL)
+            return native->equals(lhs, rhs);
         call_function(vm, lhs, obj->klass->operators[OPERATOR_EQUALS], 1, &rhs);
         if (pop(vm) == TRUE_VAL)
             return true;
@@ -7,9 +7,11 @@
 #include "object_defs.h"
 #include "vm.h"
 #include "native.h"
+#include "shape.h"
 
 ObjBoundMethod *newBoundMethod(VM *vm, Value receiver, ObjClosure *method);
 ObjClass *newClass(VM *vm, const char *name, ClassType classType, bool final);
+void invalidateInlineCaches(ObjClass *klass);
 ObjNativeClass *newNativeClass(
     VM *vm,
     const char *name,
@@ -26,6 +28,11 @@ Obj *newInstance(VM *vm, ObjClass *klass);
 ObjNative *newNativeFunction(VM *vm, NativeFn function);
 Value takeString(VM *vm, char *chars, int length);
 Value copyString(VM *vm, const char *chars, size_t length);
+// For identifiers and constants, which are compared far more often than
+// they're created. Strings from anywhere else are only interned once they're
+// used as a key in a Table.
+Value takeInternedString(VM *vm, char *chars, int length);
+Value copyInternedString(VM *vm, const char *chars, size_t length);
 ObjUpvalue *newUpvalue(VM *vm, Value *slot);
 void printObject(Value value);
 const char *objTypeName(ObjType type);
@@ -45,5 +52,8 @@ static inline bool isObjOfStdlibClassType(Value value, ClassType type)
 }
 
 bool compare_objects(VM *vm, VALUE lhs, VALUE rhs);
+// The hash used to place a key in a Hash or Set. Numbers and native classes
+// with a hasher are hashed directly, anything else has hash() called on it.
+uint32_t get_object_hash(VM *vm, VALUE value);
 
 #endif
@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+#include "shape.h"
+#include "table.h"
+#include "comet.h"
+
+static ObjShape *newShape(VM *vm, ObjShape *parent, Value name)
+{
+    ObjShape *shape = (ObjShape *)allocateObject(vm, sizeof(ObjShape), OBJ_SHAPE);
+    shape->parent = parent;
+    shape->name = name;
+    shape->nameHash = parent == NULL ? 0 : string_get_hash(name);
+    shape->fieldCount = parent == NULL ? 0 : parent->fieldCount + 1;
+    initTable(&shape->transitions);
+    return shape;
+}
+
+static ObjShape *getRootShape(VM *vm, ObjClass *klass)
+{
+    if (klass->rootShape == NULL)
+    {
+        klass->rootShape = newShape(vm, NULL, NIL_VAL);
+        writeBarrier((Obj *)klass, OBJ_VAL(klass->rootShape));
+        pop(vm);
+    }
+    return klass->rootShape;
+}
+
+static ObjShape *shapeTransition(VM *vm, ObjShape *shape, Value name)
+{
+    Value existing;
+    if (tableGet(&shape->transitions, name, &existing))
+        return AS_SHAPE(existing);
+
+    ObjShape *child = newShape(vm, shape, name);
+    tableSet(&shape->transitions, name, OBJ_VAL(child));
+    writeBarrier((Obj *)shape, OBJ_VAL(child));
+    pop(vm);
+    return child;
+}
+
+int shapeFindSlot(ObjShape *shape, Value name)
+{
+    if (shape == NULL)
+        return -1;
+
+    uint32_t hash = string_get_hash(name);
+    for (; shape->parent != NULL; shape = shape->parent)
+    {
+        if (shape->name == name ||
+            (shape->nameHash == hash &&
+             strcmp(string_get_cstr(shape->name), string_get_cstr(name)) == 0))
+        {
+            return shape->fieldCount - 1;
+        }
+    }
+    return -1;
+}
+
+void markShape(ObjShape *shape)
+{
+    markObject((Obj *)shape->parent);
+    markValue(shape->name);
+    markTable(&shape->transitions);
+}
+
+static int fieldCount(ObjInstance *instance)
+{
+    if (instance->dictionary != NULL)
+        return instance->dictionary->count;
+    return instance->shape != NULL ? instance->shape->fieldCount : 0;
+}
+
+static bool hasInlineFields(ObjInstance *instance)
+{
+    return instance->inlineFieldCapacity > 0 && instance->fields == (Value *)(instance + 1);
+}
+
+static void freeFieldArray(ObjInstance *instance)
+{
+    if (instance->fields != NULL && !hasInlineFields(instance))
+    {
+        FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+    }
+    instance->fields = NULL;
+    instance->fieldCapacity = 0;
+}
+
+static void ensureFieldCapacity(ObjInstance *instance, int count)
+{
+    if (instance->fieldCapacity >= count)
+        return;
+
+    int capacity = GROW_CAPACITY(instance->fieldCapacity);
+    while (capacity < count)
+        capacity *= 2;
+
+    Value *fields = ALLOCATE(Value, capacity);
+    int existing = fieldCount(instance);
+    if (existing > 0)
+    {
+        memcpy(fields, instance->fields, sizeof(Value) * existing);
+    }
+    freeFieldArray(instance);
+    instance->fields = fields;
+    instance->fieldCapacity = capacity;
+}
+
+void initInstanceFields(ObjInstance *instance, Value *inlineFields, uint16_t inlineFieldCapacity)
+{
+    instance->shape = NULL;
+    instance->fields = inlineFields;
+    instance->fieldCapacity = inlineFieldCapacity;
+    instance->inlineFieldCapacity = inlineFieldCapacity;
+    instance->dictionary = NULL;
+}
+
+void freeInstanceFields(ObjInstance *instance)
+{
+    freeFieldArray(instance);
+    if (instance->dictionary != NULL)
+    {
+        freeTable(instance->dictionary);
+        FREE(Table, instance->dictionary);
+        instance->dictionary = NULL;
+    }
+    instance->shape = NULL;
+}
+
+void markInstanceFields(ObjInstance *instance)
+{
+    if (instance->dictionary != NULL)
+    {
+        markTable(instance->dictionary);
+    }
+    else
+    {
+        markObject((Obj *)instance->shape);
+    }
+
+    int count = fieldCount(instance);
+    for (int i = 0; i < count; i++)
+    {
+        markValue(instance->fields[i]);
+    }
+}
+
+int instanceFindSlot(ObjInstance *instance, Value name)
+{
+    if (instance->dictionary == NULL)
+        return shapeFindSlot(instance->shape, name);
+
+    Value slot;
+    if (tableGet(instance->dictionary, name, &slot))
+        return (int)AS_NUMBER(slot);
+    return -1;
+}
+
+int instanceReserveField(ObjInstance *instance, Value name)
+{
+    int slot = instanceFindSlot(instance, name);
+    if (slot >= 0)
+        return slot;
+
+    slot = instance->dictionary->count;
+    ensureFieldCapacity(instance, slot + 1);
+    instance->fields[slot] = UNDEFINED_VAL;
+    tableSet(instance->dictionary, name, NUMBER_VAL(slot));
+    writeBarrier((Obj *)instance, name);
+    return slot;
+}
+
+bool instanceGetField(ObjInstance *instance, Value name, Value *value)
+{
+    int slot = instanceFindSlot(instance, name);
+    if (slot < 0 || instance->fields[slot] == UNDEFINED_VAL)
+        return false;
+
+    *value = instance->fields[slot];
+    return true;
+}
+
+void instanceAddField(ObjInstance *instance, ObjShape *shape, Value value)
+{
+    ensureFieldCapacity(instance, shape->fieldCount);
+    instance->fields[shape->fieldCount - 1] = value;
+    instance->shape = shape;
+    writeBarrier((Obj *)instance, value);
+    writeBarrier((Obj *)instance, OBJ_VAL(shape));
+
+    // Give later instances of the class enough inline room for this layout
+    ObjClass *klass = instance->klass;
+    if (shape->fieldCount > klass->inlineFieldCount && shape->fieldCount <= MAX_INLINE_FIELDS)
+    {
+        klass->inlineFieldCount = shape->fieldCount;
+    }
+}
+
+bool instanceSetField(VM *vm, ObjInstance *instance, Value name, Value value)
+{
+    if (instance->dictionary != NULL)
+    {
+        int slot = instanceReserveField(instance, name);
+        bool isNewField = instance->fields[slot] == UNDEFINED_VAL;
+        instance->fields[slot] = value;
+        writeBarrier((Obj *)instance, value);
+        return isNewField;
+    }
+
+    int slot = shapeFindSlot(instance->shape, name);
+    if (slot >= 0)
+    {
+        instance->fields[slot] = value;
+        writeBarrier((Obj *)instance, value);
+        return false;
+    }
+
+    if (instance->shape != NULL && instance->shape->fieldCount >= MAX_SHAPE_FIELDS)
+    {
+        instanceUseDictionary(instance);
+        return instanceSetField(vm, instance, name, value);
+    }
+
+    ObjShape *shape = instance->shape != NULL ? instance->shape : getRootShape(vm, instance->klass);
+    instanceAddField(instance, shapeTransition(vm, shape, name), value);
+    return true;
+}
+
+void instanceUseDictionary(ObjInstance *instance)
+{
+    if (instance->dictionary != NULL)
+        return;
+
+    // Fields keep their slots, only the name lookup moves into the table. The
+    // names stay reachable through the shape until the switch below, so a
+    // collection while the table grows can't lose any of them.
+    Table *dictionary = ALLOCATE(Table, 1);
+    initTable(dictionary);
+    for (ObjShape *shape = instance->shape; shape != NULL && shape->parent != NULL; shape = shape->parent)
+    {
+        tableSet(dictionary, shape->name, NUMBER_VAL(shape->fieldCount - 1));
+    }
+    instance->shape = NULL;
+    instance->dictionary = dictionary;
+    rememberObject((Obj *)instance);
+}
+
+void instanceCopyFields(VM *vm, ObjInstance *from, ObjInstance *to)
+{
+    if (from->dictionary != NULL)
+    {
+        for (int i = 0; i <= from->dictionary->capacity; i++)
+        {
+            Entry *entry = &from->dictionary->entries[i];
+            if (entry->key != NIL_VAL && from->fields[(int)AS_NUMBER(entry->value)] != UNDEFINED_VAL)
+            {
+                instanceSetField(vm, to, entry->key, from->fields[(int)AS_NUMBER(entry->value)]);
+            }
+        }
+        return;
+    }
+
+    for (ObjShape *shape = from->shape; shape != NULL && shape->parent != NULL; shape = shape->parent)
+    {
+        instanceSetField(vm, to, shape->name, from->fields[shape->fieldCount - 1]);
+    }
+}
+
+void instanceGetFieldNames(ObjInstance *instance, VM *vm, Value list)
+{
+    if (instance->dictionary != NULL)
+    {
+        for (int i = 0; i <= instance->dictionary->capacity; i++)
+        {
+            Entry *entry = &instance->dictionary->entries[i];
+            if (entry->key != NIL_VAL && instance->fields[(int)AS_NUMBER(entry->value)] != UNDEFINED_VAL)
+            {
+                list_add(vm, list, 1, &entry->key);
+            }
+        }
+        return;
+    }
+    if (instance->shape == NULL)
+        return;
+
+    Value names[MAX_SHAPE_FIELDS];
+    for (ObjShape *shape = instance->shape; shape->parent != NULL; shape = shape->parent)
+    {
+        names[shape->fieldCount - 1] = shape->name;
+    }
+    for (int i = 0; i < instance->shape->fieldCount; i++)
+    {
+        list_add(vm, list, 1, &names[i]);
+    }
+}
+
+void instanceGetFieldValues(ObjInstance *instance, VM *vm, Value list)
+{
+    int count = fieldCount(instance);
+    for (int i = 0; i < count; i++)
+    {
+        if (instance->fields[i] != UNDEFINED_VAL)
+        {
+            list_add(vm, list, 1, &instance->fields[i]);
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef _COMET_SHAPE_H_
+#define _COMET_SHAPE_H_
+
+#include "common.h"
+#include "object_defs.h"
+#include "value.h"
+
+// Instances with more fields than this stop sharing shapes and look their
+// fields up in a Table of their own, so that objects used as dictionaries
+// don't grow arbitrarily long transition chains.
+#define MAX_SHAPE_FIELDS (64)
+
+// The most field slots that will be allocated inline with a new instance.
+#define MAX_INLINE_FIELDS (16)
+
+// Fills a slot that a dictionary instance has reserved for a name but that
+// hasn't been assigned yet, e.g. a module variable referenced before it is
+// defined. Never visible to scripts.
+#define UNDEFINED_VAL ((Value)(QNAN | 1))
+
+void initInstanceFields(ObjInstance *instance, Value *inlineFields, uint16_t inlineFieldCapacity);
+void freeInstanceFields(ObjInstance *instance);
+void markInstanceFields(ObjInstance *instance);
+void markShape(ObjShape *shape);
+
+int shapeFindSlot(ObjShape *shape, Value name);
+int instanceFindSlot(ObjInstance *instance, Value name);
+// Returns the slot for name in a dictionary instance, adding an undefined
+// field if it doesn't exist. Slots never move once handed out.
+int instanceReserveField(ObjInstance *instance, Value name);
+
+bool instanceGetField(ObjInstance *instance, Value name, Value *value);
+bool instanceSetField(VM *vm, ObjInstance *instance, Value name, Value value);
+void instanceAddField(ObjInstance *instance, ObjShape *shape, Value value);
+void instanceUseDictionary(ObjInstance *instance);
+void instanceCopyFields(VM *vm, ObjInstance *from, ObjInstance *to);
+void instanceGetFieldNames(ObjInstance *instance, VM *vm, Value list);
+void instanceGetFieldValues(ObjInstance *instance, VM *vm, Value list);
+
+#endif
@@ -0,0 +1,311 @@
+#ifdef WIN32
+#include <Windows.h>
+#include <malloc.h>
+#else
+#include <pthread.h>
+#endif
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "slab.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#define SLAB_ASAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define SLAB_ASAN 1
+#endif
+#endif
+
+// Pages are aligned to their size, so the page an object lives in can be found
+// from its address alone
+#define SLAB_PAGE_SIZE (64 * 1024)
+#define SLAB_GRANULE (16)
+#define NUM_SIZE_CLASSES (MAX_SLAB_OBJECT_SIZE / SLAB_GRANULE)
+// Empty pages kept back rather than freed, enough for the nursery to fill
+// again without asking for new ones each time it's collected
+#define SPARE_PAGES (32)
+
+#ifdef WIN32
+#define THREAD_LOCAL __declspec(thread)
+#define ATOMIC_ADD(var, amount) InterlockedExchangeAdd((volatile LONG *)&(var), (amount))
+#define ATOMIC_LOAD(var) InterlockedCompareExchange((volatile LONG *)&(var), 0, 0)
+#define ATOMIC_LOAD_PTR(var) InterlockedCompareExchangePointer((PVOID volatile *)&(var), NULL, NULL)
+#define ATOMIC_EXCHANGE_PTR(var, value) InterlockedExchangePointer((PVOID volatile *)&(var), (value))
+#define ATOMIC_CAS_PTR(var, expected, value) \
+    (InterlockedCompareExchangePointer((PVOID volatile *)&(var), (value), (expected)) == (expected))
+static CRITICAL_SECTION slab_lock;
+#define SLAB_LOCK() EnterCriticalSection(&slab_lock)
+#define SLAB_UNLOCK() LeaveCriticalSection(&slab_lock)
+#else
+#define THREAD_LOCAL _Thread_local
+#define ATOMIC_ADD(var, amount) __atomic_add_fetch(&(var), (amount), __ATOMIC_SEQ_CST)
+#define ATOMIC_LOAD(var) __atomic_load_n(&(var), __ATOMIC_SEQ_CST)
+#define ATOMIC_LOAD_PTR(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define ATOMIC_EXCHANGE_PTR(var, value) __atomic_exchange_n(&(var), (value), __ATOMIC_ACQ_REL)
+#define ATOMIC_CAS_PTR(var, expected, value) \
+    __atomic_compare_exchange_n(&(var), &(expected), (value), false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+#define SLAB_LOCK() pthread_mutex_lock(&slab_lock)
+#define SLAB_UNLOCK() pthread_mutex_unlock(&slab_lock)
+#endif
+
+#if SLAB_ASAN
+#include <sanitizer/asan_interface.h>
+// The free list link stays readable, the rest of a free cell is off limits
+#define POISON_CELL(cell, size) ASAN_POISON_MEMORY_REGION((char *)(cell) + sizeof(Cell), (size) - sizeof(Cell))
+#define UNPOISON_CELL(cell, size) ASAN_UNPOISON_MEMORY_REGION((cell), (size))
+#else
+#define POISON_CELL(cell, size)
+#define UNPOISON_CELL(cell, size)
+#endif
+
+typedef struct sCell
+{
+    struct sCell *next;
+} Cell;
+
+// The header at the start of every page. A page is owned by at most one
+// thread at a time, which is the only one to allocate from it. Any thread can
+// free into it.
+typedef struct sSlabPage
+{
+    struct sSlabPage *next;
+    // Cells free for the owner to allocate, only the owner touches these
+    Cell *free;
+    // Cells freed while the page wasn't the freeing thread's own. The owner
+    // takes the whole list over once it runs out of free cells.
+    Cell *volatile returned;
+    // Cells past this point have never been handed out
+    char *bump;
+    char *end;
+    // Cells handed out and not freed by the owner. Frees by other threads are
+    // counted separately, so the owner never needs an atomic operation.
+    int allocated;
+    volatile int returnedCount;
+    int capacity;
+    int cellSize;
+    bool owned;
+} SlabPage;
+
+typedef struct
+{
+    SlabPage *pages;
+    // Where the search for a page with room in it carries on from
+    SlabPage *cursor;
+} SizeClass;
+
+static SizeClass size_classes[NUM_SIZE_CLASSES];
+static THREAD_LOCAL SlabPage *thread_pages[NUM_SIZE_CLASSES];
+
+static int sizeClassOf(size_t size)
+{
+    return (int)((size - 1) / SLAB_GRANULE);
+}
+
+// Only exact for pages nobody owns, which is all it's used for
+static int cellsInUse(SlabPage *page)
+{
+    return page->allocated - ATOMIC_LOAD(page->returnedCount);
+}
+
+static SlabPage *pageOf(void *pointer)
+{
+    return (SlabPage *)((uintptr_t)pointer & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+}
+
+void initSlabs(void)
+{
+#ifdef WIN32
+    InitializeCriticalSection(&slab_lock);
+#endif
+}
+
+static SlabPage *newPage(int sizeClass)
+{
+    SlabPage *page;
+#ifdef WIN32
+    page = (SlabPage *)_aligned_malloc(SLAB_PAGE_SIZE, SLAB_PAGE_SIZE);
+#else
+    if (posix_memalign((void **)&page, SLAB_PAGE_SIZE, SLAB_PAGE_SIZE) != 0)
+        page = NULL;
+#endif
+    if (page == NULL)
+        return NULL;
+
+    size_t headerSize = (sizeof(SlabPage) + SLAB_GRANULE - 1) & ~(size_t)(SLAB_GRANULE - 1);
+    page->cellSize = (sizeClass + 1) * SLAB_GRANULE;
+    page->capacity = (int)((SLAB_PAGE_SIZE - headerSize) / page->cellSize);
+    page->bump = (char *)page + headerSize;
+    page->end = page->bump + (size_t)page->capacity * page->cellSize;
+    page->free = NULL;
+    page->returned = NULL;
+    page->allocated = 0;
+    page->returnedCount = 0;
+    page->owned = false;
+    page->next = size_classes[sizeClass].pages;
+    size_classes[sizeClass].pages = page;
+    return page;
+}
+
+static void freePage(SlabPage *page)
+{
+#ifdef WIN32
+    _aligned_free(page);
+#else
+    free(page);
+#endif
+}
+
+// Swaps the calling thread's page for one with room in it, preferring a page
+// another thread has given up over a new one.
+static SlabPage *acquirePage(int sizeClass)
+{
+    SizeClass *sizeClassPages = &size_classes[sizeClass];
+    SlabPage *previous = thread_pages[sizeClass];
+    SLAB_LOCK();
+    if (previous != NULL)
+        previous->owned = false;
+
+    SlabPage *page = NULL;
+    for (int pass = 0; pass < 2 && page == NULL; pass++)
+    {
+        SlabPage *candidate = pass == 0 ? sizeClassPages->cursor : sizeClassPages->pages;
+        SlabPage *stop = pass == 0 ? NULL : sizeClassPages->cursor;
+        for (; candidate != stop; candidate = candidate->next)
+        {
+            if (!candidate->owned && candidate != previous &&
+                cellsInUse(candidate) < candidate->capacity)
+            {
+                page = candidate;
+                break;
+            }
+        }
+    }
+    if (page == NULL)
+        page = newPage(sizeClass);
+    if (page != NULL)
+    {
+        page->owned = true;
+        sizeClassPages->cursor = page->next;
+    }
+    SLAB_UNLOCK();
+    thread_pages[sizeClass] = page;
+    return page;
+}
+
+static bool hasFreeCell(SlabPage *page)
+{
+    if (page->free != NULL || page->bump < page->end)
+        return true;
+    page->free = (Cell *)ATOMIC_EXCHANGE_PTR(page->returned, NULL);
+
+    // The cells are the owner's again
+    int count = 0;
+    for (Cell *cell = page->free; cell != NULL; cell = cell->next)
+        count++;
+    page->allocated -= count;
+    ATOMIC_ADD(page->returnedCount, -count);
+    return count > 0;
+}
+
+void *slabAllocate(size_t size)
+{
+    if (size > MAX_SLAB_OBJECT_SIZE)
+        return malloc(size);
+
+    int sizeClass = sizeClassOf(size);
+    SlabPage *page = thread_pages[sizeClass];
+    if (page == NULL || !hasFreeCell(page))
+    {
+        page = acquirePage(sizeClass);
+        if (page == NULL || !hasFreeCell(page))
+            return NULL;
+    }
+
+    Cell *cell;
+    if (page->free != NULL)
+    {
+        cell = page->free;
+        page->free = cell->next;
+    }
+    else
+    {
+        cell = (Cell *)page->bump;
+        page->bump += page->cellSize;
+    }
+    page->allocated++;
+    UNPOISON_CELL(cell, page->cellSize);
+    return cell;
+}
+
+void slabFree(void *pointer, size_t size)
+{
+    if (size > MAX_SLAB_OBJECT_SIZE)
+    {
+        free(pointer);
+        return;
+    }
+
+    SlabPage *page = pageOf(pointer);
+    Cell *cell = (Cell *)pointer;
+    // Once pushed the cell can be handed out again by another thread
+    POISON_CELL(cell, page->cellSize);
+    if (page == thread_pages[sizeClassOf(size)])
+    {
+        cell->next = page->free;
+        page->free = cell;
+        page->allocated--;
+    }
+    else
+    {
+        Cell *head;
+        do
+        {
+            head = (Cell *)ATOMIC_LOAD_PTR(page->returned);
+            cell->next = head;
+        } while (!ATOMIC_CAS_PTR(page->returned, head, cell));
+        // Last, the page can be freed as soon as it looks empty
+        ATOMIC_ADD(page->returnedCount, 1);
+    }
+}
+
+void slabReleaseThreadPages(void)
+{
+    SLAB_LOCK();
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++)
+    {
+        if (thread_pages[i] != NULL)
+        {
+            thread_pages[i]->owned = false;
+            thread_pages[i] = NULL;
+        }
+    }
+    SLAB_UNLOCK();
+}
+
+// Nothing can be allocated from or freed into an empty page nobody owns, so
+// it can go while other threads carry on allocating from their own pages.
+void slabReleaseEmptyPages(bool keepSpares)
+{
+    SLAB_LOCK();
+    int spares = keepSpares ? SPARE_PAGES : 0;
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++)
+    {
+        SizeClass *sizeClassPages = &size_classes[i];
+        SlabPage **link = &sizeClassPages->pages;
+        while (*link != NULL)
+        {
+            SlabPage *page = *link;
+            if (page->owned || cellsInUse(page) > 0 || spares-- > 0)
+            {
+                link = &page->next;
+                continue;
+            }
+            *link = page->next;
+            freePage(page);
+        }
+        sizeClassPages->cursor = sizeClassPages->pages;
+    }
+    SLAB_UNLOCK();
+}
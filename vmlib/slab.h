@@ -0,0 +1,21 @@
+#ifndef comet_slab_h
+#define comet_slab_h
+
+#include "common.h"
+
+// Heap objects up to this size are carved out of pages shared by objects of
+// the same size class, anything larger comes straight from malloc.
+#define MAX_SLAB_OBJECT_SIZE (256)
+
+void initSlabs(void);
+void *slabAllocate(size_t size);
+// size has to be the size the object was allocated with
+void slabFree(void *pointer, size_t size);
+// Gives up the pages the calling thread is allocating from, so that other
+// threads can fill them. Called when a thread is done with the heap.
+void slabReleaseThreadPages(void);
+// Returns pages without any objects in them to the system, keeping a few
+// spare ones back unless keepSpares is false.
+void slabReleaseEmptyPages(bool keepSpares);
+
+#endif
@@ -27,11 +27,8 @@ void freeTable(Table *table)
 }
 
 static Entry *findEntry(Entry *entries, int capacity,
-                        Value key)
+                        Value key, uint32_t hash)
 {
-    const char *key_string = string_get_cstr(key);
-    int key_str_len = strlen(key_string);
-    uint32_t hash = (uint32_t) string_hash_cstr(key_string, key_str_len);
     uint32_t index = hash & capacity;
     Entry *tombstone = NULL;
 
@@ -39,7 +36,12 @@ static Entry *findEntry(Entry *entries, int capacity,
     {
         Entry *entry = &entries[index];
 
-        if (entry->key == NIL_VAL)
+        if (entry->key == key)
+        {
+            // Interned strings are unique, so identity is the common case
+            return entry;
+        }
+        else if (entry->key == NIL_VAL)
         {
             if (IS_NIL(entry->value))
             {
@@ -53,9 +55,10 @@ static Entry *findEntry(Entry *entries, int capacity,
                     tombstone = entry;
             }
         }
-        else if (strcmp(string_get_cstr(entry->key), key_string) == 0)
+        else if (entry->hash == hash &&
+                 strcmp(string_get_cstr(entry->key), string_get_cstr(key)) == 0)
         {
-            // We found the key.
+            // A non-interned key with the same contents
             return entry;
         }
 
@@ -68,7 +71,7 @@ bool tableGet(Table *table, Value key, Value *result)
     if (table->count == 0)
         return false;
 
-    Entry *entry = findEntry(table->entries, table->capacity, key);
+    Entry *entry = findEntry(table->entries, table->capacity, key, string_get_hash(key));
     if (entry->key == NIL_VAL)
         return false;
 
@@ -76,15 +79,27 @@ bool tableGet(Table *table, Value key, Value *result)
     return true;
 }
 
-static void adjustCapacity(Table *table, int capacity)
+Entry *tableAllocateEntries(int capacity)
 {
     Entry *entries = ALLOCATE(Entry, capacity + 1);
     for (int i = 0; i <= capacity; i++)
     {
         entries[i].key = NIL_VAL;
         entries[i].value = NIL_VAL;
+        entries[i].hash = 0;
     }
+    return entries;
+}
+
+int tableGrownCapacity(Table *table)
+{
+    if (table->count + 1 > (table->capacity + 1) * TABLE_MAX_LOAD)
+        return GROW_CAPACITY(table->capacity + 1) - 1;
+    return table->capacity;
+}
 
+Entry *tableReplaceEntries(Table *table, Entry *entries, int capacity)
+{
     table->count = 0;
     for (int i = 0; i <= table->capacity; i++)
     {
@@ -92,44 +107,73 @@ static void adjustCapacity(Table *table, int capacity)
         if (entry == NULL || entry->key == NIL_VAL)
             continue;
 
-        Entry *dest = findEntry(entries, capacity, entry->key);
+        Entry *dest = findEntry(entries, capacity, entry->key, entry->hash);
         dest->key = entry->key;
         dest->value = entry->value;
+        dest->hash = entry->hash;
         table->count++;
     }
-    FREE_ARRAY(Entry, table->entries, table->capacity + 1);
-
+    Entry *previous = table->entries;
     table->entries = entries;
     table->capacity = capacity;
+    return previous;
 }
 
-bool tableSet(Table *table, Value key, Value value)
+static void adjustCapacity(Table *table, int capacity)
 {
-    if (table->count + 1 > (table->capacity + 1) * TABLE_MAX_LOAD)
-    {
-        // Figure out the new table size.
-        int capacity = GROW_CAPACITY(table->capacity + 1) - 1;
-        adjustCapacity(table, capacity);
-    }
-
-    Entry *entry = findEntry(table->entries, table->capacity, key);
+    int previousCapacity = table->capacity;
+    Entry *previous = tableReplaceEntries(table, tableAllocateEntries(capacity), capacity);
+    FREE_ARRAY(Entry, previous, previousCapacity + 1);
+}
 
+static bool setEntry(Entry *entry, Table *table, Value key, uint32_t hash, Value value)
+{
     bool isNewKey = entry->key == NIL_VAL;
     if (isNewKey && IS_NIL(entry->value))
         table->count++;
 
-    entry->key = key;
+    // An existing key can be an equal string rather than the same one, the
+    // one already there stays
+    if (isNewKey)
+    {
+        entry->key = key;
+        entry->hash = hash;
+    }
     entry->value = value;
     return isNewKey;
 }
 
+bool tableSet(Table *table, Value key, Value value)
+{
+    int capacity = tableGrownCapacity(table);
+    if (capacity != table->capacity)
+        adjustCapacity(table, capacity);
+
+    uint32_t hash = string_get_hash(key);
+    Entry *entry = findEntry(table->entries, table->capacity, key, hash);
+    // A string first used as a key is interned, so that lookups with the
+    // identifiers in the code find it by identity
+    if (entry->key == NIL_VAL)
+        key = internString(key);
+    return setEntry(entry, table, key, hash, value);
+}
+
+bool tableSetWithoutGrowing(Table *table, Value key, uint32_t hash, Value value)
+{
+    if (tableGrownCapacity(table) != table->capacity)
+        return false;
+
+    setEntry(findEntry(table->entries, table->capacity, key, hash), table, key, hash, value);
+    return true;
+}
+
 bool tableDelete(Table *table, Value key)
 {
     if (table->count == 0)
         return false;
 
     // Find the entry.
-    Entry *entry = findEntry(table->entries, table->capacity, key);
+    Entry *entry = findEntry(table->entries, table->capacity, key, string_get_hash(key));
     if (entry != NULL && entry->key == NIL_VAL)
         return false;
 
@@ -171,10 +215,7 @@ Value tableFindString(Table *table, const char *chars, uint32_t hash)
         }
         else
         {
-            const char *key_string = string_get_cstr(entry->key);
-            int key_str_len = strlen(key_string);
-            uint32_t entry_hash = (uint32_t) string_hash_cstr(key_string, key_str_len);
-            if (entry_hash == hash &&
+            if (entry->hash == hash &&
                 string_compare_to_cstr(entry->key, chars) == 0)
             {
                 // We found it.
@@ -230,7 +271,7 @@ void tableRemoveWhite(Table *table)
     {
 #if !REF_COUNT_MEM_MANAGEMENT
         Entry *entry = &table->entries[i];
-        if (entry->key != NIL_VAL && !AS_OBJ(entry->key)->isMarked)
+        if (entry->key != NIL_VAL && isObjectUnreachable(AS_OBJ(entry->key)))
         {
             tableDelete(table, entry->key);
         }
@@ -240,6 +281,10 @@ void tableRemoveWhite(Table *table)
 
 void markTable(Table *table)
 {
+    // Objects are zeroed when allocated, so a collection can see a table
+    // whose owner hasn't initialised it yet
+    if (table->entries == NULL)
+        return;
     for (int i = 0; i <= table->capacity; i++)
     {
         Entry *entry = &table->entries[i];
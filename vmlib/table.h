@@ -8,6 +8,7 @@ typedef struct
 {
     Value key;
     Value value;
+    uint32_t hash;
 } Entry;
 
 typedef struct
@@ -21,6 +22,15 @@ void initTable(Table *table);
 void freeTable(Table *table);
 bool tableGet(Table *table, Value key, Value *result);
 bool tableSet(Table *table, Value key, Value value);
+// For tables shared between threads, which can't allocate while holding their
+// lock since allocating can wait for a collection. tableSetWithoutGrowing()
+// returns false if the table needs more room first, the caller then allocates
+// tableGrownCapacity() entries and swaps them in with tableReplaceEntries(),
+// freeing the previous ones it returns.
+bool tableSetWithoutGrowing(Table *table, Value key, uint32_t hash, Value value);
+int tableGrownCapacity(Table *table);
+Entry *tableAllocateEntries(int capacity);
+Entry *tableReplaceEntries(Table *table, Entry *entries, int capacity);
 bool tableDelete(Table *table, Value key);
 void tableAddAll(Table *from, Table *to);
 Value tableFindString(Table *table, const char *chars, uint32_t hash);
@@ -1,3 +1,6 @@
+#ifdef WIN32
+#include <Windows.h>
+#endif
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
@@ -17,6 +20,7 @@ static bool call(VM *vm, ObjClosure *closure, int argCount);
 static InterpretResult run(VM *vm);
 static bool callNativeMethod(VM *vm, Value receiver, ObjNativeMethod *method, int argCount);
 static Value findMethod(ObjClass *klass, Value name);
+static void throwPendingException(VM *vm);
 
 #if DEBUG_TRACE_EXECUTION
 static CallFrame *updateFrame(VM *vm);
@@ -46,6 +50,8 @@ static bool create_instance(VM *vm, ObjClass *klass, int argCount)
         {
             AS_NATIVE_METHOD(initializer)->function(vm, instance, argCount, vm->stackTop - argCount);
             popMany(vm, argCount);
+            if (vm->pendingException != NIL_VAL)
+                throwPendingException(vm);
             return true;
         }
         else
@@ -65,6 +71,8 @@ static void resetStack(VM *vm)
 {
     vm->stackTop = vm->stack;
     vm->frameCount = 0;
+    vm->baseFrameCount = 0;
+    vm->pendingException = NIL_VAL;
     vm->openUpvalues = NULL;
     for (int i = 0; i < FRAMES_MAX; i++)
     {
@@ -85,7 +93,7 @@ static CallFrame *currentFrame(VM *vm)
 static bool propagateException(VM *vm)
 {
     Value exception = peek(vm, 0);
-    while (vm->frameCount > 0)
+    while (vm->frameCount > vm->baseFrameCount)
     {
         CallFrame *frame = currentFrame(vm);
         for (int numHandlers = frame->handlerCount; numHandlers > 0; numHandlers--)
@@ -105,6 +113,13 @@ static bool propagateException(VM *vm)
         }
         vm->frameCount--;
     }
+    if (vm->baseFrameCount > 0)
+    {
+        // Not caught inside a callback, it is thrown again from where the
+        // native that ran the callback was called once that returns.
+        vm->pendingException = exception;
+        return false;
+    }
 #if DEBUG_TRACE_EXECUTION
     print_stack_trace(vm);
     print_stack(vm);
@@ -132,6 +147,16 @@ static bool propagateException(VM *vm)
     return false;
 }
 
+// Called once a native has returned, to carry on unwinding an exception that
+// one of the callbacks it ran didn't catch.
+static void throwPendingException(VM *vm)
+{
+    Value exception = vm->pendingException;
+    vm->pendingException = NIL_VAL;
+    push(vm, exception);
+    propagateException(vm);
+}
+
 Value getStackTrace(VM *vm)
 {
 #define MAX_LINE_LENGTH 512
@@ -168,6 +193,11 @@ void print_stack_trace(VM *vm)
 
 void throw_exception_native(VM *vm, const char *exception_type_name, const char *message_format, ...)
 {
+    // The exception from a callback takes precedence over anything the native
+    // then finds wrong with the NIL it got back.
+    if (vm->pendingException != NIL_VAL)
+        return;
+
     va_list args;
     va_start(args, message_format);
         int n = 0;
@@ -189,7 +219,7 @@ void throw_exception_native(VM *vm, const char *exception_type_name, const char
     }
 
     push(vm, string_create(vm, message, strlen(message)));
-    push(vm, copyString(vm, exception_type_name, strlen(exception_type_name)));
+    push(vm, copyInternedString(vm, exception_type_name, strlen(exception_type_name)));
     Value exception_type = NIL_VAL;
     if (findGlobal(peek(vm, 0), &exception_type))
     {
@@ -221,6 +251,13 @@ void runtimeError(VM *vm, const char *format, ...)
     va_end(args);
     fputs("\n", stderr);
     fprintf(stderr, "%s", string_get_cstr(getStackTrace(vm)));
+    if (vm->baseFrameCount > 0)
+    {
+        // Only abandon the callback, call_function turns the failure into an
+        // exception for its caller.
+        vm->frameCount = vm->baseFrameCount;
+        return;
+    }
     resetStack(vm);
 }
 
@@ -228,6 +265,9 @@ void runtimeError(VM *vm, const char *format, ...)
 void initVM(VM *vm)
 {
     resetStack(vm);
+#if COMET_COUNT_INSTRUCTIONS
+    vm->instructionCount = 0;
+#endif
     register_thread(vm);
 }
 
@@ -294,6 +334,7 @@ void swapTop(VM *vm)
 
 static bool call(VM *vm, ObjClosure *closure, int argCount)
 {
+    safepoint(vm);
     if (argCount + closure->function->optionalArgCount < closure->function->arity)
     {
         runtimeError(vm, "'%s' Expects a minimum of %d arguments to but got %d.",
@@ -313,7 +354,7 @@ static bool call(VM *vm, ObjClosure *closure, int argCount)
             *(restArgs - i) = *(restArgs - (i + 1));
         }
         Value klass;
-        findGlobal(copyString(vm, "List", 4), &klass);
+        findGlobal(copyInternedString(vm, "List", 4), &klass);
         push(vm, NIL_VAL); // also a placeholder
         create_instance(vm, AS_CLASS(klass), 0);
         push_to(vm, peek(vm, 0), restOfArgs + 2);
@@ -333,14 +374,14 @@ static bool call(VM *vm, ObjClosure *closure, int argCount)
             if (constant == NEW_LIST_PARAM_VALUE)
             {
                 Value klass;
-                findGlobal(copyString(vm, "List", 4), &klass);
+                findGlobal(copyInternedString(vm, "List", 4), &klass);
                 push(vm, NIL_VAL);
                 create_instance(vm, AS_CLASS(klass), 0);
             }
             else if (constant == NEW_HASH_PARAM_VALUE)
             {
                 Value klass;
-                findGlobal(copyString(vm, "Hash", 4), &klass);
+                findGlobal(copyInternedString(vm, "Hash", 4), &klass);
                 push(vm, NIL_VAL);
                 create_instance(vm, AS_CLASS(klass), 0);
             }
@@ -361,6 +402,7 @@ static bool call(VM *vm, ObjClosure *closure, int argCount)
     CallFrame *frame = &vm->frames[vm->frameCount++];
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
+    frame->handlerCount = 0;
 
     frame->slots = vm->stackTop - argCount - 1;
     return true;
@@ -396,6 +438,8 @@ static bool callValue(VM *vm, Value callee, int argCount)
             Value result = native(vm, argCount, vm->stackTop - argCount);
             push_to(vm, result, argCount + 1);
             popMany(vm, argCount);
+            if (vm->pendingException != NIL_VAL)
+                throwPendingException(vm);
             return true;
         }
 
@@ -422,6 +466,8 @@ static bool callNativeMethod(VM *vm, Value receiver, ObjNativeMethod *method, in
     Value result = method->function(vm, receiver, argCount, vm->stackTop - argCount);
     push_to(vm, result, argCount + 1);
     popMany(vm, argCount);
+    if (vm->pendingException != NIL_VAL)
+        throwPendingException(vm);
     return true;
 }
 
@@ -435,6 +481,97 @@ static Value findMethod(ObjClass *klass, Value name)
     return NIL_VAL;
 }
 
+#ifdef WIN32
+#define CACHE_LOAD_ACQUIRE(var) InterlockedCompareExchange((volatile LONG *)&(var), 0, 0)
+#define CACHE_TRY_LOCK(var, expected) \
+    (InterlockedCompareExchange((volatile LONG *)&(var), (LONG)(expected) + 1, (LONG)(expected)) == (LONG)(expected))
+#define CACHE_STORE_RELEASE(var, value) InterlockedExchange((volatile LONG *)&(var), (LONG)(value))
+#define CACHE_FENCE_ACQUIRE() MemoryBarrier()
+#define CACHE_FENCE_RELEASE() MemoryBarrier()
+#define CACHE_LOAD_FIELD(var) (var)
+#define CACHE_STORE_FIELD(var, value) ((var) = (value))
+#else
+#define CACHE_LOAD_ACQUIRE(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define CACHE_TRY_LOCK(var, expected) \
+    __atomic_compare_exchange_n(&(var), &(expected), (expected) + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)
+#define CACHE_STORE_RELEASE(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELEASE)
+#define CACHE_FENCE_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define CACHE_FENCE_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define CACHE_LOAD_FIELD(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define CACHE_STORE_FIELD(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELAXED)
+#endif
+
+// Copies a matching entry into *result. Another thread can be rewriting an
+// entry while it's read, so the copy only counts if the entry's sequence was
+// even and hadn't changed by the end, otherwise it's treated as a miss.
+static bool findInlineCacheEntry(InlineCache *cache, ObjClass *klass, ObjShape *shape, InlineCacheEntry *result)
+{
+    for (int i = 0; i < INLINE_CACHE_ENTRIES; i++)
+    {
+        InlineCacheEntry *entry = &cache->entries[i];
+        uint32_t sequence = CACHE_LOAD_ACQUIRE(entry->sequence);
+        if (sequence & 1)
+            continue;
+        result->klass = CACHE_LOAD_FIELD(entry->klass);
+        result->shape = CACHE_LOAD_FIELD(entry->shape);
+        result->version = CACHE_LOAD_FIELD(entry->version);
+        result->slot = CACHE_LOAD_FIELD(entry->slot);
+        result->value = CACHE_LOAD_FIELD(entry->value);
+        CACHE_FENCE_ACQUIRE();
+        if (CACHE_LOAD_FIELD(entry->sequence) != sequence)
+            continue;
+        if (result->klass == klass && result->shape == shape && result->version == CACHE_LOAD_ACQUIRE(klass->cacheVersion))
+            return true;
+    }
+    return false;
+}
+
+// Gives up if another thread is writing the same entry, the site just stays
+// uncached until the next miss. version is the class's cacheVersion from
+// before slot and value were looked up, so that if the class changed while
+// they were, the entry never matches.
+static void addInlineCacheEntry(InlineCache *cache, ObjClass *klass, ObjShape *shape, uint32_t version, int slot, Value value)
+{
+    uint8_t next = CACHE_LOAD_FIELD(cache->next) % INLINE_CACHE_ENTRIES;
+    InlineCacheEntry *entry = &cache->entries[next];
+    uint32_t sequence = CACHE_LOAD_FIELD(entry->sequence);
+    if ((sequence & 1) || !CACHE_TRY_LOCK(entry->sequence, sequence))
+        return;
+    CACHE_FENCE_RELEASE();
+    CACHE_STORE_FIELD(entry->klass, klass);
+    CACHE_STORE_FIELD(entry->shape, shape);
+    CACHE_STORE_FIELD(entry->version, version);
+    CACHE_STORE_FIELD(entry->slot, slot);
+    CACHE_STORE_FIELD(entry->value, value);
+    CACHE_STORE_RELEASE(entry->sequence, sequence + 2);
+    CACHE_STORE_FIELD(cache->next, (uint8_t)((next + 1) % INLINE_CACHE_ENTRIES));
+}
+
+// Resolves name for a receiver of the given class and shape. If it names a
+// field then *slot is set to its index, otherwise *slot is -1 and the method
+// is returned (NIL_VAL if there isn't one).
+static Value findCachedProperty(InlineCache *cache, ObjClass *klass, ObjShape *shape, Value name, int *slot)
+{
+    if (cache != NULL)
+    {
+        InlineCacheEntry entry;
+        if (findInlineCacheEntry(cache, klass, shape, &entry))
+        {
+            *slot = entry.slot;
+            return entry.value;
+        }
+    }
+
+    uint32_t version = CACHE_LOAD_ACQUIRE(klass->cacheVersion);
+    *slot = shapeFindSlot(shape, name);
+    Value method = *slot < 0 ? findMethod(klass, name) : NIL_VAL;
+    if (cache != NULL && (*slot >= 0 || method != NIL_VAL))
+    {
+        addInlineCacheEntry(cache, klass, shape, version, *slot, method);
+    }
+    return method;
+}
+
 static Value findStaticMethod(ObjClass *klass, Value name)
 {
     Value result;
@@ -536,7 +673,7 @@ static bool callOperator(VM *vm, Value receiver, int argCount, OPERATOR operator
     return false;
 }
 
-static bool invoke(VM *vm, Value name, int argCount)
+static bool invoke(VM *vm, Value name, int argCount, InlineCache *cache)
 {
     Value receiver = peek(vm, argCount);
 
@@ -556,20 +693,25 @@ static bool invoke(VM *vm, Value name, int argCount)
     }
 
     ObjClass *klass = NULL;
+    ObjShape *shape = NULL;
     if (IS_INSTANCE(receiver) || IS_NATIVE_INSTANCE(receiver))
     {
         ObjInstance* instance = AS_INSTANCE(receiver);
 
         // First look for a field which may shadow a method.
         Value value;
-        if (tableGet(&instance->fields, name, &value))
+        if (instance->dictionary != NULL)
         {
-            // Load the field onto the stack in place of the receiver.
-            push_to(vm, value, argCount + 1);
-            // Try to invoke it like a function.
-            return callValue(vm, value, argCount);
+            if (instanceGetField(instance, name, &value))
+            {
+                push_to(vm, value, argCount + 1);
+                return callValue(vm, value, argCount);
+            }
+            // Dictionary instances don't share shapes, so can't be cached
+            cache = NULL;
         }
         klass = instance->klass;
+        shape = instance->shape;
     }
     else if (IS_NUMBER(receiver))
     {
@@ -594,7 +736,16 @@ static bool invoke(VM *vm, Value name, int argCount)
 
     if (IS_INSTANCE(receiver) || IS_NATIVE_INSTANCE(receiver) || IS_NUMBER(receiver) || IS_CLOSURE(receiver))
     {
-        Value method = findMethod(klass, name);
+        int slot;
+        Value method = findCachedProperty(cache, klass, shape, name, &slot);
+        if (slot >= 0)
+        {
+            // Load the field onto the stack in place of the receiver.
+            Value value = AS_INSTANCE(receiver)->fields[slot];
+            push_to(vm, value, argCount + 1);
+            // Try to invoke it like a function.
+            return callValue(vm, value, argCount);
+        }
         if (method == NIL_VAL)
         {
             runtimeError(vm, "'%s' can't be invoked from '%s'.", string_get_cstr(name), klass->name);
@@ -620,10 +771,9 @@ static bool invoke(VM *vm, Value name, int argCount)
     return invokeFromClass(vm, AS_CLASS(receiver), name, argCount);
 }
 
-static bool bindMethod(VM *vm, ObjClass *klass, Value name)
+static bool bindFoundMethod(VM *vm, Value method, Value name)
 {
-    Value method;
-    if (!tableGet(&klass->methods, name, &method))
+    if (method == NIL_VAL)
     {
         runtimeError(vm, "Undefined method or field '%s'.", string_get_cstr(name));
         return false;
@@ -635,6 +785,11 @@ static bool bindMethod(VM *vm, ObjClass *klass, Value name)
     return true;
 }
 
+static bool bindMethod(VM *vm, ObjClass *klass, Value name)
+{
+    return bindFoundMethod(vm, findMethod(klass, name), name);
+}
+
 static ObjUpvalue *captureUpvalue(VM *vm, Value *local)
 {
     ObjUpvalue *prevUpvalue = NULL;
@@ -670,6 +825,7 @@ static void closeUpvalues(VM *vm, Value *last)
         ObjUpvalue *upvalue = vm->openUpvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
+        writeBarrier((Obj *)upvalue, upvalue->closed);
 #if REF_COUNT_MEM_MANAGEMENT
         upvalue->obj.refCount++;
 #endif
@@ -689,6 +845,8 @@ void defineMethod(VM *vm, Value name, bool isStatic)
     {
         tableSet(&klass->methods, name, method);
     }
+    rememberObject((Obj *)klass);
+    invalidateInlineCaches(klass);
     pop(vm);
 }
 
@@ -697,6 +855,7 @@ void defineOperator(VM *vm, OPERATOR operator)
     Value method = peek(vm, 0);
     ObjClass *klass = AS_CLASS(peek(vm, 1));
     klass->operators[operator] = method;
+    rememberObject((Obj *)klass);
     pop(vm);
 }
 
@@ -737,7 +896,7 @@ void print_stack(VM *vm)
 static InterpretResult run(VM *vm)
 {
     // No work to do
-    if (vm->frameCount == 0)
+    if (vm->frameCount == vm->baseFrameCount)
         return INTERPRET_OK;
 
     CallFrame *frame = updateFrame(vm);
@@ -747,6 +906,12 @@ static InterpretResult run(VM *vm)
     (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
 #define READ_CONSTANT() \
     (frame->closure->function->chunk.constants.values[READ_BYTE()])
+#define READ_MODULE_VAR(slot) \
+    (AS_INSTANCE(frame->closure->function->module)->fields[(slot)])
+#define MODULE_WRITE_BARRIER(value) \
+    writeBarrier(AS_OBJ(frame->closure->function->module), (value))
+#define READ_INLINE_CACHE() \
+    (&frame->closure->function->chunk.inlineCaches[READ_SHORT()])
 #define BINARY_OP(operator)                              \
     do                                                   \
     {                                                    \
@@ -757,68 +922,204 @@ static InterpretResult run(VM *vm)
         frame = &vm->frames[vm->frameCount - 1];         \
     } while (false)
 
-    for (;;)
-    {
+// Both operands being numbers is by far the most common case, so that is
+// handled here without going through the Number class's operator.
+#define NUMBER_BINARY_OP(valueType, op, operator)                            \
+    do                                                                       \
+    {                                                                        \
+        Value b = peek(vm, 0);                                               \
+        Value a = peek(vm, 1);                                               \
+        if (IS_NUMBER(a) && IS_NUMBER(b))                                    \
+        {                                                                    \
+            pop(vm);                                                         \
+            push_to(vm, valueType(AS_NUMBER(a) op AS_NUMBER(b)), 1);         \
+        }                                                                    \
+        else                                                                 \
+        {                                                                    \
+            BINARY_OP(operator);                                             \
+        }                                                                    \
+    } while (false)
+#define BOOL_RESULT(condition) ((condition) ? TRUE_VAL : FALSE_VAL)
+
+// Work done at the start of every instruction. The frame count check catches
+// an exception unwinding the whole stack during the previous instruction.
 #if DEBUG_TRACE_EXECUTION
-        if (_print_stack)
-        {
-            print_stack(vm);
-        }
+#define TRACE_INSTRUCTION() \
+    if (_print_stack)       \
+        print_stack(vm);
+#else
+#define TRACE_INSTRUCTION()
 #endif
-        uint8_t instruction = READ_BYTE();
-        ObjFunction *function = frame->closure->function;
-        size_t instruction_pointer = frame->ip - function->chunk.code - 1;
-        recordInstructionExecuted(&function->chunk, instruction_pointer);
-        switch (instruction)
-        {
-        case OP_CONSTANT:
+#if COMET_COUNT_INSTRUCTIONS
+#define COUNT_INSTRUCTION() vm->instructionCount++;
+#else
+#define COUNT_INSTRUCTION()
+#endif
+#define FETCH_INSTRUCTION()                 \
+    do                                      \
+    {                                       \
+        if (vm->frameCount == vm->baseFrameCount) \
+            return INTERPRET_RUNTIME_ERROR; \
+        TRACE_INSTRUCTION()                 \
+        instruction = READ_BYTE();          \
+        COUNT_INSTRUCTION()                 \
+        RECORD_COVERAGE();                  \
+    } while (false)
+#define RECORD_INSTRUCTION_EXECUTED()                                  \
+    do                                                                 \
+    {                                                                  \
+        Chunk *chunk = &frame->closure->function->chunk;               \
+        recordInstructionExecuted(chunk, frame->ip - chunk->code - 1); \
+    } while (false)
+
+#if COMET_COMPUTED_GOTO
+    // Each instruction jumps straight to the next one's handler, giving the
+    // branch predictor a separate indirect branch per opcode.
+    static void *dispatchTable[] = {
+        [OP_CONSTANT] = &&code_OP_CONSTANT,
+        [OP_NIL] = &&code_OP_NIL,
+        [OP_TRUE] = &&code_OP_TRUE,
+        [OP_FALSE] = &&code_OP_FALSE,
+        [OP_POP] = &&code_OP_POP,
+        [OP_GET_LOCAL] = &&code_OP_GET_LOCAL,
+        [OP_SET_LOCAL] = &&code_OP_SET_LOCAL,
+        [OP_GET_MODULE_VAR] = &&code_OP_GET_MODULE_VAR,
+        [OP_DEFINE_MODULE_VAR] = &&code_OP_DEFINE_MODULE_VAR,
+        [OP_SET_MODULE_VAR] = &&code_OP_SET_MODULE_VAR,
+        [OP_GET_UPVALUE] = &&code_OP_GET_UPVALUE,
+        [OP_SET_UPVALUE] = &&code_OP_SET_UPVALUE,
+        [OP_GET_PROPERTY] = &&code_OP_GET_PROPERTY,
+        [OP_SET_PROPERTY] = &&code_OP_SET_PROPERTY,
+        [OP_GET_SUPER] = &&code_OP_GET_SUPER,
+        [OP_EQUAL] = &&code_OP_EQUAL,
+        [OP_GREATER] = &&code_OP_GREATER,
+        [OP_GREATER_EQUAL] = &&code_OP_GREATER_EQUAL,
+        [OP_LESS] = &&code_OP_LESS,
+        [OP_LESS_EQUAL] = &&code_OP_LESS_EQUAL,
+        [OP_LESS_JUMP] = &&code_OP_LESS_JUMP,
+        [OP_ADD] = &&code_OP_ADD,
+        [OP_ADD_CONST] = &&code_OP_ADD_CONST,
+        [OP_SUBTRACT] = &&code_OP_SUBTRACT,
+        [OP_MULTIPLY] = &&code_OP_MULTIPLY,
+        [OP_DIVIDE] = &&code_OP_DIVIDE,
+        [OP_MODULO] = &&code_OP_MODULO,
+        [OP_NOT] = &&code_OP_NOT,
+        [OP_NEGATE] = &&code_OP_NEGATE,
+        [OP_JUMP] = &&code_OP_JUMP,
+        [OP_JUMP_IF_FALSE] = &&code_OP_JUMP_IF_FALSE,
+        [OP_LOOP] = &&code_OP_LOOP,
+        [OP_CALL] = &&code_OP_CALL,
+        [OP_INVOKE] = &&code_OP_INVOKE,
+        [OP_SUPER] = &&code_OP_SUPER,
+        [OP_CLOSURE] = &&code_OP_CLOSURE,
+        [OP_CLOSE_UPVALUE] = &&code_OP_CLOSE_UPVALUE,
+        [OP_RETURN] = &&code_OP_RETURN,
+        [OP_CLASS] = &&code_OP_CLASS,
+        [OP_INHERIT] = &&code_OP_INHERIT,
+        [OP_METHOD] = &&code_OP_METHOD,
+        [OP_STATIC_METHOD] = &&code_OP_STATIC_METHOD,
+        [OP_INDEX] = &&code_OP_INDEX,
+        [OP_INDEX_ASSIGN] = &&code_OP_INDEX_ASSIGN,
+        [OP_DEFINE_OPERATOR] = &&code_OP_DEFINE_OPERATOR,
+        [OP_THROW] = &&code_OP_THROW,
+        [OP_RETHROW] = &&code_OP_RETHROW,
+        [OP_DUP_TOP] = &&code_OP_DUP_TOP,
+        [OP_DUP_TWO] = &&code_OP_DUP_TWO,
+        [OP_IS] = &&code_OP_IS,
+        [OP_PUSH_EXCEPTION_HANDLER] = &&code_OP_PUSH_EXCEPTION_HANDLER,
+        [OP_POP_EXCEPTION_HANDLER] = &&code_OP_POP_EXCEPTION_HANDLER,
+        [OP_PROPAGATE_EXCEPTION] = &&code_OP_PROPAGATE_EXCEPTION,
+        [OP_IMPORT] = &&code_OP_IMPORT,
+        [OP_IMPORT_PARAMS] = &&code_OP_IMPORT_PARAMS,
+        [OP_BITWISE_OR] = &&code_OP_BITWISE_OR,
+        [OP_BITWISE_AND] = &&code_OP_BITWISE_AND,
+        [OP_BITWISE_XOR] = &&code_OP_BITWISE_XOR,
+        [OP_BITSHIFT_LEFT] = &&code_OP_BITSHIFT_LEFT,
+        [OP_BITSHIFT_RIGHT] = &&code_OP_BITSHIFT_RIGHT,
+        [OP_SPLAT] = &&code_OP_SPLAT,
+    };
+    // With coverage on every opcode is routed through record_coverage first,
+    // so the normal table carries no counting at all.
+    static void *coverageDispatchTable[] = {
+        [0 ... OP_SPLAT] = &&record_coverage,
+    };
+    void **dispatch = isCoverageEnabled() ? coverageDispatchTable : dispatchTable;
+#define RECORD_COVERAGE()
+#define INTERPRET_LOOP DISPATCH();
+#define CASE_CODE(name) code_##name
+#define DISPATCH()                   \
+    do                               \
+    {                                \
+        FETCH_INSTRUCTION();         \
+        goto *dispatch[instruction]; \
+    } while (false)
+#else
+    const bool coverage = isCoverageEnabled();
+#define RECORD_COVERAGE() \
+    if (coverage)         \
+        RECORD_INSTRUCTION_EXECUTED()
+#define INTERPRET_LOOP     \
+    loop:                  \
+    FETCH_INSTRUCTION();   \
+    switch (instruction)
+#define CASE_CODE(name) case name
+#define DISPATCH() goto loop
+#endif
+
+    uint8_t instruction;
+    INTERPRET_LOOP
+    {
+        CASE_CODE(OP_CONSTANT):
         {
             Value constant = READ_CONSTANT();
             push(vm, constant);
-            break;
+            DISPATCH();
         }
-        case OP_NIL:
+        CASE_CODE(OP_NIL):
             push(vm, NIL_VAL);
-            break;
-        case OP_TRUE:
+            DISPATCH();
+        CASE_CODE(OP_TRUE):
             push(vm, TRUE_VAL);
-            break;
-        case OP_FALSE:
+            DISPATCH();
+        CASE_CODE(OP_FALSE):
             push(vm, FALSE_VAL);
-            break;
-        case OP_POP:
+            DISPATCH();
+        CASE_CODE(OP_POP):
             pop(vm);
-            break;
-        case OP_GET_GLOBAL:
+            DISPATCH();
+        CASE_CODE(OP_GET_MODULE_VAR):
         {
             Value name = READ_CONSTANT();
-            Value value;
-            if (!findModuleVariable(frame->closure->function->module, name, &value) &&
-                !findGlobal(name, &value))
+            uint16_t slot = READ_SHORT();
+            Value value = READ_MODULE_VAR(slot);
+            // Names the module doesn't define are late bound to the builtins
+            if (value == UNDEFINED_VAL && !findGlobal(name, &value))
             {
                 runtimeError(vm, "Undefined variable '%s'.", string_get_cstr(name));
                 return INTERPRET_RUNTIME_ERROR;
             }
             push(vm, value);
-            break;
+            DISPATCH();
         }
-        case OP_DEFINE_GLOBAL:
+        CASE_CODE(OP_DEFINE_MODULE_VAR):
         {
-            Value name = READ_CONSTANT();
-            addModuleVariable(frame->closure->function->module, name, peek(vm, 0));
+            frame->ip++; // skip the name, it's only needed when disassembling
+            uint16_t slot = READ_SHORT();
+            READ_MODULE_VAR(slot) = peek(vm, 0);
+            MODULE_WRITE_BARRIER(peek(vm, 0));
 #if REF_COUNT_MEM_MANAGEMENT
             incrementRefCount(peek(vm, 0));
 #endif
             pop(vm);
-            break;
+            DISPATCH();
         }
-        case OP_GET_LOCAL:
+        CASE_CODE(OP_GET_LOCAL):
         {
             uint8_t slot = READ_BYTE();
             push(vm, frame->slots[slot]);
-            break;
+            DISPATCH();
         }
-        case OP_SET_LOCAL:
+        CASE_CODE(OP_SET_LOCAL):
         {
             uint8_t slot = READ_BYTE();
 #if REF_COUNT_MEM_MANAGEMENT
@@ -828,18 +1129,20 @@ static InterpretResult run(VM *vm)
 #if REF_COUNT_MEM_MANAGEMENT
             incrementRefCount(peek(vm, 0));
 #endif
-            break;
+            DISPATCH();
         }
-        case OP_SET_GLOBAL:
+        CASE_CODE(OP_SET_MODULE_VAR):
         {
             Value name = READ_CONSTANT();
-            Value value;
+            uint16_t slot = READ_SHORT();
+            Value value = READ_MODULE_VAR(slot);
 #if REF_COUNT_MEM_MANAGEMENT
             incrementRefCount(peek(vm, 0));
 #endif
-            if (findModuleVariable(frame->closure->function->module, name, &value))
+            if (value != UNDEFINED_VAL)
             {
-                addModuleVariable(frame->closure->function->module, name, peek(vm, 0));
+                READ_MODULE_VAR(slot) = peek(vm, 0);
+                MODULE_WRITE_BARRIER(peek(vm, 0));
 #if REF_COUNT_MEM_MANAGEMENT
                 decrementRefCount(value);
 #endif
@@ -856,24 +1159,25 @@ static InterpretResult run(VM *vm)
                 runtimeError(vm, "Undefined variable '%s'.", string_get_cstr(name));
                 return INTERPRET_RUNTIME_ERROR;
             }
-            break;
+            DISPATCH();
         }
-        case OP_GET_UPVALUE:
+        CASE_CODE(OP_GET_UPVALUE):
         {
             uint8_t slot = READ_BYTE();
             push(vm, *frame->closure->upvalues[slot]->location);
-            break;
+            DISPATCH();
         }
-        case OP_SET_UPVALUE:
+        CASE_CODE(OP_SET_UPVALUE):
         {
             uint8_t slot = READ_BYTE();
 #if REF_COUNT_MEM_MANAGEMENT
             incrementRefCount(peek(vm, 0));
 #endif
             *frame->closure->upvalues[slot]->location = peek(vm, 0);
-            break;
+            writeBarrier((Obj *)frame->closure->upvalues[slot], peek(vm, 0));
+            DISPATCH();
         }
-        case OP_GET_PROPERTY:
+        CASE_CODE(OP_GET_PROPERTY):
         {
             if (!IS_INSTANCE(peek(vm, 0)) && !IS_NATIVE_INSTANCE(peek(vm, 0)))
             {
@@ -887,20 +1191,35 @@ static InterpretResult run(VM *vm)
             }
             ObjInstance *instance = AS_INSTANCE(peek(vm, 0));
             Value name = READ_CONSTANT();
+            InlineCache *cache = READ_INLINE_CACHE();
 
             Value value;
-            if (tableGet(&instance->fields, name, &value))
+            if (instance->dictionary != NULL)
             {
-                push_to(vm, value, 1);
-                break;
+                if (instanceGetField(instance, name, &value))
+                {
+                    push_to(vm, value, 1);
+                }
+                else if (!bindMethod(vm, instance->klass, name))
+                {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                DISPATCH();
             }
-            else if (!bindMethod(vm, instance->klass, name))
+
+            int slot;
+            Value method = findCachedProperty(cache, instance->klass, instance->shape, name, &slot);
+            if (slot >= 0)
+            {
+                push_to(vm, instance->fields[slot], 1);
+            }
+            else if (!bindFoundMethod(vm, method, name))
             {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            break;
+            DISPATCH();
         }
-        case OP_SET_PROPERTY:
+        CASE_CODE(OP_SET_PROPERTY):
         {
             if (!IS_INSTANCE(peek(vm, 1)) && !IS_NATIVE_INSTANCE(peek(vm, 1)))
             {
@@ -909,9 +1228,10 @@ static InterpretResult run(VM *vm)
             }
             ObjInstance *instance = AS_INSTANCE(peek(vm, 1));
             Value propertyName = OBJ_VAL(READ_CONSTANT());
+            InlineCache *cache = READ_INLINE_CACHE();
 #if REF_COUNT_MEM_MANAGEMENT
             Value value;
-            if (tableGet(&instance->fields, propertyName, &value))
+            if (instanceGetField(instance, propertyName, &value))
             {
                 decrementRefCount(value);
             }
@@ -919,12 +1239,40 @@ static InterpretResult run(VM *vm)
 #if REF_COUNT_MEM_MANAGEMENT
             incrementRefCount(peek(vm, 0));
 #endif
-            tableSet(&instance->fields, propertyName, peek(vm, 0));
+            ObjShape *shape = instance->shape;
+            InlineCacheEntry entry;
+            bool cached = instance->dictionary == NULL &&
+                          findInlineCacheEntry(cache, instance->klass, shape, &entry);
+
+            if (!cached)
+            {
+                uint32_t version = CACHE_LOAD_ACQUIRE(instance->klass->cacheVersion);
+                int slot = shapeFindSlot(shape, propertyName);
+                instanceSetField(vm, instance, propertyName, peek(vm, 0));
+                if (instance->dictionary == NULL)
+                {
+                    // Either an existing slot was written, or the field was
+                    // added and the instance moved on to a new shape.
+                    if (slot >= 0)
+                        addInlineCacheEntry(cache, instance->klass, shape, version, slot, NIL_VAL);
+                    else
+                        addInlineCacheEntry(cache, instance->klass, shape, version, instance->shape->fieldCount - 1, OBJ_VAL(instance->shape));
+                }
+            }
+            else if (entry.value == NIL_VAL)
+            {
+                instance->fields[entry.slot] = peek(vm, 0);
+                writeBarrier((Obj *)instance, peek(vm, 0));
+            }
+            else
+            {
+                instanceAddField(instance, AS_SHAPE(entry.value), peek(vm, 0));
+            }
             swapTop(vm);
             pop(vm);
-            break;
+            DISPATCH();
         }
-        case OP_GET_SUPER:
+        CASE_CODE(OP_GET_SUPER):
         {
             Value name = READ_CONSTANT();
             ObjClass *superclass = AS_CLASS(pop(vm));
@@ -932,91 +1280,153 @@ static InterpretResult run(VM *vm)
             {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            break;
+            DISPATCH();
         }
-        case OP_EQUAL:
+        CASE_CODE(OP_EQUAL):
         {
             if (compare_objects(vm, peek(vm, 1), peek(vm, 0)))
                 push_to(vm, TRUE_VAL, 2);
             else
                 push_to(vm, FALSE_VAL, 2);
             pop(vm);
-            break;
+            // A scripted == operator runs as a callback
+            if (vm->pendingException != NIL_VAL)
+            {
+                throwPendingException(vm);
+                frame = updateFrame(vm);
+            }
+            DISPATCH();
+        }
+        CASE_CODE(OP_GREATER):
+            NUMBER_BINARY_OP(BOOL_RESULT, >, OPERATOR_GREATER_THAN);
+            DISPATCH();
+        CASE_CODE(OP_GREATER_EQUAL):
+            NUMBER_BINARY_OP(BOOL_RESULT, >=, OPERATOR_GREATER_EQUAL);
+            DISPATCH();
+        CASE_CODE(OP_LESS):
+            NUMBER_BINARY_OP(BOOL_RESULT, <, OPERATOR_LESS_THAN);
+            DISPATCH();
+        CASE_CODE(OP_LESS_EQUAL):
+            NUMBER_BINARY_OP(BOOL_RESULT, <=, OPERATOR_LESS_EQUAL);
+            DISPATCH();
+        CASE_CODE(OP_LESS_JUMP):
+        {
+            // Always followed by the condition's OP_JUMP_IF_FALSE and OP_POP,
+            // which only run as normal when the '<' operator has to be called.
+            Value b = peek(vm, 0);
+            Value a = peek(vm, 1);
+            if (IS_NUMBER(a) && IS_NUMBER(b))
+            {
+                if (AS_NUMBER(a) < AS_NUMBER(b))
+                {
+                    popMany(vm, 2);
+                    frame->ip += 4;
+                }
+                else
+                {
+                    pop(vm);
+                    push_to(vm, FALSE_VAL, 1);
+                    frame->ip++;
+                    uint16_t offset = READ_SHORT();
+                    frame->ip += offset;
+                }
+            }
+            else
+            {
+                BINARY_OP(OPERATOR_LESS_THAN);
+            }
+            DISPATCH();
         }
-        case OP_GREATER:
-            BINARY_OP(OPERATOR_GREATER_THAN);
-            break;
-        case OP_GREATER_EQUAL:
-            BINARY_OP(OPERATOR_GREATER_EQUAL);
-            break;
-        case OP_LESS:
-            BINARY_OP(OPERATOR_LESS_THAN);
-            break;
-        case OP_LESS_EQUAL:
-            BINARY_OP(OPERATOR_LESS_EQUAL);
-            break;
-        case OP_ADD:
-            BINARY_OP(OPERATOR_PLUS);
-            break;
-        case OP_SUBTRACT:
-            BINARY_OP(OPERATOR_MINUS);
-            break;
-        case OP_MULTIPLY:
-            BINARY_OP(OPERATOR_MULTIPLICATION);
-            break;
-        case OP_DIVIDE:
-            BINARY_OP(OPERATOR_DIVISION);
-            break;
-        case OP_MODULO:
-            BINARY_OP(OPERATOR_MODULO);
-            break;
-        case OP_BITWISE_OR:
+        CASE_CODE(OP_ADD):
+            NUMBER_BINARY_OP(NUMBER_VAL, +, OPERATOR_PLUS);
+            DISPATCH();
+        CASE_CODE(OP_ADD_CONST):
+        {
+            Value constant = READ_CONSTANT();
+            Value a = peek(vm, 0);
+            if (IS_NUMBER(a))
+            {
+                push_to(vm, NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(constant)), 1);
+            }
+            else
+            {
+                push(vm, constant);
+                BINARY_OP(OPERATOR_PLUS);
+            }
+            DISPATCH();
+        }
+        CASE_CODE(OP_SUBTRACT):
+            NUMBER_BINARY_OP(NUMBER_VAL, -, OPERATOR_MINUS);
+            DISPATCH();
+        CASE_CODE(OP_MULTIPLY):
+            NUMBER_BINARY_OP(NUMBER_VAL, *, OPERATOR_MULTIPLICATION);
+            DISPATCH();
+        CASE_CODE(OP_DIVIDE):
+            NUMBER_BINARY_OP(NUMBER_VAL, /, OPERATOR_DIVISION);
+            DISPATCH();
+        CASE_CODE(OP_MODULO):
+        {
+            Value b = peek(vm, 0);
+            Value a = peek(vm, 1);
+            if (IS_NUMBER(a) && IS_NUMBER(b))
+            {
+                pop(vm);
+                push_to(vm, NUMBER_VAL((double)((int64_t)AS_NUMBER(a) % (int64_t)AS_NUMBER(b))), 1);
+            }
+            else
+            {
+                BINARY_OP(OPERATOR_MODULO);
+            }
+            DISPATCH();
+        }
+        CASE_CODE(OP_BITWISE_OR):
             BINARY_OP(OPERATOR_BITWISE_OR);
-            break;
-        case OP_BITWISE_AND:
+            DISPATCH();
+        CASE_CODE(OP_BITWISE_AND):
             BINARY_OP(OPERATOR_BITWISE_AND);
-            break;
-        case OP_BITWISE_XOR:
+            DISPATCH();
+        CASE_CODE(OP_BITWISE_XOR):
             BINARY_OP(OPERATOR_BITWISE_XOR);
-            break;
-        case OP_BITSHIFT_LEFT:
+            DISPATCH();
+        CASE_CODE(OP_BITSHIFT_LEFT):
             BINARY_OP(OPERATOR_BITSHIFT_LEFT);
-            break;
-        case OP_BITSHIFT_RIGHT:
+            DISPATCH();
+        CASE_CODE(OP_BITSHIFT_RIGHT):
             BINARY_OP(OPERATOR_BITSHIFT_RIGHT);
-            break;
-        case OP_NOT:
+            DISPATCH();
+        CASE_CODE(OP_NOT):
         {
             Value result = FALSE_VAL;
             if (bool_is_falsey(pop(vm)))
                 result = TRUE_VAL;
 
             push(vm, result);
-            break;
+            DISPATCH();
         }
-        case OP_NEGATE:
+        CASE_CODE(OP_NEGATE):
             push(vm, create_number(vm, number_get_value(pop(vm)) * -1));
-            break;
-        case OP_JUMP:
+            DISPATCH();
+        CASE_CODE(OP_JUMP):
         {
             uint16_t offset = READ_SHORT();
             frame->ip += offset;
-            break;
+            DISPATCH();
         }
-        case OP_JUMP_IF_FALSE:
+        CASE_CODE(OP_JUMP_IF_FALSE):
         {
             uint16_t offset = READ_SHORT();
             if (bool_is_falsey(peek(vm, 0)))
                 frame->ip += offset;
-            break;
+            DISPATCH();
         }
-        case OP_LOOP:
+        CASE_CODE(OP_LOOP):
         {
             uint16_t offset = READ_SHORT();
             frame->ip -= offset;
-            break;
+            safepoint(vm);
+            DISPATCH();
         }
-        case OP_CALL:
+        CASE_CODE(OP_CALL):
         {
             int argCount = READ_BYTE() + frame->bonusSplatArgCount;
             if (!callValue(vm, peek(vm, argCount), argCount))
@@ -1025,21 +1435,22 @@ static InterpretResult run(VM *vm)
             }
             frame->bonusSplatArgCount = 0;
             frame = updateFrame(vm);
-            break;
+            DISPATCH();
         }
-        case OP_INVOKE:
+        CASE_CODE(OP_INVOKE):
         {
             Value method = READ_CONSTANT();
             int argCount = READ_BYTE() + frame->bonusSplatArgCount;
-            if (!invoke(vm, method, argCount))
+            InlineCache *cache = READ_INLINE_CACHE();
+            if (!invoke(vm, method, argCount, cache))
             {
                 return INTERPRET_RUNTIME_ERROR;
             }
             frame->bonusSplatArgCount = 0;
             frame = updateFrame(vm);
-            break;
+            DISPATCH();
         }
-        case OP_SUPER:
+        CASE_CODE(OP_SUPER):
         {
             int argCount = READ_BYTE();
             Value method = READ_CONSTANT();
@@ -1049,9 +1460,9 @@ static InterpretResult run(VM *vm)
                 return INTERPRET_RUNTIME_ERROR;
             }
             frame = updateFrame(vm);
-            break;
+            DISPATCH();
         }
-        case OP_CLOSURE:
+        CASE_CODE(OP_CLOSURE):
         {
             ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
             uint8_t attributeCount = READ_BYTE();
@@ -1061,6 +1472,7 @@ static InterpretResult run(VM *vm)
             {
                 function->attributes[i] = pop(vm);
             }
+            rememberObject((Obj *)function);
             ObjClosure *closure = newClosure(vm, function);
             for (int i = 0; i < closure->upvalueCount; i++)
             {
@@ -1075,14 +1487,15 @@ static InterpretResult run(VM *vm)
                 {
                     closure->upvalues[i] = frame->closure->upvalues[index];
                 }
+                writeBarrier((Obj *)closure, OBJ_VAL(closure->upvalues[i]));
             }
-            break;
+            DISPATCH();
         }
-        case OP_CLOSE_UPVALUE:
+        CASE_CODE(OP_CLOSE_UPVALUE):
             closeUpvalues(vm, vm->stackTop - 1);
             pop(vm);
-            break;
-        case OP_RETURN:
+            DISPATCH();
+        CASE_CODE(OP_RETURN):
         {
             Value result = peek(vm, 0);
             closeUpvalues(vm, frame->slots);
@@ -1093,19 +1506,15 @@ static InterpretResult run(VM *vm)
             }
 #endif
             vm->frameCount--;
-            if (vm->frameCount == 0)
-            {
-                swapTop(vm);
-                pop(vm);
-                return INTERPRET_OK;
-            }
             *frame->slots = result;
             vm->stackTop = frame->slots+1;
+            if (vm->frameCount == vm->baseFrameCount)
+                return INTERPRET_OK;
             frame = updateFrame(vm);
 
-            break;
+            DISPATCH();
         }
-        case OP_CLASS:
+        CASE_CODE(OP_CLASS):
         {
             push(vm, READ_CONSTANT());
             bool final = READ_BYTE();
@@ -1120,9 +1529,10 @@ static InterpretResult run(VM *vm)
             {
                 klass->attributes[i] = peek(vm, i + 1);
             }
-            break;
+            rememberObject((Obj *)klass);
+            DISPATCH();
         }
-        case OP_INHERIT:
+        CASE_CODE(OP_INHERIT):
         {
             Value super_ = peek(vm, 1);
             if (!(IS_CLASS(super_) || IS_NATIVE_CLASS(super_)))
@@ -1147,16 +1557,18 @@ static InterpretResult run(VM *vm)
                 subclass->operators[i] = superclass->operators[i];
             }
             subclass->super_ = superclass;
+            rememberObject((Obj *)subclass);
+            invalidateInlineCaches(subclass);
             pop(vm); // Subclass.
-            break;
+            DISPATCH();
         }
-        case OP_METHOD:
+        CASE_CODE(OP_METHOD):
             defineMethod(vm, READ_CONSTANT(), false);
-            break;
-        case OP_STATIC_METHOD:
+            DISPATCH();
+        CASE_CODE(OP_STATIC_METHOD):
             defineMethod(vm, READ_CONSTANT(), true);
-            break;
-        case OP_INDEX:
+            DISPATCH();
+        CASE_CODE(OP_INDEX):
         {
             int argCount = READ_BYTE();
             Value receiver = peek(vm, argCount);
@@ -1165,9 +1577,9 @@ static InterpretResult run(VM *vm)
                 return INTERPRET_RUNTIME_ERROR;
             }
             frame = updateFrame(vm);
-            break;
+            DISPATCH();
         }
-        case OP_INDEX_ASSIGN:
+        CASE_CODE(OP_INDEX_ASSIGN):
         {
             int argCount = READ_BYTE();
             Value receiver = peek(vm, argCount);
@@ -1176,53 +1588,53 @@ static InterpretResult run(VM *vm)
                 return INTERPRET_RUNTIME_ERROR;
             }
             frame = updateFrame(vm);
-            break;
+            DISPATCH();
         }
-        case OP_DEFINE_OPERATOR:
+        CASE_CODE(OP_DEFINE_OPERATOR):
         {
             defineOperator(vm, (OPERATOR)READ_BYTE());
-            break;
+            DISPATCH();
         }
-        case OP_THROW:
+        CASE_CODE(OP_THROW):
         {
             Value val = peek(vm, 0);
             exception_set_stacktrace(vm, val, getStackTrace(vm));
             if (propagateException(vm))
             {
                 frame = updateFrame(vm);
-                break;
+                DISPATCH();
             }
             return INTERPRET_RUNTIME_ERROR;
         }
-        case OP_RETHROW:
+        CASE_CODE(OP_RETHROW):
         {
             if (propagateException(vm))
             {
                 frame = updateFrame(vm);
-                break;
+                DISPATCH();
             }
             return INTERPRET_RUNTIME_ERROR;
         }
-        case OP_DUP_TOP:
+        CASE_CODE(OP_DUP_TOP):
         {
             push(vm, peek(vm, 0));
-            break;
+            DISPATCH();
         }
-        case OP_DUP_TWO:
+        CASE_CODE(OP_DUP_TWO):
         {
             push(vm, peek(vm, 1));
             push(vm, peek(vm, 1));
-            break;
+            DISPATCH();
         }
-        case OP_IS:
+        CASE_CODE(OP_IS):
         {
             VALUE rhs = peek(vm, 0);
             VALUE lhs = peek(vm, 1);
             push_to(vm, instanceof(lhs, rhs), 2);
             pop(vm);
-            break;
+            DISPATCH();
         }
-        case OP_PUSH_EXCEPTION_HANDLER:
+        CASE_CODE(OP_PUSH_EXCEPTION_HANDLER):
         {
             uint8_t constantIndex = READ_BYTE();
             VALUE type = NIL_VAL;
@@ -1240,20 +1652,20 @@ static InterpretResult run(VM *vm)
                 }
             }
             pushExceptionHandler(vm, value, handlerAddress, finallyAddress);
-            break;
+            DISPATCH();
         }
-        case OP_POP_EXCEPTION_HANDLER:
+        CASE_CODE(OP_POP_EXCEPTION_HANDLER):
             frame->handlerCount--;
-            break;
-        case OP_PROPAGATE_EXCEPTION:
+            DISPATCH();
+        CASE_CODE(OP_PROPAGATE_EXCEPTION):
             frame->handlerCount--;
             if (propagateException(vm))
             {
                 frame = updateFrame(vm);
-                break;
+                DISPATCH();
             }
             return INTERPRET_RUNTIME_ERROR;
-        case OP_IMPORT:
+        CASE_CODE(OP_IMPORT):
         {
             Value imported = import_from_file(vm, frame->closure->function->chunk.filename, peek(vm, 0));
             if (imported != NIL_VAL)
@@ -1277,16 +1689,16 @@ static InterpretResult run(VM *vm)
                 }
                 pop(vm);
             }
-            break;
+            DISPATCH();
         }
-        case OP_IMPORT_PARAMS:
+        CASE_CODE(OP_IMPORT_PARAMS):
         {
             uint8_t moduleParamCount = READ_BYTE();
             if (moduleParamCount == 0xff)
             {
                 ObjInstance *current = AS_INSTANCE(frame->closure->function->module);
                 ObjInstance *imported = AS_INSTANCE(peek(vm, 0));
-                tableAddAll(&imported->fields, &current->fields);
+                instanceCopyFields(vm, imported, current);
             }
             else
             {
@@ -1309,9 +1721,9 @@ static InterpretResult run(VM *vm)
                 }
             }
             pop(vm); // pop the imported module off the stack
-            break;
+            DISPATCH();
         }
-        case OP_SPLAT:
+        CASE_CODE(OP_SPLAT):
         {
             // This kind of freaks me out - if we get a GC here, it's possible
             // that the list gets free'd.
@@ -1324,75 +1736,126 @@ static InterpretResult run(VM *vm)
             }
             // -1 because we already had "one" argument
             frame->bonusSplatArgCount += (length - 1);
-            break;
+            DISPATCH();
         }
+#if !COMET_COMPUTED_GOTO
         default:
         {
             runtimeError(vm, "Unknown instruction: %u", instruction);
-        }
-        }
-        if (vm->frameCount == 0)
             return INTERPRET_RUNTIME_ERROR;
+        }
+#endif
     }
 
+#if COMET_COMPUTED_GOTO
+record_coverage:
+    RECORD_INSTRUCTION_EXECUTED();
+    goto *dispatchTable[instruction];
+#endif
+
+#undef INTERPRET_LOOP
+#undef CASE_CODE
+#undef DISPATCH
+#undef FETCH_INSTRUCTION
+#undef RECORD_COVERAGE
+#undef RECORD_INSTRUCTION_EXECUTED
+#undef TRACE_INSTRUCTION
+#undef BOOL_RESULT
+#undef NUMBER_BINARY_OP
 #undef BINARY_OP
+#undef READ_MODULE_VAR
+#undef MODULE_WRITE_BARRIER
+#undef READ_INLINE_CACHE
 #undef READ_SHORT
 #undef READ_CONSTANT
 #undef READ_BYTE
 }
 
+// Runs whatever callValue or invoke just set up, in a nested run() that
+// stops once the frame count is back to where it started. Leaves the result
+// on the stack in place of the receiver.
+static InterpretResult runCallback(VM *vm)
+{
+    if (vm->frameCount == vm->baseFrameCount)
+        return INTERPRET_OK; // a native was called, the result is already there
+    return run(vm);
+}
+
 void call_function(VM *vm, VALUE receiver, VALUE method, int arg_count, VALUE *arguments)
 {
-    VM *frame = (VM *)malloc(sizeof(VM));
-    initVM(frame);
-    push(frame, method);
-    push(frame, receiver);
-    for (int i = 0; i < arg_count; i++)
+    // Once a callback has thrown, nothing else runs until the native that
+    // made the call has returned and the exception has been rethrown.
+    if (vm->pendingException != NIL_VAL)
     {
-        push(frame, arguments[i]);
+        push(vm, NIL_VAL);
+        return;
     }
-    if (IS_BOUND_METHOD(method) || IS_CLOSURE(method) || IS_FUNCTION(method))
+
+    // The callback runs on this thread's own stack, above everything the
+    // caller has on it, so the caller's frames stay untouched underneath.
+    Value *stackBase = vm->stackTop;
+    int enclosingBaseFrameCount = vm->baseFrameCount;
+    vm->baseFrameCount = vm->frameCount;
+
+    InterpretResult result = INTERPRET_RUNTIME_ERROR;
+    Value value = NIL_VAL;
+    // Room for the callee, receiver and arguments, and a frame's worth of
+    // slots for the callee's locals or for throwing the exception below
+    if (vm->stackTop + arg_count + 2 + MAX_VAR_COUNT > vm->stack + STACK_MAX)
+    {
+        throw_exception_native(vm, "InvokeException", "Stack overflow.");
+    }
+    else
     {
-        if (callValue(frame, method, arg_count) && run(frame) == INTERPRET_OK)
+        push(vm, method);
+        push(vm, receiver);
+        for (int i = 0; i < arg_count; i++)
         {
-            push(vm, peek(frame, 0));
+            push(vm, arguments[i]);
         }
-        else
+
+        if (IS_BOUND_METHOD(method) || IS_CLOSURE(method) || IS_FUNCTION(method))
         {
-            push(vm, NIL_VAL);
-            throw_exception_native(vm, "InvokeException", "Function call failed");
+            if (callValue(vm, method, arg_count))
+                result = runCallback(vm);
         }
-    }
-    else if (IS_NATIVE_METHOD(method))
-    {
-        push(vm, AS_NATIVE_METHOD(method)->function(frame, receiver, arg_count, arguments));
-    }
-    else if (invoke(frame, method, arg_count))
-    {
-        if (run(frame) == INTERPRET_OK)
+        else if (IS_NATIVE_METHOD(method))
         {
-            push(vm, peek(frame, 0));
+            value = AS_NATIVE_METHOD(method)->function(vm, receiver, arg_count, arguments);
+            push(vm, value);
+            result = INTERPRET_OK;
         }
-        else
+        else if (invoke(vm, method, arg_count, NULL))
         {
-            push(vm, NIL_VAL);
-            throw_exception_native(vm, "InvokeException", "Function call failed");
+            result = runCallback(vm);
         }
     }
-    else
+
+    if (result == INTERPRET_OK)
     {
-        push(vm, NIL_VAL);
+        value = peek(vm, 0);
+    }
+    else if (vm->pendingException == NIL_VAL)
+    {
+        // Thrown from the callback's own level, so that like any exception it
+        // didn't catch, it is rethrown once the native has returned.
+        vm->frameCount = vm->baseFrameCount;
         if (isObjOfStdlibClassType(method, CLS_STRING))
         {
-            runtimeError(vm, "Function call failed: %s", string_get_cstr(method));
+            throw_exception_native(vm, "InvokeException", "Function call failed: %s", string_get_cstr(method));
         }
         else
         {
-            runtimeError(vm, "Function call failed");
+            throw_exception_native(vm, "InvokeException", "Function call failed");
         }
     }
-    deregister_thread(frame);
-    free(frame);
+    // Anything the callback left behind goes, including upvalues still open
+    // on frames that were abandoned by an error.
+    closeUpvalues(vm, stackBase);
+    vm->frameCount = vm->baseFrameCount;
+    vm->baseFrameCount = enclosingBaseFrameCount;
+    vm->stackTop = stackBase;
+    push(vm, value);
 }
 
 InterpretResult interpret(VM *vm, Value main)
@@ -7,7 +7,9 @@
 #include "value.h"
 #include "common.h"
 
-#define FRAMES_MAX 64
+// Callbacks from natives run on their caller's frames and stack, so this
+// covers the script's own recursion plus any callbacks nested inside it
+#define FRAMES_MAX 256
 #define STACK_MAX (FRAMES_MAX * MAX_VAR_COUNT)
 
 typedef struct {
@@ -30,9 +32,25 @@ struct _vm
 {
     CallFrame frames[FRAMES_MAX];
     int frameCount;
+    // Natives call back into scripts with a nested run() on the same stack,
+    // which returns once the frame count drops back to this. 0 outside of
+    // any callback.
+    int baseFrameCount;
+    // An exception that unwound a callback's frames without being caught. It
+    // is rethrown when the native that ran the callback returns. NIL_VAL
+    // otherwise.
+    Value pendingException;
     Value stack[STACK_MAX];
     Value *stackTop;
     ObjUpvalue *openUpvalues;
+#if COMET_COUNT_INSTRUCTIONS
+    uint64_t instructionCount;
+#endif
+    // Objects allocated on this thread since the last collection
+    Obj *youngObjects;
+    // Non zero while the thread is stopped at a safepoint or is in a safe
+    // region, where a collection on another thread can run without it
+    volatile int parked;
 };
 
 typedef enum
@@ -63,8 +81,8 @@ void initVM(VM *vm);
 void freeVM(VM *vm);
 
 Value findInternedString(const char *chars, uint32_t hash);
-
-bool internString(Value string);
+// The interned string equal to string, which is interned if there isn't one
+Value internString(Value string);
 void addModule(Value module, Value filename);
 bool findModule(Value filename,  Value *module);
 void getAllModules(VM *vm, Value list);
@@ -1,7 +1,27 @@
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+
 #include "vm.h"
 #include "mem.h"
+#include "comet.h"
+
+// Any thread can intern a string. The lock is never held while allocating,
+// a collection could be waiting for the thread holding it to stop.
+#ifdef WIN32
+static CRITICAL_SECTION strings_lock;
+#define STRINGS_LOCK() EnterCriticalSection(&strings_lock)
+#define STRINGS_UNLOCK() LeaveCriticalSection(&strings_lock)
+#else
+static pthread_mutex_t strings_lock = PTHREAD_MUTEX_INITIALIZER;
+#define STRINGS_LOCK() pthread_mutex_lock(&strings_lock)
+#define STRINGS_UNLOCK() pthread_mutex_unlock(&strings_lock)
+#endif
 
 static Table globals;
+// Weak, strings no longer reachable are removed by removeWhiteStrings()
 static Table strings;
 static Table modules;
 Value common_strings[NUM_COMMON_STRINGS];
@@ -10,6 +30,9 @@ void initGlobals(void)
 {
     initTable(&globals);
     initTable(&strings);
+#ifdef WIN32
+    InitializeCriticalSection(&strings_lock);
+#endif
     initTable(&modules);
 }
 
@@ -18,6 +41,9 @@ void freeGlobals(void)
     freeTable(&globals);
     freeTable(&strings);
     freeTable(&modules);
+#ifdef WIN32
+    DeleteCriticalSection(&strings_lock);
+#endif
     for (int i = 0; i < NUM_COMMON_STRINGS; i++)
     {
         common_strings[i] = NIL_VAL;
@@ -27,7 +53,6 @@ void freeGlobals(void)
 void markGlobals(void)
 {
     markTable(&globals);
-    markTable(&strings);
     markTable(&modules);
     for (int i = 0; i < NUM_COMMON_STRINGS; i++)
     {
@@ -45,12 +70,46 @@ void removeWhiteStrings(void)
 
 Value findInternedString(const char *chars, uint32_t hash)
 {
-    return tableFindString(&strings, chars, hash);
+    STRINGS_LOCK();
+    Value interned = tableFindString(&strings, chars, hash);
+    STRINGS_UNLOCK();
+    return interned;
 }
 
-bool internString(Value string)
+Value internString(Value string)
 {
-    return tableSet(&strings, string, NIL_VAL);
+    if (string_is_interned(string))
+        return string;
+
+    // Both can allocate for a rope, so they're worked out before locking
+    const char *chars = string_get_cstr(string);
+    uint32_t hash = string_get_hash(string);
+    for (;;)
+    {
+        STRINGS_LOCK();
+        Value interned = tableFindString(&strings, chars, hash);
+        if (interned == NIL_VAL && tableSetWithoutGrowing(&strings, string, hash, NIL_VAL))
+        {
+            string_set_interned(string);
+            interned = string;
+        }
+        int capacity = strings.capacity;
+        int grownCapacity = tableGrownCapacity(&strings);
+        STRINGS_UNLOCK();
+        if (interned != NIL_VAL)
+            return interned;
+
+        Entry *entries = tableAllocateEntries(grownCapacity);
+        STRINGS_LOCK();
+        // Unless another thread got there first
+        if (strings.capacity == capacity)
+        {
+            entries = tableReplaceEntries(&strings, entries, grownCapacity);
+            grownCapacity = capacity;
+        }
+        STRINGS_UNLOCK();
+        FREE_ARRAY(Entry, entries, grownCapacity + 1);
+    }
 }
 
 bool findGlobal(Value name, Value *value)
@@ -66,13 +125,18 @@ bool addGlobal(Value name, Value value)
 bool findModuleVariable(Value module, Value name, Value *value)
 {
     ObjInstance *instance = AS_INSTANCE(module);
-    return tableGet(&instance->fields, name, value);
+    return instanceGetField(instance, name, value);
 }
 
 bool addModuleVariable(Value module, Value name, Value value)
 {
+    // Modules always keep their variables in a dictionary, see module_create
     ObjInstance *instance = AS_INSTANCE(module);
-    return tableSet(&instance->fields, name, value);
+    int slot = instanceReserveField(instance, name);
+    bool isNewVariable = instance->fields[slot] == UNDEFINED_VAL;
+    instance->fields[slot] = value;
+    writeBarrier((Obj *)instance, value);
+    return isNewVariable;
 }
 
 void addModule(Value module, Value filename)